@@ -0,0 +1,229 @@
+// Микробенчмарки: tokenize, разбор, diff, optimize, подсчет (дерево, программа, машинный код) и печать для double и complex<double>
+// на синтетических нагрузках (широкие суммы, глубокая вложенность, старшие производные, пакетный подсчет).
+// Результаты - JSON (stdout или --out), таблица - в stderr. Сравнивать прогоны удобно по полю name.
+//   bench_ [--filter подстрока] [--scale N] [--min-time секунды] [--out файл]
+// --scale умножает размеры нагрузок. Имеет смысл только в сборке с -DCMAKE_BUILD_TYPE=Release.
+#include "Batch.h"
+#include "Jit.h"
+#include "Parser.h"
+#include "Simplify.h"
+#include "Tokenator.h"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifndef EXPRESSION_BUILD_TYPE
+#define EXPRESSION_BUILD_TYPE ""
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+using C = std::complex<double>;
+
+// Не дает компилятору выбросить результат
+template <typename V>
+void keep(V &&value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+struct Options {
+    std::string filter;
+    std::size_t scale = 1;
+    double min_time = 0.5; // секунд на один бенчмарк
+    std::string out;
+};
+
+struct Result {
+    std::string name;
+    std::string type;
+    std::size_t size;        // размер нагрузки (слагаемых, уровней, строк)
+    std::size_t iterations;  // всего замерено
+    double ns_per_iter;      // медиана по выборкам
+    double min_ns_per_iter;
+    double items_per_second; // size / ns_per_iter
+};
+
+class Runner {
+    Options options;
+    std::vector<Result> results;
+    static constexpr int samples = 5;
+
+public:
+    explicit Runner(Options options) : options(std::move(options)) {}
+
+    template <typename Body>
+    void run(const std::string &name, const std::string &type, const std::size_t size, Body &&body) {
+        if (!options.filter.empty() && (name + "/" + type).find(options.filter) == std::string::npos) return;
+        auto measure = [&](const std::size_t n) {
+            const auto start = Clock::now();
+            for (std::size_t i = 0; i < n; i++) body();
+            return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        };
+        // Подбор числа повторов, чтобы одна выборка шла не меньше min_time / samples
+        const double target = options.min_time * 1e9 / samples;
+        std::size_t n = 1;
+        for (double elapsed = measure(n); elapsed < target && n < (std::size_t(1) << 40); elapsed = measure(n)) {
+            n = elapsed <= 0 ? n * 10 : std::max(n + 1, std::min(n * 10, static_cast<std::size_t>(n * target / elapsed * 1.2)));
+        }
+        std::vector<double> per_iter;
+        for (int i = 0; i < samples; i++) per_iter.push_back(measure(n) / static_cast<double>(n));
+        std::sort(per_iter.begin(), per_iter.end());
+        const double median = per_iter[samples / 2];
+        results.push_back({name, type, size, n * samples, median, per_iter.front(),
+                           median > 0 ? static_cast<double>(size) * 1e9 / median : 0});
+        std::fprintf(stderr, "%-28s %-8s %9zu %14.1f ns %14.0f items/s\n", name.c_str(), type.c_str(), size, median,
+                     results.back().items_per_second);
+    }
+
+    void write_json(std::ostream &out) const {
+        auto quoted = [](const std::string &text) {
+            std::string result = "\"";
+            for (const char c : text) {
+                if (c == '"' || c == '\\') result += '\\';
+                result += c;
+            }
+            return result + "\"";
+        };
+        char date[32];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        out << "{\n  \"context\": {\"date\": " << quoted(date) << ", \"compiler\": "
+#if defined(__VERSION__)
+            << quoted(__VERSION__)
+#else
+            << quoted("unknown")
+#endif
+            << ", \"build_type\": " << quoted(EXPRESSION_BUILD_TYPE) << ", \"scale\": " << options.scale
+            << ", \"min_time\": " << options.min_time << "},\n  \"benchmarks\": [";
+        for (std::size_t i = 0; i < results.size(); i++) {
+            const auto &r = results[i];
+            out << (i ? ",\n" : "\n") << "    {\"name\": " << quoted(r.name) << ", \"type\": " << quoted(r.type)
+                << ", \"size\": " << r.size << ", \"iterations\": " << r.iterations << ", \"ns_per_iter\": " << r.ns_per_iter
+                << ", \"min_ns_per_iter\": " << r.min_ns_per_iter << ", \"items_per_second\": " << r.items_per_second << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+// Широкая сумма из n слагаемых по x, y, z
+std::string wide_sum(const std::size_t n) {
+    static const char *terms[] = {"1.5 * x", "sin(y) * x", "x^2 / (z + 3)", "exp(0.5 * z) - y", "ln(x + 2) * cos(z)"};
+    std::string text;
+    for (std::size_t i = 0; i < n; i++) {
+        if (i) text += " + ";
+        text += terms[i % std::size(terms)];
+    }
+    return text;
+}
+
+// Вложенность глубиной n: функции и скобки по очереди
+std::string deep_nesting(const std::size_t n) {
+    static const char *open[] = {"sin(", "(", "ln(2 + "};
+    static const char *close[] = {")", " + y) * 0.5", ")"};
+    std::string text;
+    for (std::size_t i = 0; i < n; i++) text += open[i % 3];
+    text += "x";
+    for (std::size_t i = n; i-- > 0;) text += close[i % 3];
+    return text;
+}
+
+template <typename T>
+void run_type(Runner &runner, const std::string &type, const std::size_t scale) {
+    const std::map<std::string, T> params{{"x", T(0.7)}, {"y", T(1.3)}, {"z", T(-0.4)}};
+    std::string x = "x";
+
+    for (const auto &[shape, size, text] : {std::tuple{std::string("wide"), 2000 * scale, wide_sum(2000 * scale)},
+                                            std::tuple{std::string("deep"), 1000 * scale, deep_nesting(1000 * scale)}}) {
+        const std::string_view view(text);
+        if constexpr (std::is_same_v<T, double>) { // лексеру тип не важен
+            runner.run("tokenize/" + shape, "any", size, [&] { keep(tokenize(view)); });
+        }
+        runner.run("parse/" + shape, type, size, [&] { keep(Parser<T>(view).parse()); });
+
+        const auto expr = Parser<T>(view).parse();
+        runner.run("diff/" + shape, type, size, [&] { keep(expr->diff(x)); });
+        runner.run("optimize/" + shape, type, size, [&] { keep(optimize(expr)); });
+        runner.run("eval_tree/" + shape, type, size, [&] { keep(expr->eval(params)); });
+        const auto program = compile(expr);
+        const auto values = program.bind(params);
+        runner.run("eval_program/" + shape, type, size, [&] { keep(program.eval(std::span<const T>(values))); });
+        if constexpr (std::is_same_v<T, double>) {
+            const NativeProgram native(program);
+            runner.run("eval_native/" + shape, type, size, [&] { keep(native.eval(std::span<const T>(values))); });
+        }
+        runner.run("to_string/" + shape, type, size, [&] { keep(expr->to_string()); });
+        runner.run("print_minimal/" + shape, type, size, [&] { keep(print(expr)); });
+    }
+
+    // Старшие производные: каждая следующая берется от упрощенной предыдущей
+    const auto base = Parser<T>(std::string_view("sin(x) * exp(x * y) / (x^2 + 1)")).parse();
+    for (std::size_t order = 1; order <= 4; order++) {
+        runner.run("diff_order/" + std::to_string(order), type, order, [&] {
+            auto derivative = base;
+            for (std::size_t k = 0; k < order; k++) derivative = simplify(derivative->diff(x));
+            keep(derivative);
+        });
+    }
+
+    // Пакетный подсчет по столбцам
+    const std::size_t rows = (std::size_t(1) << 16) * scale;
+    const auto program = compile(Parser<T>(std::string_view(wide_sum(10))).parse());
+    std::vector<std::vector<T>> data(program.get_variables().size(), std::vector<T>(rows));
+    for (std::size_t slot = 0; slot < data.size(); slot++) {
+        for (std::size_t i = 0; i < rows; i++) data[slot][i] = T(0.5 + 0.001 * static_cast<double>(i % 997) + slot);
+    }
+    std::vector<std::span<const T>> columns(data.begin(), data.end());
+    std::vector<T> out(rows);
+    BatchScratch<T> scratch;
+    runner.run("eval_batch/rows", type, rows, [&] {
+        eval_batch(program, std::span<const std::span<const T>>(columns), std::span<T>(out), scratch);
+        keep(out.front());
+    });
+}
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    try {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            const std::string value = argv[++i];
+            if (arg == "--filter") options.filter = value;
+            else if (arg == "--scale") options.scale = std::max<std::size_t>(1, std::stoul(value));
+            else if (arg == "--min-time") options.min_time = std::stod(value);
+            else if (arg == "--out") options.out = value;
+            else throw std::runtime_error("Unknown argument: " + arg);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\nUsage: bench_ [--filter text] [--scale N] [--min-time seconds] [--out file]"
+                  << std::endl;
+        return 1;
+    }
+
+    Runner runner(options);
+    run_type<double>(runner, "double", options.scale);
+    run_type<C>(runner, "complex", options.scale);
+
+    if (options.out.empty()) {
+        runner.write_json(std::cout);
+    } else {
+        std::ofstream out(options.out);
+        runner.write_json(out);
+        if (!out) {
+            std::cerr << "Cannot write file: " << options.out << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Генератор нагрузки для differentiator --serve: несколько соединений шлют call-запросы подряд
+// (не больше --pipeline без ответа на каждое) и замеряют задержку каждого ответа.
+//   loadgen <сокет> [--expr "..."] [--requests N] [--pipeline N] [--connections N]
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string socket;
+    std::string expr = "sin(x) * exp(y) + x^2 / (y + 2)";
+    std::size_t requests = 100000; // на соединение
+    std::size_t pipeline = 32;
+    std::size_t connections = 1;
+};
+
+class Client {
+    int fd;
+    std::string in;
+
+public:
+    explicit Client(const std::string &path) : fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (fd < 0 || path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Bad socket: " + path);
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+            throw std::runtime_error("Cannot connect to " + path + ": " + std::strerror(errno));
+        }
+    }
+    ~Client() { ::close(fd); }
+
+    void send(const std::string &text) {
+        for (std::size_t done = 0; done < text.size();) {
+            const auto sent = ::send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+            if (sent <= 0) throw std::runtime_error("Connection lost");
+            done += static_cast<std::size_t>(sent);
+        }
+    }
+
+    // Все полные строки, пришедшие к этому моменту (блокируется, пока не придет хотя бы одна)
+    std::size_t receive(std::vector<std::string> &lines) {
+        lines.clear();
+        char chunk[1 << 16];
+        while (lines.empty()) {
+            const auto got = ::read(fd, chunk, sizeof(chunk));
+            if (got <= 0) throw std::runtime_error("Connection lost");
+            in.append(chunk, static_cast<std::size_t>(got));
+            std::size_t start = 0;
+            for (auto end = in.find('\n'); end != std::string::npos; end = in.find('\n', start)) {
+                lines.emplace_back(in, start, end - start);
+                start = end + 1;
+            }
+            in.erase(0, start);
+        }
+        return lines.size();
+    }
+};
+
+void run_connection(const Options &options, const unsigned seed, std::vector<double> &latencies) {
+    Client client(options.socket);
+    std::vector<std::string> lines;
+    client.send("def " + options.expr + "\n");
+    client.receive(lines);
+    if (!lines.front().starts_with("ok ")) throw std::runtime_error("def failed: " + lines.front());
+    // ok <handle> <переменные>
+    std::size_t handle = 0, variables = 0;
+    {
+        std::size_t pos = 3;
+        handle = std::stoull(lines.front().substr(pos));
+        for (auto space = lines.front().find(' ', pos); space != std::string::npos; space = lines.front().find(' ', space + 1)) {
+            variables++;
+        }
+    }
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> value(0.5, 2.0);
+    std::deque<Clock::time_point> in_flight;
+    std::size_t sent = 0, received = 0;
+    latencies.reserve(options.requests);
+    while (received < options.requests) {
+        std::string batch;
+        while (sent < options.requests && in_flight.size() < options.pipeline) {
+            batch += "call " + std::to_string(handle);
+            for (std::size_t v = 0; v < variables; v++) batch += ' ' + std::to_string(value(random));
+            batch += '\n';
+            in_flight.push_back(Clock::now());
+            sent++;
+        }
+        if (!batch.empty()) client.send(batch);
+        client.receive(lines);
+        const auto now = Clock::now();
+        for (const auto &line : lines) {
+            if (line.starts_with("error")) throw std::runtime_error(line);
+            latencies.push_back(std::chrono::duration<double, std::micro>(now - in_flight.front()).count());
+            in_flight.pop_front();
+            received++;
+        }
+    }
+}
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: loadgen <socket> [--expr E] [--requests N] [--pipeline N] [--connections N]" << std::endl;
+        return 1;
+    }
+    Options options;
+    options.socket = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string arg = argv[i];
+        if (arg == "--expr") options.expr = argv[i + 1];
+        else if (arg == "--requests") options.requests = std::stoull(argv[i + 1]);
+        else if (arg == "--pipeline") options.pipeline = std::max<std::size_t>(1, std::stoull(argv[i + 1]));
+        else if (arg == "--connections") options.connections = std::max<std::size_t>(1, std::stoull(argv[i + 1]));
+        else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::vector<double>> latencies(options.connections);
+    std::vector<std::string> errors(options.connections);
+    const auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t c = 0; c < options.connections; c++) {
+        threads.emplace_back([&, c] {
+            try {
+                run_connection(options, static_cast<unsigned>(c + 1), latencies[c]);
+            } catch (const std::exception &e) {
+                errors[c] = e.what();
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (const auto &error : errors) {
+        if (!error.empty()) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<double> all;
+    for (const auto &part : latencies) all.insert(all.end(), part.begin(), part.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](const double p) { return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<std::size_t>(p * all.size()))]; };
+    std::cout << "requests: " << all.size() << ", time: " << seconds << " s, throughput: " << all.size() / seconds
+              << " req/s, p50: " << percentile(0.5) << " us, p99: " << percentile(0.99) << " us" << std::endl;
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "Profile.h"
+#include <memory>
+#include <memory_resource>
+
+// Арена для узлов выражений: все узлы одной сессии (разбор, diff, optimize) лежат подряд
+// в больших блоках и освобождаются разом вместе с ареной. Узел и его счетчик ссылок
+// размещаются одним выделением.
+// Арена должна пережить все созданные в ней узлы и все weak_ptr на них (в том числе записи DiffCache).
+class ExpressionArena {
+    std::pmr::monotonic_buffer_resource memory;
+    std::size_t nodes = 0;
+
+public:
+    explicit ExpressionArena(const std::size_t initial_bytes = 64 * 1024) : memory(initial_bytes) {}
+    ExpressionArena(const ExpressionArena &other) = delete;
+    ExpressionArena &operator=(const ExpressionArena &other) = delete;
+
+    std::pmr::memory_resource *resource() { return &memory; }
+    std::size_t node_count() const { return nodes; }
+    void count_node() { nodes++; }
+
+    // Арена, в которую сейчас попадают новые узлы этого потока (nullptr - обычная куча)
+    static ExpressionArena *&current() {
+        thread_local ExpressionArena *active = nullptr;
+        return active;
+    }
+};
+
+// Пока объект жив, новые узлы этого потока создаются в арене
+class ArenaScope {
+    ExpressionArena *previous;
+
+public:
+    explicit ArenaScope(ExpressionArena &arena) : previous(ExpressionArena::current()) {
+        ExpressionArena::current() = &arena;
+    }
+    ~ArenaScope() { ExpressionArena::current() = previous; }
+    ArenaScope(const ArenaScope &other) = delete;
+    ArenaScope &operator=(const ArenaScope &other) = delete;
+};
+
+// Создание узла: в активной арене, если она есть, иначе через make_shared
+template <typename Node, typename... Args>
+std::shared_ptr<Node> make_node(Args &&...args) {
+    if (auto *profiler = Profiler::active()) [[unlikely]] profiler->count_node();
+    if (auto *arena = ExpressionArena::current()) {
+        arena->count_node();
+        return std::allocate_shared<Node>(std::pmr::polymorphic_allocator<Node>(arena->resource()),
+                                          std::forward<Args>(args)...);
+    }
+    return std::make_shared<Node>(std::forward<Args>(args)...);
+}
+
+#endif // ARENA_H
@@ -0,0 +1,203 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Program.h"
+#include <algorithm>
+
+// Пакетный подсчет: одна программа применяется сразу к блоку точек.
+// Входы - столбцы значений (по столбцу на слот переменной), каждая инструкция выполняется
+// циклом по всему блоку, такие циклы компилятор векторизует (AVX2/AVX-512 при EXPRESSION_NATIVE).
+// Для std::complex<double> регистры хранятся раздельно: действительные и мнимые части в своих полосах.
+
+constexpr std::size_t batch_block = 256; // точек в блоке
+
+template <typename T>
+constexpr bool is_complex_v = std::is_same_v<T, std::complex<double>>;
+
+// Рабочая память пакетного подсчета, переиспользуется между вызовами
+template <typename T>
+class BatchScratch {
+    std::vector<double> lanes;
+
+public:
+    double *reserve(const Program<T> &program) {
+        const std::size_t need = program.get_registers() * batch_block * (is_complex_v<T> ? 2 : 1);
+        if (lanes.size() < need) lanes.resize(need);
+        return lanes.data();
+    }
+};
+
+namespace batch_kernels {
+    inline void fill(double *d, const double c, const std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) d[i] = c;
+    }
+    inline void add(double *d, const double *x, const double *y, const std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) d[i] = x[i] + y[i];
+    }
+    inline void sub(double *d, const double *x, const double *y, const std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) d[i] = x[i] - y[i];
+    }
+    inline void mul(double *d, const double *x, const double *y, const std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) d[i] = x[i] * y[i];
+    }
+    inline void div(double *d, const double *x, const double *y, const std::size_t n) {
+        bool zero = false;
+        for (std::size_t i = 0; i < n; i++) zero |= y[i] == 0.0;
+        if (zero) throw std::runtime_error("Division by zero");
+        for (std::size_t i = 0; i < n; i++) d[i] = x[i] / y[i];
+    }
+    template <typename F>
+    void map(double *d, const double *x, const std::size_t n, F f) {
+        for (std::size_t i = 0; i < n; i++) d[i] = f(x[i]);
+    }
+
+    // Комплексные полосы: (dr, di) = (xr, xi) (op) (yr, yi); n <= batch_block.
+    // Формула (ac - bd, ad + bc) совпадает с std::complex для конечных результатов; точки, где обе части
+    // вышли NaN (бесконечности, переполнение), пересчитываются через std::complex с его правилами Annex G.
+    // Результат копится отдельно: dr может совпадать с xr или yr, а входы нужны для пересчета.
+    inline void cmul(double *dr, double *di, const double *xr, const double *xi,
+                     const double *yr, const double *yi, const std::size_t n) {
+        double re[batch_block], im[batch_block];
+        bool recompute = false;
+        for (std::size_t i = 0; i < n; i++) {
+            re[i] = xr[i] * yr[i] - xi[i] * yi[i];
+            im[i] = xr[i] * yi[i] + xi[i] * yr[i];
+            recompute |= re[i] != re[i] && im[i] != im[i];
+        }
+        if (recompute) [[unlikely]] {
+            for (std::size_t i = 0; i < n; i++) {
+                if (re[i] == re[i] || im[i] == im[i]) continue;
+                const auto r = std::complex<double>(xr[i], xi[i]) * std::complex<double>(yr[i], yi[i]);
+                re[i] = r.real();
+                im[i] = r.imag();
+            }
+        }
+        std::copy_n(re, n, dr);
+        std::copy_n(im, n, di);
+    }
+    // Остальное считается поточечно через std::complex, чтобы совпадать со скалярным eval
+    template <typename F>
+    void cmap(double *dr, double *di, const double *xr, const double *xi,
+              const double *yr, const double *yi, const std::size_t n, F f) {
+        for (std::size_t i = 0; i < n; i++) {
+            const auto r = f(std::complex<double>(xr[i], xi[i]), std::complex<double>(yr[i], yi[i]));
+            dr[i] = r.real();
+            di[i] = r.imag();
+        }
+    }
+}
+
+// Подсчет одного блока из n <= batch_block точек, начиная с позиции offset во входных столбцах
+template <typename T>
+void eval_block(const Program<T> &program, std::span<const std::span<const T>> columns,
+                const std::size_t offset, const std::size_t n, std::span<T> out, BatchScratch<T> &scratch) {
+    using namespace batch_kernels;
+    double *lanes = scratch.reserve(program);
+    const auto &constants = program.get_constants();
+
+    if constexpr (!is_complex_v<T>) {
+        auto reg = [&](const std::uint32_t r) { return lanes + r * batch_block; };
+        for (const auto &ins : program.get_code()) {
+            double *d = reg(ins.dst);
+            // у OP_CONST и OP_VAR поле a - не регистр
+            const double *x = ins.code >= OP_ADD ? reg(ins.a) : lanes;
+            const double *y = reg(ins.b);
+            switch (ins.code) {
+                case OP_CONST: fill(d, constants[ins.a], n); break;
+                case OP_VAR: std::copy_n(columns[ins.a].data() + offset, n, d); break;
+                case OP_ADD: add(d, x, y, n); break;
+                case OP_SUB: sub(d, x, y, n); break;
+                case OP_MUL: mul(d, x, y, n); break;
+                case OP_DIV: div(d, x, y, n); break;
+                case OP_POW:
+                    for (std::size_t i = 0; i < n; i++) d[i] = std::pow(x[i], y[i]);
+                    break;
+                case OP_SIN: map(d, x, n, [](const double v) { return std::sin(v); }); break;
+                case OP_COS: map(d, x, n, [](const double v) { return std::cos(v); }); break;
+                case OP_LN: map(d, x, n, [](const double v) { return std::log(v); }); break;
+                case OP_EXP: map(d, x, n, [](const double v) { return std::exp(v); }); break;
+                default: throw std::runtime_error("Unknown instruction");
+            }
+        }
+        std::copy_n(reg(program.get_result()), n, out.data() + offset);
+    } else {
+        auto re = [&](const std::uint32_t r) { return lanes + 2 * r * batch_block; };
+        auto im = [&](const std::uint32_t r) { return lanes + (2 * r + 1) * batch_block; };
+        using C = std::complex<double>;
+        for (const auto &ins : program.get_code()) {
+            double *dr = re(ins.dst), *di = im(ins.dst);
+            const std::uint32_t a = ins.code >= OP_ADD ? ins.a : 0;
+            const double *xr = re(a), *xi = im(a);
+            const double *yr = re(ins.b), *yi = im(ins.b);
+            switch (ins.code) {
+                case OP_CONST:
+                    fill(dr, constants[ins.a].real(), n);
+                    fill(di, constants[ins.a].imag(), n);
+                    break;
+                case OP_VAR: {
+                    const C *column = columns[ins.a].data() + offset;
+                    for (std::size_t i = 0; i < n; i++) {
+                        dr[i] = column[i].real();
+                        di[i] = column[i].imag();
+                    }
+                    break;
+                }
+                case OP_ADD: add(dr, xr, yr, n); add(di, xi, yi, n); break;
+                case OP_SUB: sub(dr, xr, yr, n); sub(di, xi, yi, n); break;
+                case OP_MUL: cmul(dr, di, xr, xi, yr, yi, n); break;
+                case OP_DIV: {
+                    bool zero = false;
+                    for (std::size_t i = 0; i < n; i++) zero |= yr[i] == 0.0 && yi[i] == 0.0;
+                    if (zero) throw std::runtime_error("Division by zero");
+                    cmap(dr, di, xr, xi, yr, yi, n, [](const C a, const C b) { return a / b; });
+                    break;
+                }
+                case OP_POW: cmap(dr, di, xr, xi, yr, yi, n, [](const C a, const C b) { return std::pow(a, b); }); break;
+                case OP_SIN: cmap(dr, di, xr, xi, xr, xi, n, [](const C a, C) { return std::sin(a); }); break;
+                case OP_COS: cmap(dr, di, xr, xi, xr, xi, n, [](const C a, C) { return std::cos(a); }); break;
+                case OP_LN: cmap(dr, di, xr, xi, xr, xi, n, [](const C a, C) { return std::log(a); }); break;
+                case OP_EXP: cmap(dr, di, xr, xi, xr, xi, n, [](const C a, C) { return std::exp(a); }); break;
+                default: throw std::runtime_error("Unknown instruction");
+            }
+        }
+        const double *rr = re(program.get_result()), *ri = im(program.get_result());
+        for (std::size_t i = 0; i < n; i++) out[offset + i] = C(rr[i], ri[i]);
+    }
+}
+
+// Подсчет по всем точкам: columns[slot] - значения переменной program.get_variables()[slot]
+template <typename T>
+void eval_batch(const Program<T> &program, std::span<const std::span<const T>> columns, std::span<T> out,
+                BatchScratch<T> &scratch) {
+    if (columns.size() < program.get_variables().size()) throw std::runtime_error("Not enough input columns");
+    for (std::size_t slot = 0; slot < program.get_variables().size(); slot++) {
+        if (columns[slot].size() < out.size()) throw std::runtime_error("Input column is too short");
+    }
+    profile_phase(PHASE_EVAL, program.get_code().size() * out.size(), [&] {
+        for (std::size_t offset = 0; offset < out.size(); offset += batch_block) {
+            eval_block(program, columns, offset, std::min(batch_block, out.size() - offset), out, scratch);
+        }
+    });
+}
+
+template <typename T>
+void eval_batch(const Program<T> &program, std::span<const std::span<const T>> columns, std::span<T> out) {
+    BatchScratch<T> scratch;
+    eval_batch(program, columns, out, scratch);
+}
+
+// Вариант с именованными столбцами прямо для дерева
+template <typename T>
+void eval_batch(const std::shared_ptr<Expression<T>> &expr,
+                const std::map<std::string, std::span<const T>> &columns, std::span<T> out) {
+    auto program = compile(expr);
+    std::vector<std::span<const T>> by_slot;
+    for (const auto &name : program.get_variables()) {
+        auto it = columns.find(name);
+        if (it == columns.end()) throw std::runtime_error("No input column for variable: " + name);
+        by_slot.push_back(it->second);
+    }
+    eval_batch(program, std::span<const std::span<const T>>(by_slot), out);
+}
+
+#endif // BATCH_H
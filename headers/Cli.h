@@ -0,0 +1,77 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include "ExpressionCache.h"
+#include <complex>
+#include <iosfwd>
+#include <string_view>
+
+// Режимы differentiator для потоков запросов (кроме одиночных --eval и --diff в main.cpp)
+
+struct BatchOptions {
+    std::size_t threads = 1;
+    std::size_t block = 4096;            // строк, которые читаются и обрабатываются за раз
+    std::size_t buffer = std::size_t(1) << 16; // байт вывода, после которых он записывается
+};
+
+struct BatchStats {
+    std::size_t requests = 0;
+    std::size_t errors = 0;
+    double seconds = 0;
+};
+
+// Значение в том же виде, что и std::cout << std::complex<double>: (re,im)
+std::string format_value(const std::complex<double> &value);
+
+// Одна строка запроса, поля через ';':
+//   eval; <выражение>; x=1; y=2+i   - значение (непереданные переменные равны нулю)
+//   diff; <выражение>; x            - упрощенная производная
+// Ошибка не бросается, а возвращается строкой "error: <сообщение>".
+std::string process_request(std::string_view line, ExpressionCache<std::complex<double>> &cache);
+
+// Читает запросы построчно (пустые строки пропускаются) и пишет ответы в том же порядке
+BatchStats run_batch(std::istream &in, std::ostream &out, const BatchOptions &options,
+                     ExpressionCache<std::complex<double>> &cache);
+
+// differentiator --batch [файл] [--threads N] [--block N] [--stats]
+int batch_command(int argc, char *argv[]);
+
+// Подсчет по файлу столбцов (действительные числа), порциями фиксированного размера:
+//   CSV    - первая строка - имена столбцов, дальше значения через запятую; ответ - по числу в строке;
+//   BINARY - строки по columns.size() чисел double (little-endian) подряд; ответ - double подряд.
+// Столбцы связываются с переменными по имени (без учета регистра), лишние столбцы пропускаются.
+enum class ColumnFormat { CSV, BINARY };
+
+struct EvalFileOptions {
+    ColumnFormat format = ColumnFormat::CSV;
+    std::vector<std::string> columns;      // имена столбцов двоичного файла
+    std::size_t chunk = std::size_t(1) << 16; // строк в одной порции
+    std::size_t threads = 1;
+};
+
+struct EvalFileStats {
+    std::size_t rows = 0;
+    std::size_t bytes = 0; // прочитано
+    double seconds = 0;
+};
+
+EvalFileStats eval_file(const Program<double> &program, std::istream &in, std::ostream &out,
+                        const EvalFileOptions &options);
+
+// differentiator --eval-file <выражение> <вход> <выход> [--format csv|binary] [--columns x,y]
+//                [--chunk N] [--threads N] [--stats]
+int eval_file_command(int argc, char *argv[]);
+
+// Выражение (или его производная) оптимизируется, компилируется и записывается в двоичный файл
+// (Serialize.h), чтобы другие процессы загружали его без разбора:
+// differentiator --save <выражение> <файл> [--by <переменная>]
+int save_command(int argc, char *argv[]);
+
+// differentiator --load <файл> [переменная=значение ...]
+int load_command(int argc, char *argv[]);
+
+// Заголовок C++ с функциями выражения и его производных (Codegen.h), в stdout или в файл:
+// differentiator --emit-header <имя> <выражение> [--by x,y] [--complex] [--out <файл>]
+int emit_header_command(int argc, char *argv[]);
+
+#endif // CLI_H
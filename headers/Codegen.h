@@ -0,0 +1,247 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "Program.h"
+#include "Simplify.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <unordered_set>
+
+// Заголовок C++ с функциями выражения и его частных производных, чтобы формулы, известные при сборке,
+// компилировались вместе с программой без разбора и интерпретации:
+//   namespace <name> {
+//   inline double f(const double x, const double y);        // само выражение
+//   inline double df_dx(const double x, const double y);    // по одной на переменную из by
+//   inline void all(const double x, const double y, double *out); // f и производные за один проход
+//   }
+// Тело каждой функции - SSA-программа compile без переиспользования регистров: значение каждой инструкции
+// становится константной локальной переменной, общие подвыражения считаются один раз.
+// Деление на ноль бросает std::runtime_error, как при подсчете дерева.
+
+struct HeaderOptions {
+    std::string name = "expression"; // пространство имен и основа защиты от повторного включения
+    std::vector<std::string> by;      // переменные частных производных
+};
+
+namespace codegen {
+    inline bool is_keyword(const std::string_view word) {
+        // Имена переменных из лексера - только буквы, поэтому ключевые слова с цифрами и '_' не нужны
+        static constexpr std::string_view keywords[] = {
+            "alignas", "alignof", "and", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+            "class", "compl", "concept", "const", "consteval", "constexpr", "constinit", "continue", "decltype",
+            "default", "delete", "do", "double", "else", "enum", "explicit", "export", "extern", "false", "float",
+            "for", "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not",
+            "nullptr", "operator", "or", "private", "protected", "public", "register", "requires", "return", "short",
+            "signed", "sizeof", "static", "struct", "switch", "template", "this", "throw", "true", "try", "typedef",
+            "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile", "while", "xor",
+            "out", "f", "all"}; // последние - имена из самого заголовка
+        for (const auto keyword : keywords) {
+            if (word == keyword) return true;
+        }
+        return false;
+    }
+
+    inline bool is_identifier(const std::string_view word) {
+        if (word.empty() || std::isdigit(static_cast<unsigned char>(word.front()))) return false;
+        for (const char c : word) {
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') return false;
+        }
+        return !is_keyword(word);
+    }
+
+    // Имя переменной в том виде, в каком его дает лексер
+    inline bool is_variable(const std::string_view word) {
+        if (word.empty()) return false;
+        for (const char c : word) {
+            if (!std::isalpha(static_cast<unsigned char>(c))) return false;
+        }
+        return true;
+    }
+
+    // Имя параметра для переменной: ключевые слова получают '_' в конце
+    inline std::string parameter(const std::string &variable) {
+        return is_keyword(variable) ? variable + "_" : variable;
+    }
+
+    // Литерал double, который читается обратно в то же число
+    inline void append_literal(std::string &out, const double value) {
+        if (std::isnan(value)) {
+            out += "std::numeric_limits<double>::quiet_NaN()";
+            return;
+        }
+        if (std::isinf(value)) {
+            out += value < 0 ? "(-std::numeric_limits<double>::infinity())" : "std::numeric_limits<double>::infinity()";
+            return;
+        }
+        char buffer[32];
+        const auto result = std::to_chars(buffer, std::end(buffer), value);
+        const std::string_view text(buffer, result.ptr - buffer);
+        if (std::signbit(value)) out += '(';
+        out += text;
+        // Иначе 1 / 2 - целочисленное деление
+        if (text.find_first_of(".e") == std::string_view::npos) out += ".0";
+        if (std::signbit(value)) out += ')';
+    }
+
+    template <typename T>
+    const char *type_name() {
+        return std::is_same_v<T, std::complex<double>> ? "std::complex<double>" : "double";
+    }
+
+    template <typename T>
+    void append_value(std::string &out, const T &value) {
+        if constexpr (std::is_same_v<T, std::complex<double>>) {
+            // Всегда комплексное: std::pow(z, 2.0) и std::pow(z, complex(2, 0)) считают по-разному
+            out += "std::complex<double>(";
+            append_literal(out, value.real());
+            out += ", ";
+            append_literal(out, value.imag());
+            out += ')';
+        } else {
+            append_literal(out, static_cast<double>(value));
+        }
+    }
+
+    template <typename T>
+    void append_signature(std::string &out, const std::string &function, const std::vector<std::string> &variables,
+                          const std::vector<std::string> &used, const bool results) {
+        out += "inline ";
+        out += results ? "void" : type_name<T>();
+        out += ' ';
+        out += function;
+        out += '(';
+        for (std::size_t i = 0; i < variables.size(); i++) {
+            if (i) out += ", ";
+            // Параметры одинаковы у всех функций, но не каждая их читает
+            if (std::find(used.begin(), used.end(), variables[i]) == used.end()) out += "[[maybe_unused]] ";
+            out += "const ";
+            out += type_name<T>();
+            out += ' ';
+            out += parameter(variables[i]);
+        }
+        if (results) {
+            out += variables.empty() ? "" : ", ";
+            out += type_name<T>();
+            out += " *out";
+        }
+        out += ") {\n";
+    }
+
+    // Тело функции: локальные tN по инструкциям SSA-программы, затем return (или запись в out)
+    template <typename T>
+    void append_body(std::string &out, const Program<T> &program, const bool results) {
+        const auto &code = program.get_code();
+        std::vector<std::string> names(code.size());
+        std::size_t locals = 0;
+        std::unordered_set<std::uint32_t> checked; // делители, уже сравненные с нулем
+        for (std::size_t i = 0; i < code.size(); i++) {
+            const auto &ins = code[i];
+            if (ins.code == OP_CONST) {
+                append_value(names[i], program.get_constants()[ins.a]);
+                continue;
+            }
+            if (ins.code == OP_VAR) {
+                names[i] = parameter(program.get_variables()[ins.a]);
+                continue;
+            }
+            const std::string &a = names[ins.a];
+            const std::string &b = names[ins.b];
+            if (ins.code == OP_DIV && checked.insert(ins.b).second) {
+                out += "    if (" + b + " == 0.0) throw std::runtime_error(\"Division by zero\");\n";
+            }
+            names[i] = "t" + std::to_string(locals++);
+            out += "    const ";
+            out += type_name<T>();
+            out += ' ' + names[i] + " = ";
+            switch (ins.code) {
+                case OP_ADD: out += a + " + " + b; break;
+                case OP_SUB: out += a + " - " + b; break;
+                case OP_MUL: out += a + " * " + b; break;
+                case OP_DIV: out += a + " / " + b; break;
+                case OP_POW: out += "std::pow(" + a + ", " + b + ")"; break;
+                case OP_SIN: out += "std::sin(" + a + ")"; break;
+                case OP_COS: out += "std::cos(" + a + ")"; break;
+                case OP_LN: out += "std::log(" + a + ")"; break;
+                case OP_EXP: out += "std::exp(" + a + ")"; break;
+                default: throw std::runtime_error("Unknown instruction");
+            }
+            out += ";\n";
+        }
+        const auto &outputs = program.get_outputs();
+        if (!results) {
+            out += "    return " + names[outputs.front()] + ";\n}\n";
+            return;
+        }
+        for (std::size_t i = 0; i < outputs.size(); i++) {
+            out += "    out[" + std::to_string(i) + "] = " + names[outputs[i]] + ";\n";
+        }
+        out += "}\n";
+    }
+
+    // Константное деление на ноль не упрощается, оно проявится в сгенерированной функции
+    template <typename T, typename Step>
+    std::shared_ptr<Expression<T>> try_simplify(const std::shared_ptr<Expression<T>> &expr, Step step) {
+        try {
+            return step(expr);
+        } catch (const std::runtime_error &) {
+            return expr;
+        }
+    }
+}
+
+template <typename T>
+std::string emit_header(const std::shared_ptr<Expression<T>> &expr, const HeaderOptions &options) {
+    if (!codegen::is_identifier(options.name)) throw std::runtime_error("Invalid header name: " + options.name);
+    std::vector<std::shared_ptr<Expression<T>>> exprs{
+        codegen::try_simplify(expr, [](const std::shared_ptr<Expression<T>> &e) { return optimize(e); })};
+    {
+        DiffCache<T> derivatives;
+        DiffCacheScope<T> scope(derivatives);
+        for (auto var : options.by) {
+            if (!codegen::is_variable(var)) throw std::runtime_error("Invalid variable: " + var);
+            if (std::count(options.by.begin(), options.by.end(), var) > 1) {
+                throw std::runtime_error("Duplicate variable: " + var);
+            }
+            exprs.push_back(codegen::try_simplify(expr->diff(var), [](const std::shared_ptr<Expression<T>> &e) {
+                return optimize(simplify(e));
+            }));
+        }
+    }
+    const CompileOptions ssa{true, false};
+    // Общий порядок параметров для всех функций - порядок переменных общей программы
+    const auto together = compile(exprs, ssa);
+    const auto &variables = together.get_variables();
+
+    std::string guard;
+    for (const char c : options.name) guard += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    guard += "_GENERATED_H";
+
+    std::string out = "// Generated by differentiator --emit-header. Do not edit.\n";
+    out += "#ifndef " + guard + "\n#define " + guard + "\n\n";
+    out += "#include <cmath>\n";
+    if constexpr (std::is_same_v<T, std::complex<double>>) out += "#include <complex>\n";
+    out += "#include <limits>\n#include <stdexcept>\n\nnamespace " + options.name + " {\n\n";
+    out += "inline constexpr int variable_count = " + std::to_string(variables.size()) + ";\n";
+    out += "inline constexpr int result_count = " + std::to_string(exprs.size()) + ";\n\n";
+
+    for (std::size_t i = 0; i < exprs.size(); i++) {
+        const std::string function = i == 0 ? "f" : "df_d" + options.by[i - 1];
+        out += "// " + (i == 0 ? std::string() : "d/d" + options.by[i - 1] + ": ") + print(exprs[i]) + "\n";
+        const auto program = compile(exprs[i], ssa);
+        codegen::append_signature<T>(out, function, variables, program.get_variables(), false);
+        codegen::append_body(out, program, false);
+        out += '\n';
+    }
+
+    out += "// out[0] = f";
+    for (const auto &var : options.by) out += ", df_d" + var;
+    out += "; shared subexpressions are computed once\n";
+    codegen::append_signature<T>(out, "all", variables, variables, true);
+    codegen::append_body(out, together, true);
+    out += "\n} // namespace " + options.name + "\n\n#endif // " + guard + "\n";
+    return out;
+}
+
+#endif // CODEGEN_H
@@ -0,0 +1,161 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include "Program.h"
+
+// Дуальные числа: value + derivative * eps, eps^2 = 0.
+// Подсчет на дуальных числах дает f(x) и f'(x) за один обход, без построения дерева производной.
+template <typename T>
+struct Dual {
+    T value;
+    T derivative;
+
+    Dual(const T &value = T(0), const T &derivative = T(0)) : value(value), derivative(derivative) {}
+};
+
+template <typename T>
+Dual<T> operator+(const Dual<T> &a, const Dual<T> &b) {
+    return {a.value + b.value, a.derivative + b.derivative};
+}
+
+template <typename T>
+Dual<T> operator-(const Dual<T> &a, const Dual<T> &b) {
+    return {a.value - b.value, a.derivative - b.derivative};
+}
+
+template <typename T>
+Dual<T> operator*(const Dual<T> &a, const Dual<T> &b) {
+    return {a.value * b.value, a.derivative * b.value + a.value * b.derivative};
+}
+
+template <typename T>
+Dual<T> operator/(const Dual<T> &a, const Dual<T> &b) {
+    if (b.value == T(0)) throw std::runtime_error("Division by zero");
+    return {a.value / b.value, (a.derivative * b.value - a.value * b.derivative) / (b.value * b.value)};
+}
+
+// (f^g)' = g * f^(g - 1) * f' + f^g * ln(f) * g'; нулевые слагаемые не считаются (ln(f) для f < 0 дал бы NaN)
+template <typename T>
+Dual<T> pow(const Dual<T> &a, const Dual<T> &b) {
+    const T value = std::pow(a.value, b.value);
+    T derivative = T(0);
+    if (a.derivative != T(0)) derivative += b.value * std::pow(a.value, b.value - T(1)) * a.derivative;
+    if (b.derivative != T(0)) derivative += value * std::log(a.value) * b.derivative;
+    return {value, derivative};
+}
+
+template <typename T>
+Dual<T> sin(const Dual<T> &a) {
+    return {std::sin(a.value), std::cos(a.value) * a.derivative};
+}
+
+template <typename T>
+Dual<T> cos(const Dual<T> &a) {
+    return {std::cos(a.value), -std::sin(a.value) * a.derivative};
+}
+
+template <typename T>
+Dual<T> log(const Dual<T> &a) {
+    return {std::log(a.value), a.derivative / a.value};
+}
+
+template <typename T>
+Dual<T> exp(const Dual<T> &a) {
+    const T value = std::exp(a.value);
+    return {value, value * a.derivative};
+}
+
+template <typename T>
+Dual<T> apply_operation(const Operation op, const Dual<T> &left, const Dual<T> &right) {
+    switch (op) {
+        case PLUS: return left + right;
+        case MINUS: return left - right;
+        case MULT: return left * right;
+        case DIV: return left / right;
+        case POW: return pow(left, right);
+        default: throw std::runtime_error("Unknown operation");
+    }
+}
+
+template <typename T>
+Dual<T> apply_function(const Function func, const Dual<T> &arg) {
+    switch (func) {
+        case SIN: return sin(arg);
+        case COS: return cos(arg);
+        case LN: return log(arg);
+        case EXP: return exp(arg);
+        default: throw std::runtime_error("Unknown function");
+    }
+}
+
+// Значение и производная по переменной var прямо по исходному дереву
+template <typename T>
+Dual<T> eval_dual(const Expression<T> &expr, const std::map<std::string, T> &parameters, const std::string &var) {
+    switch (expr.kind()) {
+        case CONST_NODE: return Dual<T>(static_cast<const ConstantExpression<T> &>(expr).get_value());
+        case VAR_NODE: {
+            const auto &name = static_cast<const VarExpression<T> &>(expr).get_name();
+            auto it = parameters.find(name);
+            return Dual<T>(it != parameters.end() ? it->second : T(0), name == var ? T(1) : T(0));
+        }
+        case MONO_NODE: {
+            const auto &mono = static_cast<const MonoExpression<T> &>(expr);
+            return apply_function(mono.get_func(), eval_dual(*mono.get_arg(), parameters, var));
+        }
+        case BINARY_NODE: {
+            const auto &binary = static_cast<const BinaryExpression<T> &>(expr);
+            const auto left = eval_dual(*binary.get_left(), parameters, var);
+            const auto right = eval_dual(*binary.get_right(), parameters, var);
+            return apply_operation(binary.get_op(), left, right);
+        }
+        default: throw std::runtime_error("Unknown node");
+    }
+}
+
+// То же по скомпилированной программе: производная по переменной из слота slot
+template <typename T>
+Dual<T> eval_dual(const Program<T> &program, std::span<const T> values, const std::size_t slot,
+                  std::span<Dual<T>> regs) {
+    if (values.size() < program.get_variables().size()) throw std::runtime_error("Not enough variable values");
+    if (regs.size() < program.get_registers()) throw std::runtime_error("Not enough registers");
+    const auto &constants = program.get_constants();
+    for (const auto &ins : program.get_code()) {
+        switch (ins.code) {
+            case OP_CONST: regs[ins.dst] = Dual<T>(constants[ins.a]); break;
+            case OP_VAR: regs[ins.dst] = Dual<T>(values[ins.a], ins.a == slot ? T(1) : T(0)); break;
+            case OP_ADD: regs[ins.dst] = regs[ins.a] + regs[ins.b]; break;
+            case OP_SUB: regs[ins.dst] = regs[ins.a] - regs[ins.b]; break;
+            case OP_MUL: regs[ins.dst] = regs[ins.a] * regs[ins.b]; break;
+            case OP_DIV: regs[ins.dst] = regs[ins.a] / regs[ins.b]; break;
+            case OP_POW: regs[ins.dst] = pow(regs[ins.a], regs[ins.b]); break;
+            case OP_SIN: regs[ins.dst] = sin(regs[ins.a]); break;
+            case OP_COS: regs[ins.dst] = cos(regs[ins.a]); break;
+            case OP_LN: regs[ins.dst] = log(regs[ins.a]); break;
+            case OP_EXP: regs[ins.dst] = exp(regs[ins.a]); break;
+            default: throw std::runtime_error("Unknown instruction");
+        }
+    }
+    return regs[program.get_result()];
+}
+
+// Пакетный вариант: columns[slot] - значения переменных, на выходе значения и производные по всем точкам
+template <typename T>
+void eval_dual_batch(const Program<T> &program, std::span<const std::span<const T>> columns, const std::size_t slot,
+                     std::span<T> values_out, std::span<T> derivatives_out) {
+    const std::size_t vars = program.get_variables().size();
+    if (columns.size() < vars) throw std::runtime_error("Not enough input columns");
+    if (derivatives_out.size() < values_out.size()) throw std::runtime_error("Not enough space for derivatives");
+    for (std::size_t s = 0; s < vars; s++) {
+        if (columns[s].size() < values_out.size()) throw std::runtime_error("Input column is too short");
+    }
+    std::vector<Dual<T>> regs(program.get_registers());
+    std::vector<T> point(vars);
+    for (std::size_t i = 0; i < values_out.size(); i++) {
+        for (std::size_t s = 0; s < vars; s++) point[s] = columns[s][i];
+        const auto result = eval_dual(program, std::span<const T>(point), slot, std::span<Dual<T>>(regs));
+        values_out[i] = result.value;
+        derivatives_out[i] = result.derivative;
+    }
+}
+
+#endif // DUAL_H
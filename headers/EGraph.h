@@ -0,0 +1,496 @@
+#ifndef EGRAPH_H
+#define EGRAPH_H
+
+#include "Expression.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Оптимизация насыщением равенств (e-graph): классы эквивалентных выражений пополняются
+// по правилам переписывания, пока граф не перестанет меняться или не кончатся лимиты,
+// затем из каждого класса выбирается самый дешевый по модели стоимости вариант.
+// В отличие от optimize/simplify, никакое переписывание не отменяет другие варианты.
+
+// Примерная стоимость подсчета узла (в единицах сложения)
+struct CostModel {
+    double leaf = 1;  // константа или переменная
+    double add = 1;   // + и -
+    double mult = 2;
+    double div = 8;
+    double pow = 40;
+    double exp = 20;
+    double ln = 20;
+    double trig = 25; // sin и cos
+};
+
+struct SaturationLimits {
+    std::size_t max_nodes = 20000;
+    std::size_t max_iterations = 12;
+    // Ограничение по времени работы: с ним результат зависит от скорости машины и может отличаться между
+    // запусками; для воспроизводимого результата задайте большое time и ограничивайтесь итерациями и узлами
+    std::chrono::milliseconds time = std::chrono::milliseconds(200);
+};
+
+struct SaturationReport {
+    std::size_t iterations = 0;
+    std::size_t nodes = 0;
+    bool saturated = false; // правила больше ничего не добавляют
+    double cost_before = 0;
+    double cost_after = 0;
+};
+
+template <typename T>
+class EGraph {
+public:
+    using Id = std::uint32_t;
+    using Ptr = std::shared_ptr<Expression<T>>;
+
+    struct ENode {
+        NodeKind kind;
+        std::uint8_t op = 0;      // Operation или Function
+        Id a = 0, b = 0;          // классы аргументов
+        std::uint32_t payload = 0; // номер константы или имени переменной
+
+        bool operator==(const ENode &other) const = default;
+    };
+
+private:
+    struct ENodeHash {
+        std::size_t operator()(const ENode &n) const {
+            std::size_t h = n.kind * 31 + n.op;
+            for (const std::uint64_t v : {std::uint64_t(n.a), std::uint64_t(n.b), std::uint64_t(n.payload)}) {
+                h ^= std::hash<std::uint64_t>()(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+            }
+            return h;
+        }
+    };
+
+    std::vector<Id> parent;
+    std::vector<std::vector<ENode>> classes; // узлы класса (актуальны только для корней)
+    std::vector<std::optional<T>> folded;    // известное значение класса
+    std::unordered_map<ENode, Id, ENodeHash> memo;
+    std::vector<T> constants;
+    std::vector<std::string> names;
+    bool changed = false;
+
+    static constexpr int max_unrolled_power = 8;
+
+    static bool finite(const T &v) {
+        if constexpr (std::is_same_v<T, std::complex<double>>) return std::isfinite(v.real()) && std::isfinite(v.imag());
+        else return std::isfinite(v);
+    }
+
+    ENode canonical(ENode n) {
+        if (n.kind == MONO_NODE) n.a = find(n.a);
+        if (n.kind == BINARY_NODE) {
+            n.a = find(n.a);
+            n.b = find(n.b);
+        }
+        return n;
+    }
+
+    std::optional<T> fold(const ENode &n) {
+        switch (n.kind) {
+            case CONST_NODE: return constants[n.payload];
+            case VAR_NODE: return std::nullopt;
+            case MONO_NODE: {
+                const auto &arg = folded[find(n.a)];
+                if (!arg) return std::nullopt;
+                T v;
+                switch (static_cast<Function>(n.op)) {
+                    case SIN: v = std::sin(*arg); break;
+                    case COS: v = std::cos(*arg); break;
+                    case LN: v = std::log(*arg); break;
+                    case EXP: v = std::exp(*arg); break;
+                    default: return std::nullopt;
+                }
+                if (finite(v)) return v;
+                return std::nullopt;
+            }
+            case BINARY_NODE: {
+                const auto &left = folded[find(n.a)];
+                const auto &right = folded[find(n.b)];
+                if (!left || !right) return std::nullopt;
+                if (static_cast<Operation>(n.op) == DIV && *right == T(0)) return std::nullopt;
+                const T v = apply_operation(static_cast<Operation>(n.op), *left, *right);
+                if (finite(v)) return v;
+                return std::nullopt;
+            }
+        }
+        return std::nullopt;
+    }
+
+public:
+    Id find(Id x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+
+    std::size_t node_count() const { return memo.size(); }
+    std::size_t class_count() const {
+        std::size_t count = 0;
+        for (Id i = 0; i < parent.size(); i++) count += parent[i] == i;
+        return count;
+    }
+    const std::vector<ENode> &nodes(const Id id) { return classes[find(id)]; }
+    const std::optional<T> &value(const Id id) { return folded[find(id)]; }
+
+    Id add(ENode n) {
+        n = canonical(n);
+        auto it = memo.find(n);
+        if (it != memo.end()) return find(it->second);
+        const Id id = static_cast<Id>(parent.size());
+        parent.push_back(id);
+        classes.push_back({n});
+        folded.push_back(fold(n));
+        memo.emplace(n, id);
+        changed = true;
+        // Константный класс сразу объединяется с самой константой
+        if (n.kind != CONST_NODE && folded[id]) merge(id, add_constant(*folded[id]));
+        return find(id);
+    }
+
+    Id add_constant(const T &v) {
+        std::uint32_t index = 0;
+        while (index < constants.size() && value_bits(constants[index]) != value_bits(v)) index++;
+        if (index == constants.size()) constants.push_back(v);
+        return add(ENode{CONST_NODE, 0, 0, 0, index});
+    }
+
+    Id add_var(const std::string &name) {
+        std::uint32_t index = 0;
+        while (index < names.size() && names[index] != name) index++;
+        if (index == names.size()) names.push_back(name);
+        return add(ENode{VAR_NODE, 0, 0, 0, index});
+    }
+
+    Id add_mono(const Function func, const Id arg) { return add(ENode{MONO_NODE, static_cast<std::uint8_t>(func), arg, 0, 0}); }
+    Id add_binary(const Operation op, const Id left, const Id right) {
+        return add(ENode{BINARY_NODE, static_cast<std::uint8_t>(op), left, right, 0});
+    }
+
+    Id add(const Ptr &expr) {
+        switch (expr->kind()) {
+            case CONST_NODE: return add_constant(static_cast<const ConstantExpression<T> &>(*expr).get_value());
+            case VAR_NODE: return add_var(static_cast<const VarExpression<T> &>(*expr).get_name());
+            case MONO_NODE: {
+                const auto &mono = static_cast<const MonoExpression<T> &>(*expr);
+                return add_mono(mono.get_func(), add(mono.get_arg()));
+            }
+            case BINARY_NODE: {
+                const auto &binary = static_cast<const BinaryExpression<T> &>(*expr);
+                const Id left = add(binary.get_left());
+                return add_binary(binary.get_op(), left, add(binary.get_right()));
+            }
+        }
+        throw std::runtime_error("Unknown node");
+    }
+
+    bool merge(Id a, Id b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) return false;
+        if (classes[a].size() < classes[b].size()) std::swap(a, b);
+        parent[b] = a;
+        classes[a].insert(classes[a].end(), classes[b].begin(), classes[b].end());
+        classes[b].clear();
+        if (!folded[a]) folded[a] = folded[b];
+        changed = true;
+        return true;
+    }
+
+    // Восстановление конгруэнтности: узлы с одинаковыми (канонизированными) аргументами - один класс
+    void rebuild() {
+        bool again = true;
+        while (again) {
+            again = false;
+            memo.clear();
+            for (Id id = 0; id < parent.size(); id++) {
+                if (parent[id] != id) continue;
+                for (auto &n : classes[id]) {
+                    n = canonical(n);
+                    auto [it, inserted] = memo.emplace(n, id);
+                    if (!inserted && find(it->second) != find(id)) {
+                        merge(it->second, id);
+                        again = true;
+                    }
+                }
+            }
+            if (again) continue;
+            std::vector<std::pair<Id, T>> known;
+            for (Id id = 0; id < parent.size(); id++) {
+                if (parent[id] != id) continue;
+                auto &list = classes[id];
+                std::vector<ENode> unique;
+                for (const auto &n : list) {
+                    if (std::find(unique.begin(), unique.end(), n) == unique.end()) unique.push_back(n);
+                }
+                list = std::move(unique);
+                // Значение класса стало известно после объединений - добавляем в него константу
+                if (folded[id]) continue;
+                for (const auto &n : list) {
+                    if ((folded[id] = fold(n))) {
+                        known.emplace_back(id, *folded[id]);
+                        break;
+                    }
+                }
+            }
+            for (const auto &[id, v] : known) merge(id, add_constant(v));
+            again = !known.empty();
+        }
+    }
+
+    bool take_changed() {
+        const bool result = changed;
+        changed = false;
+        return result;
+    }
+
+    // Один проход правил по всем классам; возвращает, изменился ли граф.
+    // Новые узлы перестают добавляться, как только их стало больше max_nodes.
+    bool apply_rules(const std::size_t max_nodes = std::numeric_limits<std::size_t>::max()) {
+        struct Pending {
+            Id target;
+            std::function<Id()> make;
+        };
+        std::vector<Pending> pending;
+        auto is_value = [this](const Id id, const T &v) { return value(id) && *value(id) == v; };
+        auto with = [this](const Id id, const NodeKind kind, const std::uint8_t op, auto &&f) {
+            for (const auto n : std::vector<ENode>(nodes(id))) {
+                if (n.kind == kind && n.op == op) f(n);
+            }
+        };
+
+        const Id count = static_cast<Id>(parent.size());
+        for (Id c = 0; c < count; c++) {
+            if (parent[c] != c) continue;
+            if (folded[c]) continue; // у константного класса уже есть самый дешевый представитель
+            for (const auto n : std::vector<ENode>(classes[c])) {
+                if (n.kind == MONO_NODE) {
+                    const auto func = static_cast<Function>(n.op);
+                    // ln(exp(a)) = a только для действительных чисел (у комплексных ln берет главное значение),
+                    // exp(ln(a)) = a только для комплексных (для действительных a <= 0 слева NaN)
+                    if constexpr (!std::is_same_v<T, std::complex<double>>) {
+                        if (func == LN) with(n.a, MONO_NODE, EXP, [&](const ENode &e) { pending.push_back({c, [=] { return e.a; }}); });
+                    } else {
+                        if (func == EXP) with(n.a, MONO_NODE, LN, [&](const ENode &l) { pending.push_back({c, [=] { return l.a; }}); });
+                    }
+                    continue;
+                }
+                if (n.kind != BINARY_NODE) continue;
+                const auto op = static_cast<Operation>(n.op);
+                const Id a = n.a, b = n.b;
+                switch (op) {
+                    case PLUS:
+                    case MULT: {
+                        // Коммутативность и ассоциативность
+                        pending.push_back({c, [=, this] { return add_binary(op, b, a); }});
+                        with(a, BINARY_NODE, op, [&](const ENode &inner) {
+                            pending.push_back({c, [=, this] { return add_binary(op, inner.a, add_binary(op, inner.b, b)); }});
+                        });
+                        with(b, BINARY_NODE, op, [&](const ENode &inner) {
+                            pending.push_back({c, [=, this] { return add_binary(op, add_binary(op, a, inner.a), inner.b); }});
+                        });
+                        if (op == PLUS) {
+                            if (is_value(b, T(0))) pending.push_back({c, [=] { return a; }});
+                            // Вынесение общего множителя: a * p + a * q = a * (p + q)
+                            with(a, BINARY_NODE, MULT, [&](const ENode &left) {
+                                with(b, BINARY_NODE, MULT, [&](const ENode &right) {
+                                    if (find(left.a) == find(right.a)) {
+                                        pending.push_back({c, [=, this] { return add_binary(MULT, left.a, add_binary(PLUS, left.b, right.b)); }});
+                                    }
+                                });
+                            });
+                            // a + a = 2 * a
+                            if (find(a) == find(b)) pending.push_back({c, [=, this] { return add_binary(MULT, add_constant(T(2)), a); }});
+                            // sin(x)^2 + cos(x)^2 = 1
+                            with(a, BINARY_NODE, POW, [&](const ENode &p) {
+                                if (!is_value(p.b, T(2))) return;
+                                with(b, BINARY_NODE, POW, [&](const ENode &q) {
+                                    if (!is_value(q.b, T(2))) return;
+                                    with(p.a, MONO_NODE, SIN, [&](const ENode &s) {
+                                        with(q.a, MONO_NODE, COS, [&](const ENode &k) {
+                                            if (find(s.a) == find(k.a)) pending.push_back({c, [=, this] { return add_constant(T(1)); }});
+                                        });
+                                    });
+                                });
+                            });
+                        } else {
+                            if (is_value(b, T(1))) pending.push_back({c, [=] { return a; }});
+                            if (is_value(b, T(0))) pending.push_back({c, [=, this] { return add_constant(T(0)); }});
+                            // Дистрибутивность: a * (p + q) = a * p + a * q
+                            with(b, BINARY_NODE, PLUS, [&](const ENode &sum) {
+                                pending.push_back({c, [=, this] { return add_binary(PLUS, add_binary(MULT, a, sum.a), add_binary(MULT, a, sum.b)); }});
+                            });
+                            // Степени: a * a = a^2, a^p * a^q = a^(p + q), a * a^p = a^(p + 1)
+                            if (find(a) == find(b)) pending.push_back({c, [=, this] { return add_binary(POW, a, add_constant(T(2))); }});
+                            with(b, BINARY_NODE, POW, [&](const ENode &right) {
+                                if (find(right.a) == find(a)) {
+                                    pending.push_back({c, [=, this] { return add_binary(POW, a, add_binary(PLUS, right.b, add_constant(T(1)))); }});
+                                }
+                                with(a, BINARY_NODE, POW, [&](const ENode &left) {
+                                    if (find(left.a) == find(right.a)) {
+                                        pending.push_back({c, [=, this] { return add_binary(POW, left.a, add_binary(PLUS, left.b, right.b)); }});
+                                    }
+                                });
+                            });
+                            // exp(p) * exp(q) = exp(p + q)
+                            with(a, MONO_NODE, EXP, [&](const ENode &left) {
+                                with(b, MONO_NODE, EXP, [&](const ENode &right) {
+                                    pending.push_back({c, [=, this] { return add_mono(EXP, add_binary(PLUS, left.a, right.a)); }});
+                                });
+                            });
+                        }
+                        break;
+                    }
+                    case MINUS:
+                        if (find(a) == find(b)) pending.push_back({c, [=, this] { return add_constant(T(0)); }});
+                        if (is_value(b, T(0))) pending.push_back({c, [=] { return a; }});
+                        pending.push_back({c, [=, this] { return add_binary(PLUS, a, add_binary(MULT, add_constant(T(-1)), b)); }});
+                        break;
+                    case DIV:
+                        // a / a = 1 только для ненулевой константы: при a = 0 дерево бросает "Division by zero"
+                        if (find(a) == find(b) && value(a) && *value(a) != T(0)) {
+                            pending.push_back({c, [=, this] { return add_constant(T(1)); }});
+                        }
+                        if (is_value(b, T(1))) pending.push_back({c, [=] { return a; }});
+                        // a / b = a * b^(-1) тоже только для ненулевой константы: b^(-1) при b = 0 не бросает ошибку,
+                        // и через a * a^p = a^(p + 1) отсюда получилось бы x / x = x^0 = 1
+                        if (value(b) && *value(b) != T(0)) {
+                            pending.push_back({c, [=, this] { return add_binary(MULT, a, add_binary(POW, b, add_constant(T(-1)))); }});
+                        }
+                        break;
+                    case POW:
+                        // Небольшая целая степень дешевле как произведение: a^n = a * a^(n - 1)
+                        for (int k = 2; k <= max_unrolled_power; k++) {
+                            if (is_value(b, T(k))) {
+                                pending.push_back({c, [=, this] { return add_binary(MULT, a, add_binary(POW, a, add_constant(T(k - 1)))); }});
+                            }
+                        }
+                        if (is_value(b, T(1))) pending.push_back({c, [=] { return a; }});
+                        if (is_value(b, T(0))) pending.push_back({c, [=, this] { return add_constant(T(1)); }});
+                        // a^(-1) не переписывается в 1 / a: при a = 0 степень дает inf, а деление бросает ошибку
+                        break;
+                }
+            }
+        }
+        for (auto &p : pending) {
+            if (memo.size() > max_nodes) break;
+            merge(p.target, p.make());
+        }
+        rebuild();
+        return take_changed();
+    }
+
+    // Извлечение самого дешевого представителя каждого класса
+    class Extractor {
+        EGraph &graph;
+        const CostModel &model;
+        std::vector<double> best;
+        std::vector<ENode> choice;
+        std::unordered_map<Id, Ptr> built;
+
+        double own_cost(const ENode &n) const {
+            switch (n.kind) {
+                case CONST_NODE: case VAR_NODE: return model.leaf;
+                case MONO_NODE:
+                    switch (static_cast<Function>(n.op)) {
+                        case EXP: return model.exp;
+                        case LN: return model.ln;
+                        default: return model.trig;
+                    }
+                case BINARY_NODE:
+                    switch (static_cast<Operation>(n.op)) {
+                        case PLUS: case MINUS: return model.add;
+                        case MULT: return model.mult;
+                        case DIV: return model.div;
+                        default: return model.pow;
+                    }
+            }
+            return model.leaf;
+        }
+
+    public:
+        Extractor(EGraph &graph, const CostModel &model) : graph(graph), model(model) {
+            const auto inf = std::numeric_limits<double>::infinity();
+            best.assign(graph.parent.size(), inf);
+            choice.resize(graph.parent.size());
+            bool improved = true;
+            while (improved) {
+                improved = false;
+                for (Id id = 0; id < graph.parent.size(); id++) {
+                    if (graph.parent[id] != id) continue;
+                    for (const auto &n : graph.classes[id]) {
+                        double cost = own_cost(n);
+                        if (n.kind == MONO_NODE || n.kind == BINARY_NODE) cost += best[graph.find(n.a)];
+                        if (n.kind == BINARY_NODE) cost += best[graph.find(n.b)];
+                        if (cost < best[id]) {
+                            best[id] = cost;
+                            choice[id] = n;
+                            improved = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        double cost(const Id id) { return best[graph.find(id)]; }
+
+        Ptr build(Id id) {
+            id = graph.find(id);
+            auto it = built.find(id);
+            if (it != built.end()) return it->second;
+            const ENode &n = choice[id];
+            Ptr result;
+            switch (n.kind) {
+                case CONST_NODE: result = make_constant<T>(graph.constants[n.payload]); break;
+                case VAR_NODE: result = make_var<T>(graph.names[n.payload]); break;
+                case MONO_NODE: result = make_mono<T>(build(n.a), static_cast<Function>(n.op)); break;
+                case BINARY_NODE: {
+                    auto left = build(n.a);
+                    result = make_binary<T>(left, build(n.b), static_cast<Operation>(n.op));
+                    break;
+                }
+            }
+            built.emplace(id, result);
+            return result;
+        }
+    };
+};
+
+// Тяжелая разовая оптимизация: насыщение по правилам в пределах лимитов и извлечение самого дешевого варианта
+template <typename T>
+std::shared_ptr<Expression<T>> saturate(const std::shared_ptr<Expression<T>> &expr, const SaturationLimits limits = {},
+                                        const CostModel model = {}, SaturationReport *report = nullptr) {
+    const auto start = std::chrono::steady_clock::now();
+    EGraph<T> graph;
+    const auto root = graph.add(expr);
+    graph.rebuild();
+    graph.take_changed();
+
+    SaturationReport result;
+    result.cost_before = typename EGraph<T>::Extractor(graph, model).cost(root);
+    while (result.iterations < limits.max_iterations) {
+        if (graph.node_count() > limits.max_nodes) break;
+        if (std::chrono::steady_clock::now() - start > limits.time) break;
+        result.iterations++;
+        if (!graph.apply_rules(limits.max_nodes)) {
+            result.saturated = true;
+            break;
+        }
+    }
+    typename EGraph<T>::Extractor extractor(graph, model);
+    result.nodes = graph.node_count();
+    result.cost_after = extractor.cost(root);
+    if (report) *report = result;
+    return extractor.build(root);
+}
+
+#endif // EGRAPH_H
@@ -1,15 +1,25 @@
 #ifndef EXPRESSION_H
 #define EXPRESSION_H
+#include "Arena.h"
+#include "Operations.h"
+#include <array>
+#include <bit>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
 #include <complex>
+#include <cstring>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
 #include <string>
 #include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-enum Operation { PLUS, MINUS, MULT, DIV, POW };
-enum Function { SIN, COS, LN, EXP };
+enum NodeKind { CONST_NODE, VAR_NODE, MONO_NODE, BINARY_NODE }; // вид узла, чтобы обходить дерево без dynamic_cast
 
 struct operators {
     Operation type; // тип
@@ -23,23 +33,86 @@ struct operators {
     }
 };
 
+// Число дописывается в буфер без промежуточных строк. exact - кратчайшая запись, которая читается
+// обратно в то же число (без экспоненты: лексер ее не знает); иначе как std::to_string: целые без
+// дробной части, остальные с шестью знаками.
+inline void append_number(std::string &out, double value, const bool exact) {
+    if (value == 0) value = 0; // -0 печатается как 0
+    char buffer[400]; // fixed-запись самого большого double - 309 цифр
+    const auto result = exact ? std::to_chars(buffer, std::end(buffer), value, std::chars_format::fixed)
+                        : value == std::floor(value) ? std::to_chars(buffer, std::end(buffer), value, std::chars_format::fixed, 0)
+                        : std::to_chars(buffer, std::end(buffer), value, std::chars_format::fixed, 6);
+    out.append(buffer, result.ptr);
+}
+
 inline std::string to_string_optimized(double a) {
-    auto a_ = std::floor(a);
-    if (a == a_) {
-        return std::to_string(static_cast<long>(a_));
+    std::string result;
+    append_number(result, a, false);
+    return result;
+}
+
+// Константа как операнд: отрицательные и комплексные с обеими частями - в скобках
+template <typename T>
+void append_constant(std::string &out, const T &value, const bool exact) {
+    if constexpr (std::is_same_v<T, std::complex<double>>) {
+        const double real = value.real();
+        const double imag = value.imag();
+        if (real != 0 && imag != 0) {
+            out += '(';
+            append_number(out, real, exact);
+            out += imag >= 0 ? " + " : " - ";
+            append_number(out, imag >= 0 ? imag : -imag, exact);
+            out += "i)";
+            return;
+        }
+        const double part = real == 0 ? imag : real;
+        const bool wrap = exact && part < 0; // в to_string исторически без скобок
+        if (wrap) out += '(';
+        append_number(out, part, exact);
+        if (real == 0 && imag != 0) out += 'i';
+        if (wrap) out += ')';
+    } else {
+        const double number = static_cast<double>(value);
+        if (number < 0) out += '(';
+        append_number(out, number, exact);
+        if (number < 0) out += ')';
+    }
+}
+
+// Биты значения: константы сравниваются побитно (различаются 0 и -0, NaN равен себе)
+template <typename T>
+std::array<std::uint64_t, 2> value_bits(const T &value) {
+    if constexpr (std::is_same_v<T, std::complex<double>>) {
+        return {std::bit_cast<std::uint64_t>(value.real()), std::bit_cast<std::uint64_t>(value.imag())};
+    } else {
+        return {std::bit_cast<std::uint64_t>(static_cast<double>(value)), 0};
     }
-    return std::to_string(a);
 }
 
 template <typename T>
-struct Expression {
+struct Expression : std::enable_shared_from_this<Expression<T>> {
     virtual ~Expression() = default;
 
     virtual std::string to_string() = 0;
-    virtual T eval(std::map<std::string, T> &parameters) = 0;
+    virtual T eval(const std::map<std::string, T> &parameters) const = 0; // не меняет ни дерево, ни параметры
     virtual std::shared_ptr<Expression<T>> diff(std::string &str) = 0;
+    virtual NodeKind kind() const = 0;
 };
 
+// Все узлы создаются через эти функции (определены ниже): они учитывают активные арену и таблицу уникальных узлов
+template <typename T>
+std::shared_ptr<Expression<T>> make_constant(const T &value);
+template <typename T>
+std::shared_ptr<Expression<T>> make_var(const std::string &name);
+template <typename T>
+std::shared_ptr<Expression<T>> make_mono(const std::shared_ptr<Expression<T>> &arg, Function func);
+template <typename T>
+std::shared_ptr<Expression<T>> make_binary(const std::shared_ptr<Expression<T>> &left,
+                                           const std::shared_ptr<Expression<T>> &right, Operation op);
+// Производная узла через активный кэш производных (определена ниже, см. DiffCache)
+template <typename T, typename Compute>
+std::shared_ptr<Expression<T>> cached_diff(Expression<T> &node, const std::string &var, Compute compute);
+
 template <typename T>
 class ConstantExpression : public Expression<T> {
     T value;
@@ -51,30 +124,20 @@ public:
     ConstantExpression &operator=(const ConstantExpression<T> &other) = default;
     ConstantExpression &operator=(ConstantExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        return value;
+    T eval(const std::map<std::string, T> &parameters) const override {
+        return profile_phase(PHASE_EVAL, 1, [&]() -> T {
+            return value;
+        });
     }
     std::shared_ptr<Expression<T>> diff(std::string &str) override {
-        return std::make_shared<ConstantExpression<T>>(T(0));
+        return make_constant<T>(T(0));
     }
+    NodeKind kind() const override { return CONST_NODE; }
+    const T &get_value() const { return value; }
     std::string to_string() override {
-        if constexpr (std::is_same_v<T, std::complex<double>>) {
-            // Специальная обработка для комплексных чисел
-            double real = value.real();
-            double imag = value.imag();
-            if (real != 0 && imag != 0) {
-                if (imag >= 0) return "(" + to_string_optimized(real) + " + " + to_string_optimized(imag) + "i)";
-                return "(" + to_string_optimized(real) + " - " + to_string_optimized(-imag) + "i)";
-            }
-            if (real == 0 && imag == 0) {
-                return to_string_optimized(0);
-            }
-            if (real == 0) return to_string_optimized(imag) + "i";
-            else return to_string_optimized(real);
-        } else if (std::is_same_v<T, double>) {
-            if (value < 0.0f) return "(" + to_string_optimized(value) + ")";
-            return to_string_optimized(value);
-        }
+        std::string result;
+        append_constant(result, value, false);
+        return result;
     }
 };
 
@@ -89,18 +152,47 @@ public:
     VarExpression &operator=(const VarExpression<T> &other) = default;
     VarExpression &operator=(VarExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        return parameters[value];
+    T eval(const std::map<std::string, T> &parameters) const override {
+        return profile_phase(PHASE_EVAL, 1, [&]() -> T {
+            auto it = parameters.find(value);
+            return it != parameters.end() ? it->second : T(0); // неизвестная переменная равна нулю
+        });
     }
     std::shared_ptr<Expression<T>> diff(std::string &str) override {
-        if (str == value) return std::make_shared<ConstantExpression<T>>(T(1));
-        return std::make_shared<ConstantExpression<T>>(T(0));
+        if (str == value) return make_constant<T>(T(1));
+        return make_constant<T>(T(0));
     }
+    NodeKind kind() const override { return VAR_NODE; }
+    const std::string &get_name() const { return value; }
     std::string to_string() override {
         return value;
     }
 };
 
+// Очень глубокие деревья (сгенерированные формулы в мегабайты) нельзя удалять рекурсивно - кончится стек.
+// Удаляемый узел отдает детей в очередь самого внешнего удаления, и та удаляет их в цикле.
+// В thread_local только указатель: он переживает деструкторы других thread_local объектов с деревьями.
+template <typename T>
+void release_child(std::shared_ptr<Expression<T>> &child) noexcept {
+    thread_local std::vector<std::shared_ptr<Expression<T>>> *active = nullptr;
+    if (child.use_count() != 1) { // узел еще кому-то нужен (или его уже нет)
+        child.reset();
+        return;
+    }
+    if (active) {
+        active->push_back(std::move(child));
+        return;
+    }
+    std::vector<std::shared_ptr<Expression<T>>> pending;
+    active = &pending;
+    pending.push_back(std::move(child));
+    while (!pending.empty()) {
+        auto node = std::move(pending.back());
+        pending.pop_back();
+    }
+    active = nullptr;
+}
+
 template <typename T>
 class MonoExpression: public Expression<T> {
     std::shared_ptr<Expression<T>> expr;
@@ -108,24 +200,31 @@ class MonoExpression: public Expression<T> {
 public:
     MonoExpression(const std::shared_ptr<Expression<T>> &expr, Function func)
         : expr(expr), func(func) {}
-    ~MonoExpression() override = default;
+    ~MonoExpression() override { release_child(expr); }
     MonoExpression(const MonoExpression<T> &other) = default;
     MonoExpression(MonoExpression<T> &&other) = default;
     MonoExpression &operator=(const MonoExpression<T> &other) = default;
     MonoExpression &operator=(MonoExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        switch (func) {
-            case SIN: return std::sin(expr->eval(parameters));
-            case COS: return std::cos(expr->eval(parameters));
-            case LN: return std::log(expr->eval(parameters));
-            case EXP: return std::exp(expr->eval(parameters));
-            default: throw std::runtime_error("Unknown function");
-        }
+    T eval(const std::map<std::string, T> &parameters) const override {
+        return profile_phase(PHASE_EVAL, 1, [&]() -> T {
+            switch (func) {
+                case SIN: return std::sin(expr->eval(parameters));
+                case COS: return std::cos(expr->eval(parameters));
+                case LN: return std::log(expr->eval(parameters));
+                case EXP: return std::exp(expr->eval(parameters));
+                default: throw std::runtime_error("Unknown function");
+            }
+        });
+    }
+    std::shared_ptr<Expression<T>> diff(std::string &str) override {
+        return cached_diff(*this, str, [&] { return diff_node(str); });
     }
-    std::shared_ptr<Expression<T>> diff(std::string &str) override; // реализация ниже
+    std::shared_ptr<Expression<T>> diff_node(std::string &str); // реализация ниже, без кэша
     std::string to_string() override ;
-    friend std::shared_ptr<Expression<T>> optimize<T> (std::shared_ptr<Expression<T>> expr);
+    NodeKind kind() const override { return MONO_NODE; }
+    const std::shared_ptr<Expression<T>> &get_arg() const { return expr; }
+    Function get_func() const { return func; }
 
 };
 
@@ -143,245 +242,762 @@ public:
             throw std::runtime_error("Division by zero");
         }*/
     }
-    ~BinaryExpression() override = default;
+    ~BinaryExpression() override {
+        release_child(left);
+        release_child(right);
+    }
     BinaryExpression(const BinaryExpression<T> &other) = default;
     BinaryExpression(BinaryExpression<T> &&other) = default;
     BinaryExpression &operator=(const BinaryExpression<T> &other) = default;
     BinaryExpression &operator=(BinaryExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        switch (op) {
-            case PLUS: return left->eval(parameters) + right->eval(parameters);
-            case MINUS: return left->eval(parameters) - right->eval(parameters);
-            case MULT: return left->eval(parameters) * right->eval(parameters);
-            case DIV:
-                if (right->eval(parameters) == T(0)) throw std::runtime_error("Division by zero");
-                return left->eval(parameters) / right->eval(parameters);
-            case POW: return std::pow(left->eval(parameters), right->eval(parameters));
-            default: throw std::runtime_error("Unknown operation");
+    T eval(const std::map<std::string, T> &parameters) const override {
+        return profile_phase(PHASE_EVAL, 1, [&]() -> T {
+            switch (op) {
+                case PLUS: return left->eval(parameters) + right->eval(parameters);
+                case MINUS: return left->eval(parameters) - right->eval(parameters);
+                case MULT: return left->eval(parameters) * right->eval(parameters);
+                case DIV: {
+                    const T numerator = left->eval(parameters);
+                    const T denominator = right->eval(parameters);
+                    if (denominator == T(0)) throw std::runtime_error("Division by zero");
+                    return numerator / denominator;
+                }
+                case POW: return std::pow(left->eval(parameters), right->eval(parameters));
+                default: throw std::runtime_error("Unknown operation");
 
-        }
+            }
+        });
     }
     std::shared_ptr<Expression<T>> diff(std::string &str) override {
+        return cached_diff(*this, str, [&] { return diff_node(str); });
+    }
+    std::shared_ptr<Expression<T>> diff_node(std::string &str) {
         auto left_diff = left->diff(str);
         auto right_diff = right->diff(str);
         switch (op) {
             case PLUS:
-                return std::make_shared<BinaryExpression<T>>(left_diff, right_diff, PLUS);
+                return make_binary<T>(left_diff, right_diff, PLUS);
             case MINUS:
-                return std::make_shared<BinaryExpression<T>>(left_diff, right_diff, MINUS);
+                return make_binary<T>(left_diff, right_diff, MINUS);
             case MULT: {
-                auto left_mult = std::make_shared<BinaryExpression<T>>(left_diff, right, MULT);
-                auto right_mult = std::make_shared<BinaryExpression<T>>(left, right_diff, MULT);
-                return std::make_shared<BinaryExpression<T>>(left_mult, right_mult, PLUS);
+                auto left_mult = make_binary<T>(left_diff, right, MULT);
+                auto right_mult = make_binary<T>(left, right_diff, MULT);
+                return make_binary<T>(left_mult, right_mult, PLUS);
             }
             case DIV: {
-                auto numerator = std::make_shared<BinaryExpression<T>>(
-                    std::make_shared<BinaryExpression<T>>(left_diff, right, MULT),
-                    std::make_shared<BinaryExpression<T>>(left, right_diff, MULT),
+                auto numerator = make_binary<T>(
+                    make_binary<T>(left_diff, right, MULT),
+                    make_binary<T>(left, right_diff, MULT),
                     MINUS);
-                auto denominator = std::make_shared<BinaryExpression<T>>(
-                    right, std::make_shared<ConstantExpression<T>>(T(2)), POW);
-                return std::make_shared<BinaryExpression<T>>(numerator, denominator, DIV);
+                auto denominator = make_binary<T>(
+                    right, make_constant<T>(T(2)), POW);
+                return make_binary<T>(numerator, denominator, DIV);
             }
             case POW: {
-
-                if constexpr (!std::is_same_v<T, std::complex<double>>) {
-                    std::map<std::string, T> map;
-                    // f(x) ^ const
-                    if (auto right_const = std::dynamic_pointer_cast<ConstantExpression<T>>(right)) {
-                        if (right_const->eval(map) > T(1)) {
-                            auto power = std::make_shared<ConstantExpression<T>>(right_const->eval(map) - T(1));
-                            auto multiplier = std::make_shared<BinaryExpression<T>>(left, power, POW);
-                            return std::make_shared<BinaryExpression<T>>(
-                                right,
-                                std::make_shared<BinaryExpression<T>>(
-                                    multiplier , left_diff, MULT),
-                                MULT);
-                        }
-                        if (right_const->eval(map) == 1)
-                            return std::make_shared<ConstantExpression<T>>(T(1));
-
-                        auto multiplier = std::make_shared<BinaryExpression<T>>(right, left_diff, MULT);
-                        auto power = std::make_shared<ConstantExpression<T>>(T(std::abs(right_const->eval(map)) + T(1)));
-                        return std::make_shared<BinaryExpression<T>>(multiplier,
-                            std::make_shared<BinaryExpression<T>>(left, power, POW), DIV);
-                    }
-                    // const ^ f(x)
-                    if (auto left_const = std::dynamic_pointer_cast<ConstantExpression<T>>(left)) {
-                        auto multiplier1 = std::make_shared<BinaryExpression<T>>(left, right, POW);
-                        auto multiplier2 = std::make_shared<MonoExpression<T>>(left, LN);
-                        return std::make_shared<BinaryExpression<T>>(
-                            right_diff,
-                            std::make_shared<BinaryExpression<T>>(
-                                multiplier1,
-                                multiplier2, MULT),
+                // f(x) ^ const
+                if (auto right_const = std::dynamic_pointer_cast<ConstantExpression<T>>(right)) {
+                    const T c = right_const->get_value();
+                    if (c == T(1)) return left_diff;
+                    bool negative = false;
+                    if constexpr (!std::is_same_v<T, std::complex<double>>) negative = c <= T(0);
+                    if (!negative) {
+                        auto power = make_constant<T>(c - T(1));
+                        auto multiplier = make_binary<T>(left, power, POW);
+                        return make_binary<T>(
+                            right,
+                            make_binary<T>(
+                                multiplier , left_diff, MULT),
                             MULT);
                     }
-
-                    // f(x) ^ g(x)
-                    auto term1 = std::make_shared<BinaryExpression<T>>(
-                        right_diff, std::make_shared<MonoExpression<T>>(left, LN), MULT);
-                    auto term2 = std::make_shared<BinaryExpression<T>>(
-                        right, std::make_shared<BinaryExpression<T>>(left_diff, left, DIV), MULT);
-                    return std::make_shared<BinaryExpression<T>>(term1, term2, PLUS);
+                    // Отрицательная степень уходит в знаменатель
+                    auto multiplier = make_binary<T>(right, left_diff, MULT);
+                    auto power = make_constant<T>(T(std::abs(c) + T(1)));
+                    return make_binary<T>(multiplier,
+                        make_binary<T>(left, power, POW), DIV);
+                }
+                // const ^ f(x)
+                if (auto left_const = std::dynamic_pointer_cast<ConstantExpression<T>>(left)) {
+                    auto multiplier1 = make_binary<T>(left, right, POW);
+                    auto multiplier2 = make_mono<T>(left, LN);
+                    return make_binary<T>(
+                        right_diff,
+                        make_binary<T>(
+                            multiplier1,
+                            multiplier2, MULT),
+                        MULT);
                 }
 
+                // f(x) ^ g(x) = f^g * (g' * ln(f) + g * f' / f)
+                auto term1 = make_binary<T>(
+                    right_diff, make_mono<T>(left, LN), MULT);
+                auto term2 = make_binary<T>(
+                    right, make_binary<T>(left_diff, left, DIV), MULT);
+                return make_binary<T>(
+                    make_binary<T>(left, right, POW),
+                    make_binary<T>(term1, term2, PLUS), MULT);
             }
             default: throw std::runtime_error("Unknown operation");
         }
     }
-    std::string to_string() override {
+    std::string to_string() override;
+    NodeKind kind() const override { return BINARY_NODE; }
+    const std::shared_ptr<Expression<T>> &get_left() const { return left; }
+    const std::shared_ptr<Expression<T>> &get_right() const { return right; }
+    Operation get_op() const { return op; }
+};
+// Печать в один буфер, без рекурсии и без промежуточных строк.
+// minimal_parens - только скобки, нужные по приоритетам (все операции левоассоциативны, поэтому
+// правый операнд того же приоритета в скобках); разбор такой записи дает то же дерево.
+// Иначе - как to_string: каждая бинарная операция в скобках, числа как std::to_string.
+// share - общие (встреченные более одного раза) подвыражения выписываются один раз строками
+// "t1 = ...", последняя строка - само выражение. Имена с цифрами не пересекаются с переменными.
+// Без share общий узел печатается столько раз, сколько встречается, но обходится один раз:
+// повторно копируется уже напечатанный текст.
+struct PrintOptions {
+    bool minimal_parens = true;
+    bool share = false;
+};
+
+template <typename T>
+class Printer {
+    struct Frame {
+        const Expression<T> *node;
+        std::uint8_t stage;
+        bool parens; // скобки вокруг узла решает родитель
+        bool shared; // на узел есть другие ссылки: текст запоминается
+        std::size_t begin;
+    };
+
+    PrintOptions options;
+    std::vector<Frame> stack;
+    std::unordered_map<const Expression<T> *, std::pair<std::size_t, std::size_t>> printed; // начало и длина текста
+    std::unordered_map<const Expression<T> *, std::size_t> names;                         // номера временных (share)
+
+    static const char *function_name(const Function func) {
+        switch (func) {
+            case SIN: return "sin";
+            case COS: return "cos";
+            case LN: return "ln";
+            case EXP: return "exp";
+        }
+        return "unknown";
+    }
+
+    static const char *operation_text(const Operation op) {
         switch (op) {
-            case PLUS: return "(" + left->to_string() + " + " + right->to_string() + ")";
-            case MINUS: return "(" + left->to_string() + " - " + right->to_string() + ")";
-            case MULT: return "(" + left->to_string() + " * " + right->to_string() + ")";
-            case DIV: return "(" + left->to_string() + " / " + right->to_string() + ")";
-            case POW: return "(" + left->to_string() + "^" + right->to_string() + ")";
-            default: return "Unknown operation";
+            case PLUS: return " + ";
+            case MINUS: return " - ";
+            case MULT: return " * ";
+            case DIV: return " / ";
+            case POW: return "^";
         }
+        return " ? ";
     }
-    friend std::shared_ptr<Expression<T>> optimize<T> (std::shared_ptr<Expression<T>> expr);
-};
-template<typename T>
-std::string MonoExpression<T>::to_string() {
-    if (auto binary = std::dynamic_pointer_cast<BinaryExpression<T>>(expr)) {
-        switch (func) {
-            case SIN: return "sin" + expr->to_string();
-            case COS: return "cos" + expr->to_string();
-            case LN: return "ln" + expr->to_string();
-            case EXP: return "exp" + expr->to_string();
-            default: return "Unknown function";
+
+    // Приоритет операнда: листья, функции и временные не требуют скобок
+    int priority(const Expression<T> &node) const {
+        if (node.kind() != BINARY_NODE || (options.share && names.count(&node))) return 4;
+        return operators(static_cast<const BinaryExpression<T> &>(node).get_op()).priority;
+    }
+
+    void push(const std::shared_ptr<Expression<T>> &child, const bool parens) {
+        const bool leaf = child->kind() == CONST_NODE || child->kind() == VAR_NODE;
+        stack.push_back({child.get(), 0, parens, !leaf && child.use_count() > 1, 0});
+    }
+
+    void close(std::string &out) {
+        const Frame &frame = stack.back();
+        if (frame.shared) printed.emplace(frame.node, std::make_pair(frame.begin, out.size() - frame.begin));
+        if (frame.parens) out += ')';
+        stack.pop_back();
+    }
+
+    // Одно выражение; defining - определяемый временный узел, он печатается сам, а не своим именем
+    void body(const Expression<T> &root, std::string &out, const Expression<T> *defining) {
+        stack.push_back({&root, 0, !options.minimal_parens && priority(root) < 4, false, 0});
+        while (!stack.empty()) {
+            Frame &frame = stack.back();
+            const Expression<T> &node = *frame.node;
+            switch (frame.stage++) {
+                case 0: {
+                    if (frame.parens) out += '(';
+                    frame.begin = out.size();
+                    if (auto it = options.share ? names.find(&node) : names.end(); it != names.end() && &node != defining) {
+                        out += 't';
+                        out += std::to_string(it->second);
+                        frame.shared = false;
+                        close(out);
+                        break;
+                    }
+                    if (frame.shared) {
+                        if (auto it = printed.find(&node); it != printed.end()) {
+                            const auto [begin, length] = it->second;
+                            out.resize(frame.begin + length);
+                            std::memcpy(out.data() + frame.begin, out.data() + begin, length);
+                            frame.shared = false;
+                            close(out);
+                            break;
+                        }
+                    }
+                    switch (node.kind()) {
+                        case CONST_NODE:
+                            append_constant(out, static_cast<const ConstantExpression<T> &>(node).get_value(),
+                                            options.minimal_parens);
+                            close(out);
+                            break;
+                        case VAR_NODE:
+                            out += static_cast<const VarExpression<T> &>(node).get_name();
+                            close(out);
+                            break;
+                        case MONO_NODE: {
+                            const auto &mono = static_cast<const MonoExpression<T> &>(node);
+                            out += function_name(mono.get_func());
+                            out += '(';
+                            push(mono.get_arg(), false);
+                            break;
+                        }
+                        case BINARY_NODE: {
+                            const auto &binary = static_cast<const BinaryExpression<T> &>(node);
+                            const int own = operators(binary.get_op()).priority;
+                            const int left = priority(*binary.get_left());
+                            push(binary.get_left(), options.minimal_parens ? left < own : left < 4);
+                            break;
+                        }
+                    }
+                    break;
+                }
+                case 1: {
+                    if (node.kind() == MONO_NODE) {
+                        out += ')';
+                        close(out);
+                        break;
+                    }
+                    const auto &binary = static_cast<const BinaryExpression<T> &>(node);
+                    out += operation_text(binary.get_op());
+                    const int own = operators(binary.get_op()).priority;
+                    const int right = priority(*binary.get_right());
+                    push(binary.get_right(), options.minimal_parens ? right <= own : right < 4);
+                    break;
+                }
+                default:
+                    close(out);
+            }
         }
     }
-    switch (func) {
-        case SIN: return "sin(" + expr->to_string() + ")";
-        case COS: return "cos(" + expr->to_string() + ")";
-        case LN: return "ln(" + expr->to_string() + ")";
-        case EXP: return "exp(" + expr->to_string() + ")";
-        default: return "Unknown function";
+
+    // Общие узлы (больше одного родителя) в порядке, в котором их можно определять: дети раньше
+    std::vector<const Expression<T> *> shared_nodes(const Expression<T> &root) {
+        std::unordered_map<const Expression<T> *, std::size_t> parents;
+        std::vector<const Expression<T> *> order;
+        std::vector<std::pair<const Expression<T> *, bool>> pending{{&root, false}};
+        parents[&root] = 1;
+        while (!pending.empty()) {
+            auto [node, expanded] = pending.back();
+            if (expanded) {
+                pending.pop_back();
+                order.push_back(node);
+                continue;
+            }
+            pending.back().second = true;
+            auto visit = [&](const Expression<T> *child) {
+                if (parents[child]++ == 0) pending.push_back({child, false});
+            };
+            // Правый кладется первым, чтобы левые определения шли раньше
+            if (node->kind() == MONO_NODE) {
+                visit(static_cast<const MonoExpression<T> *>(node)->get_arg().get());
+            } else if (node->kind() == BINARY_NODE) {
+                const auto *binary = static_cast<const BinaryExpression<T> *>(node);
+                visit(binary->get_right().get());
+                visit(binary->get_left().get());
+            }
+        }
+        std::vector<const Expression<T> *> result;
+        for (const auto *node : order) {
+            if (parents[node] > 1 && (node->kind() == MONO_NODE || node->kind() == BINARY_NODE)) result.push_back(node);
+        }
+        return result;
+    }
+
+public:
+    explicit Printer(const PrintOptions options = {}) : options(options) {}
+
+    // Дописывает запись выражения в out
+    void print(const Expression<T> &expr, std::string &out) {
+        printed.clear();
+        names.clear();
+        if (options.share) {
+            for (const auto *node : shared_nodes(expr)) {
+                const std::size_t number = names.size() + 1;
+                out += 't';
+                out += std::to_string(number);
+                out += " = ";
+                body(*node, out, node);
+                out += '\n';
+                names.emplace(node, number);
+            }
+        }
+        body(expr, out, nullptr);
     }
+};
+
+template <typename T>
+void print(const Expression<T> &expr, std::string &out, const PrintOptions options = {}) {
+    Printer<T>(options).print(expr, out);
+}
+
+template <typename T>
+std::string print(const std::shared_ptr<Expression<T>> &expr, const PrintOptions options = {}) {
+    std::string out;
+    Printer<T>(options).print(*expr, out);
+    return out;
+}
+
+template <typename T>
+std::string MonoExpression<T>::to_string() {
+    std::string result;
+    Printer<T>(PrintOptions{false, false}).print(*this, result);
+    return result;
+}
+
+template <typename T>
+std::string BinaryExpression<T>::to_string() {
+    std::string result;
+    Printer<T>(PrintOptions{false, false}).print(*this, result);
+    return result;
 }
 
 template<typename T>
-std::shared_ptr<Expression<T> > MonoExpression<T>::diff(std::string &str) {
+std::shared_ptr<Expression<T> > MonoExpression<T>::diff_node(std::string &str) {
     auto expr_diff = expr->diff(str);
     switch (func) {
         case SIN:
-            return std::make_shared<BinaryExpression<T>>(
-                std::make_shared<MonoExpression<T>>(expr, COS),
+            return make_binary<T>(
+                make_mono<T>(expr, COS),
                 expr_diff, MULT);
         case COS:
-            return std::make_shared<BinaryExpression<T>>(
-                std::make_shared<BinaryExpression<T>>(
-                    std::make_shared<ConstantExpression<T>>(T(-1)),
-                    std::make_shared<MonoExpression<T>>(expr, SIN),
+            return make_binary<T>(
+                make_binary<T>(
+                    make_constant<T>(T(-1)),
+                    make_mono<T>(expr, SIN),
                     MULT),
                 expr_diff, MULT);
         case LN:
-            return std::make_shared<BinaryExpression<T>>(expr_diff, expr, DIV);
+            return make_binary<T>(expr_diff, expr, DIV);
         case EXP:
-            return std::make_shared<BinaryExpression<T>>(
-                std::make_shared<MonoExpression<T>>(expr, EXP),
+            return make_binary<T>(
+                make_mono<T>(expr, EXP),
                 expr_diff, MULT);
         default: throw std::runtime_error("Unknown function");
     }
 }
 
+// Таблица уникальных узлов (hash-consing): пока она активна, структурно одинаковые узлы
+// создаются один раз, дерево превращается в DAG, а равенство поддеревьев - в сравнение указателей.
+// Таблица держит свои узлы живыми до своего уничтожения.
 template <typename T>
-std::shared_ptr<Expression<T>> optimize (std::shared_ptr<Expression<T>> expr) {
-    if (auto mono = std::dynamic_pointer_cast<MonoExpression<T>>(expr)) {
-        mono->expr = optimize(mono->expr);
-    }
-    if (auto binary = std::dynamic_pointer_cast<BinaryExpression<T>>(expr)) {
-        binary->left = optimize(binary->left);
-        binary->right = optimize(binary->right);
-        /*if (auto left_b = std::dynamic_pointer_cast<BinaryExpression<T>>(binary->left)) {
-            optimize(std::dynamic_pointer_cast<Expression<T>>(left_b));
+class HashConsTable {
+    struct Key {
+        NodeKind kind;
+        int tag; // операция или функция
+        const Expression<T> *left;
+        const Expression<T> *right;
+        std::uint64_t bits[2]; // биты значения константы
+        std::string name;
+
+        bool operator==(const Key &other) const = default;
+    };
+    struct KeyHash {
+        std::size_t operator()(const Key &key) const {
+            std::size_t h = std::hash<int>()(key.kind * 16 + key.tag);
+            auto mix = [&h](const std::size_t v) { h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2); };
+            mix(std::hash<const void *>()(key.left));
+            mix(std::hash<const void *>()(key.right));
+            mix(std::hash<std::uint64_t>()(key.bits[0]));
+            mix(std::hash<std::uint64_t>()(key.bits[1]));
+            mix(std::hash<std::string>()(key.name));
+            return h;
         }
-        if (auto right_b = std::dynamic_pointer_cast<BinaryExpression<T>>(binary->right)) {
-            optimize(std::dynamic_pointer_cast<Expression<T>>(right_b));
-        }*/
-        auto left = std::dynamic_pointer_cast<ConstantExpression<T>>(binary->left);
-        auto right = std::dynamic_pointer_cast<ConstantExpression<T>>(binary->right);
-        // Если сложение или вычитание нас интересуют нули
-        if (binary->op == PLUS || binary->op == MINUS) {
-            // Оба константы
-            if (left && right) {
-                std::map <std::string, T> map;
-                // Есть ноль
-                if (left->eval(map) == T(0) || right->eval(map) == T(0)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(expr->eval(map)));
-                }
-            // Если только левое выражение - константа
-            } else if (left) {
-                std::map <std::string, T> map;
-                // Если оно ноль
-                if (left->eval(map) == T(0)) {
-                    if (binary->op == MINUS) {
-                        binary->op = MULT;
-                        binary->left = std::make_shared<ConstantExpression<T>>(T(-1));
-                    } else {
-                        expr = binary->right;
-                    }
-                }
-            // Если только правое выражение - константа
-            } else if (right) {
-                std::map <std::string, T> map;
-                // Если оно ноль
-                if (right->eval(map) == T(0)) {
-                    expr = binary->left;
-                }
+    };
+
+    std::unordered_map<Key, std::shared_ptr<Expression<T>>, KeyHash> nodes;
+    std::size_t hits = 0;
+
+    template <typename Make>
+    std::shared_ptr<Expression<T>> intern(Key &&key, Make make) {
+        auto it = nodes.find(key);
+        if (it != nodes.end()) {
+            hits++;
+            return it->second;
+        }
+        auto node = make();
+        nodes.emplace(std::move(key), node);
+        return node;
+    }
+
+    static Key key(const NodeKind kind, const int tag, const Expression<T> *left, const Expression<T> *right) {
+        return Key{kind, tag, left, right, {0, 0}, {}};
+    }
+
+public:
+    HashConsTable() = default;
+    HashConsTable(const HashConsTable &other) = delete;
+    HashConsTable &operator=(const HashConsTable &other) = delete;
+
+    std::size_t size() const { return nodes.size(); }
+    std::size_t hit_count() const { return hits; }
+
+    std::shared_ptr<Expression<T>> constant(const T &value) {
+        Key k = key(CONST_NODE, 0, nullptr, nullptr);
+        const auto bits = value_bits(value);
+        k.bits[0] = bits[0];
+        k.bits[1] = bits[1];
+        return intern(std::move(k), [&] { return make_node<ConstantExpression<T>>(value); });
+    }
+    std::shared_ptr<Expression<T>> var(const std::string &name) {
+        Key k = key(VAR_NODE, 0, nullptr, nullptr);
+        k.name = name;
+        return intern(std::move(k), [&] { return make_node<VarExpression<T>>(name); });
+    }
+    std::shared_ptr<Expression<T>> mono(const std::shared_ptr<Expression<T>> &arg, const Function func) {
+        return intern(key(MONO_NODE, func, arg.get(), nullptr),
+                      [&] { return make_node<MonoExpression<T>>(arg, func); });
+    }
+    std::shared_ptr<Expression<T>> binary(const std::shared_ptr<Expression<T>> &left,
+                                          const std::shared_ptr<Expression<T>> &right, const Operation op) {
+        return intern(key(BINARY_NODE, op, left.get(), right.get()),
+                      [&] { return make_node<BinaryExpression<T>>(left, right, op); });
+    }
+
+    // Таблица, через которую сейчас создаются узлы этого потока (nullptr - без дедупликации)
+    static HashConsTable *&current() {
+        thread_local HashConsTable *active = nullptr;
+        return active;
+    }
+};
+
+// Пока объект жив, узлы типа T в этом потоке создаются через таблицу
+template <typename T>
+class HashConsScope {
+    HashConsTable<T> *previous;
+
+public:
+    explicit HashConsScope(HashConsTable<T> &table) : previous(HashConsTable<T>::current()) {
+        HashConsTable<T>::current() = &table;
+    }
+    ~HashConsScope() { HashConsTable<T>::current() = previous; }
+    HashConsScope(const HashConsScope &other) = delete;
+    HashConsScope &operator=(const HashConsScope &other) = delete;
+};
+
+// Кэш производных: d/dvar узла считается один раз, пока кэш активен, - и для общих поддеревьев
+// (после hash-consing это один узел), и для повторных diff, и для diff(diff(f)).
+// Узлы-источники не удерживаются (weak_ptr), поэтому запись умершего узла просто не находится.
+// Размер ограничен: при переполнении вытесняются самые старые записи.
+// weak_ptr держит память узла до удаления записи, а память узла из арены возвращается в арену, поэтому
+// кэш не должен пережить арены своих узлов: очищайте (clear) или уничтожайте его раньше арены.
+template <typename T>
+class DiffCache {
+    struct Key {
+        const Expression<T> *node;
+        std::string var;
+
+        bool operator==(const Key &other) const = default;
+    };
+    struct KeyHash {
+        std::size_t operator()(const Key &key) const {
+            return std::hash<const void *>()(key.node) ^ (std::hash<std::string>()(key.var) << 1);
+        }
+    };
+    struct Entry {
+        std::weak_ptr<Expression<T>> source;
+        std::shared_ptr<Expression<T>> result;
+        typename std::list<Key>::iterator slot; // место ключа в order
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    std::list<Key> order; // порядок добавления, для вытеснения; запись и ее место удаляются вместе
+
+    void erase(typename std::unordered_map<Key, Entry, KeyHash>::iterator it) {
+        order.erase(it->second.slot);
+        entries.erase(it);
+    }
+    std::size_t capacity;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+
+public:
+    explicit DiffCache(const std::size_t capacity = 1 << 16) : capacity(capacity) {}
+    DiffCache(const DiffCache &other) = delete;
+    DiffCache &operator=(const DiffCache &other) = delete;
+
+    std::size_t size() const { return entries.size(); }
+    std::size_t hit_count() const { return hits; }
+    std::size_t miss_count() const { return misses; }
+
+    std::shared_ptr<Expression<T>> find(const Expression<T> &node, const std::string &var) {
+        auto it = entries.find(Key{&node, var});
+        if (it == entries.end() || it->second.source.expired()) {
+            // Адрес умершего узла может достаться новому узлу - его запись не должна вытеснить новую
+            if (it != entries.end()) erase(it);
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        return it->second.result;
+    }
+
+    void insert(Expression<T> &node, const std::string &var, const std::shared_ptr<Expression<T>> &result) {
+        auto source = node.weak_from_this();
+        if (source.expired() || capacity == 0) return; // узел не в shared_ptr - кэшировать нечем
+        Key key{&node, var};
+        auto it = entries.find(key);
+        if (it != entries.end()) erase(it);
+        order.push_back(key);
+        entries.emplace(std::move(key), Entry{std::move(source), result, std::prev(order.end())});
+        while (entries.size() > capacity) erase(entries.find(order.front()));
+    }
+
+    void clear() {
+        entries.clear();
+        order.clear();
+    }
+
+    // Кэш, которым сейчас пользуется diff в этом потоке (nullptr - без кэша)
+    static DiffCache *&current() {
+        thread_local DiffCache *active = nullptr;
+        return active;
+    }
+};
+
+// Пока объект жив, diff в этом потоке запоминает результаты в кэше
+template <typename T>
+class DiffCacheScope {
+    DiffCache<T> *previous;
+
+public:
+    explicit DiffCacheScope(DiffCache<T> &cache) : previous(DiffCache<T>::current()) { DiffCache<T>::current() = &cache; }
+    ~DiffCacheScope() { DiffCache<T>::current() = previous; }
+    DiffCacheScope(const DiffCacheScope &other) = delete;
+    DiffCacheScope &operator=(const DiffCacheScope &other) = delete;
+};
+
+// Размер результата фазы в различных узлах: только во внешнем вызове и при включенном профилировщике
+template <typename T>
+void profile_tree(const PhaseTimer &timer, const std::shared_ptr<Expression<T>> &root) {
+    Profiler *profiler = timer.outermost();
+    if (!profiler || !root) return;
+    std::unordered_set<const Expression<T> *> seen{root.get()};
+    std::vector<const Expression<T> *> pending{root.get()};
+    auto visit = [&](const std::shared_ptr<Expression<T>> &child) {
+        if (seen.insert(child.get()).second) pending.push_back(child.get());
+    };
+    while (!pending.empty()) {
+        const Expression<T> *node = pending.back();
+        pending.pop_back();
+        if (node->kind() == MONO_NODE) {
+            visit(static_cast<const MonoExpression<T> *>(node)->get_arg());
+        } else if (node->kind() == BINARY_NODE) {
+            visit(static_cast<const BinaryExpression<T> *>(node)->get_left());
+            visit(static_cast<const BinaryExpression<T> *>(node)->get_right());
+        }
+    }
+    profiler->tree_size(seen.size());
+}
+
+// Фаза, результат которой - дерево: без профилировщика просто body()
+template <typename Body>
+auto profile_tree_phase(const Phase phase, Body &&body) {
+    if (Profiler::active()) [[unlikely]] {
+        PhaseTimer timer(phase);
+        auto result = body();
+        profile_tree(timer, result);
+        return result;
+    }
+    return body();
+}
+
+// dynamic_pointer_cast со счетчиком профилировщика (profiler может быть nullptr)
+template <typename U, typename T>
+std::shared_ptr<U> profiled_cast(const std::shared_ptr<Expression<T>> &expr, Profiler *profiler) {
+    if (profiler) profiler->count_cast();
+    return std::dynamic_pointer_cast<U>(expr);
+}
+
+template <typename T, typename Compute>
+std::shared_ptr<Expression<T>> cached_diff(Expression<T> &node, const std::string &var, Compute compute) {
+    return profile_tree_phase(PHASE_DIFF, [&] {
+        auto *cache = DiffCache<T>::current();
+        if (!cache) return compute();
+        if (auto result = cache->find(node, var)) return result;
+        auto result = compute();
+        cache->insert(node, var, result);
+        return result;
+    });
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_constant(const T &value) {
+    if (auto *table = HashConsTable<T>::current()) return table->constant(value);
+    return make_node<ConstantExpression<T>>(value);
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_var(const std::string &name) {
+    if (auto *table = HashConsTable<T>::current()) return table->var(name);
+    return make_node<VarExpression<T>>(name);
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_mono(const std::shared_ptr<Expression<T>> &arg, const Function func) {
+    if (auto *table = HashConsTable<T>::current()) return table->mono(arg, func);
+    return make_node<MonoExpression<T>>(arg, func);
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_binary(const std::shared_ptr<Expression<T>> &left,
+                                           const std::shared_ptr<Expression<T>> &right, const Operation op) {
+    if (auto *table = HashConsTable<T>::current()) return table->binary(left, right, op);
+    return make_node<BinaryExpression<T>>(left, right, op);
+}
+
+// Бинарная операция над готовыми значениями (для свертки констант)
+template <typename T>
+T apply_operation(const Operation op, const T &left, const T &right) {
+    switch (op) {
+        case PLUS: return left + right;
+        case MINUS: return left - right;
+        case MULT: return left * right;
+        case DIV:
+            if (right == T(0)) throw std::runtime_error("Division by zero");
+            return left / right;
+        case POW: return std::pow(left, right);
+        default: throw std::runtime_error("Unknown operation");
+    }
+}
+
+// Перезапись одного узла, дети которого уже оптимизированы (у MonoExpression - только new_left).
+// Узлы не меняются на месте (их могут разделять несколько деревьев), измененный узел собирается заново
+template <typename T>
+std::shared_ptr<Expression<T>> optimize_node(const std::shared_ptr<Expression<T>> &expr,
+                                             const std::shared_ptr<Expression<T>> &new_left,
+                                             const std::shared_ptr<Expression<T>> &new_right, Profiler *profiler) {
+    if (expr->kind() == MONO_NODE) {
+        const auto &mono = static_cast<const MonoExpression<T> &>(*expr);
+        if (new_left != mono.get_arg()) return make_mono<T>(new_left, mono.get_func());
+        return expr;
+    }
+    if (expr->kind() != BINARY_NODE) return expr;
+    const auto &binary = static_cast<const BinaryExpression<T> &>(*expr);
+    const Operation op = binary.get_op();
+    auto left = profiled_cast<ConstantExpression<T>>(new_left, profiler);
+    auto right = profiled_cast<ConstantExpression<T>>(new_right, profiler);
+    // Если сложение или вычитание нас интересуют нули
+    if (op == PLUS || op == MINUS) {
+        // Оба константы
+        if (left && right) {
+            // Есть ноль
+            if (left->get_value() == T(0) || right->get_value() == T(0)) {
+                return make_constant<T>(apply_operation(op, left->get_value(), right->get_value()));
             }
+        // Если только левое выражение - константа
+        } else if (left) {
+            // Если оно ноль
+            if (left->get_value() == T(0)) {
+                if (op == MINUS) return make_binary<T>(make_constant<T>(T(-1)), new_right, MULT);
+                return new_right;
+            }
+        // Если только правое выражение - константа
+        } else if (right) {
+            // Если оно ноль
+            if (right->get_value() == T(0)) return new_left;
         }
-        if (binary->op == MULT || binary->op == DIV) {
-            // Оба константы
-            if (left && right) {
-                std::map <std::string, T> map;
-                // Есть ноль
-                if (left->eval(map) == T(0) || right->eval(map) == T(0)) {
-                    if (binary->op == MULT) {
-                        expr = std::make_shared<ConstantExpression<T>>(T(0));
-                    } else if (binary->op == DIV) {
-                        if (right->eval(map) == T(0)) {
-                            throw std::runtime_error("Division by zero");
-                        } else if (left->eval(map) == T(0)) {
-                            expr = std::make_shared<ConstantExpression<T>>(T(0));
-                        }
-                    }
-                }
-                // Есть единица
-                if (left->eval(map) == T(1) || right->eval(map) == T(1)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(expr->eval(map)));
-                }
-            // Если только левое выражение - константа
-            } else if (left) {
-                std::map <std::string, T> map;
-                // Если оно единица
-                if (left->eval(map) == T(1)) {
-                    if (binary->op == MULT) {
-                        expr = binary->right;
-                    }
-                }
-                // Если - 0
-                if (left->eval(map) == T(0)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(0));
-                }
-                // Если только правое выражение - константа
-            } else if (right) {
-                std::map <std::string, T> map;
-                // Если оно единица
-                if (right->eval(map) == T(1)) {
-                    expr = binary->left;
-                }
-                // Если - 0
-                if (right->eval(map) == T(0)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(0));
-                }
+    }
+    if (op == MULT || op == DIV) {
+        // Оба константы
+        if (left && right) {
+            // Есть ноль
+            if (op == DIV && right->get_value() == T(0)) throw std::runtime_error("Division by zero");
+            if (left->get_value() == T(0) || right->get_value() == T(0)) return make_constant<T>(T(0));
+            // Есть единица
+            if (left->get_value() == T(1) || right->get_value() == T(1)) {
+                return make_constant<T>(apply_operation(op, left->get_value(), right->get_value()));
+            }
+        // Если только левое выражение - константа
+        } else if (left) {
+            // Если оно единица
+            if (left->get_value() == T(1) && op == MULT) return new_right;
+            // Если - 0
+            if (left->get_value() == T(0)) return make_constant<T>(T(0));
+        // Если только правое выражение - константа
+        } else if (right) {
+            // Если - 0
+            if (right->get_value() == T(0)) {
+                if (op == DIV) throw std::runtime_error("Division by zero");
+                return make_constant<T>(T(0));
             }
-        } //
+            // Если оно единица
+            if (right->get_value() == T(1)) return new_left;
+        }
     }
+    if (new_left != binary.get_left() || new_right != binary.get_right()) return make_binary<T>(new_left, new_right, op);
     return expr;
 }
 
+// Обход без рекурсии (как в compile): узел перезаписывается, когда его дети уже обработаны.
+// Общий узел (use_count > 1) оптимизируется один раз.
+template <typename T>
+std::shared_ptr<Expression<T>> optimize_tree(const std::shared_ptr<Expression<T>> &root, Profiler *profiler) {
+    using Ptr = std::shared_ptr<Expression<T>>;
+    // Указатели на shared_ptr внутри дерева: узлы живы, пока жив root
+    std::vector<std::pair<const Ptr *, bool>> stack{{&root, false}};
+    std::vector<Ptr> results;
+    std::unordered_map<const Expression<T> *, Ptr> shared;
+    while (!stack.empty()) {
+        const auto [node, expanded] = stack.back();
+        const Ptr &expr = *node;
+        if (!expanded) {
+            if (expr.use_count() > 1) {
+                auto it = shared.find(expr.get());
+                if (it != shared.end()) {
+                    results.push_back(it->second);
+                    stack.pop_back();
+                    continue;
+                }
+            }
+            stack.back().second = true;
+            // Правый ребенок кладется первым, чтобы левый обрабатывался раньше
+            if (auto mono = profiled_cast<MonoExpression<T>>(expr, profiler)) {
+                stack.push_back({&mono->get_arg(), false});
+            } else if (auto binary = profiled_cast<BinaryExpression<T>>(expr, profiler)) {
+                stack.push_back({&binary->get_right(), false});
+                stack.push_back({&binary->get_left(), false});
+            }
+            continue;
+        }
+        stack.pop_back();
+        Ptr result;
+        if (expr->kind() == MONO_NODE) {
+            result = optimize_node<T>(expr, results.back(), nullptr, profiler);
+            results.pop_back();
+        } else if (expr->kind() == BINARY_NODE) {
+            Ptr right = std::move(results.back());
+            results.pop_back();
+            result = optimize_node<T>(expr, results.back(), right, profiler);
+            results.pop_back();
+        } else {
+            result = expr;
+        }
+        if (expr.use_count() > 1) shared.emplace(expr.get(), result);
+        results.push_back(std::move(result));
+    }
+    return results.back();
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> optimize (std::shared_ptr<Expression<T>> expr) {
+    Profiler *profiler = Profiler::active();
+    return profile_tree_phase(PHASE_OPTIMIZE, [&] { return optimize_tree(expr, profiler); });
+}
+
 #endif //EXPRESSION_H
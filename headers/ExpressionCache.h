@@ -0,0 +1,142 @@
+#ifndef EXPRESSION_CACHE_H
+#define EXPRESSION_CACHE_H
+
+#include "Parser.h"
+#include "Program.h"
+#include "Simplify.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Кэш разобранных формул: одна и та же формула (с точностью до пробелов и регистра имен)
+// разбирается, оптимизируется и компилируется один раз. Записи неизменяемы и живут, пока на них
+// есть ссылки, даже если кэш их уже вытеснил. Вытесняются давно не использованные (LRU).
+
+template <typename T>
+struct CompiledExpression {
+    std::string key;                          // нормализованный текст
+    std::shared_ptr<Expression<T>> parsed;
+    std::shared_ptr<Expression<T>> optimized;
+    Program<T> program;                       // скомпилировано из optimized
+    std::size_t bytes = 0;                    // примерный размер записи
+};
+
+struct CacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+};
+
+// Нормализованный текст: токены через пробел, имена в нижнем регистре, вставленные токены
+// (0 перед унарным минусом, * перед i) выписаны явно. Разбор такого текста дает то же дерево.
+inline std::string normalize_formula(const std::string_view text, std::vector<Token> *tokens = nullptr) {
+    std::string key;
+    key.reserve(text.size());
+    Lexer lexer(text);
+    Token token(START, {});
+    while (lexer.next(token)) {
+        if (!key.empty()) key += ' ';
+        for (const char c : token.value) key += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (token.type == COMPLEX) key += 'i';
+        if (tokens) tokens->push_back(token);
+    }
+    return key;
+}
+
+template <typename T>
+class ExpressionCache {
+    using Entry = std::shared_ptr<const CompiledExpression<T>>;
+
+    mutable std::mutex mutex;
+    std::size_t capacity;
+    std::list<Entry> order; // в начале - последние использованные
+    std::unordered_map<std::string_view, typename std::list<Entry>::iterator> index; // ключи живут в записях
+    CacheStats stats_;
+
+    static Entry build(std::string key, std::vector<Token> tokens) {
+        auto entry = std::make_shared<CompiledExpression<T>>();
+        entry->parsed = Parser<T>(std::move(tokens)).parse();
+        try {
+            entry->optimized = optimize(entry->parsed);
+        } catch (const std::runtime_error &) {
+            entry->optimized = entry->parsed; // деление на константный ноль проявится при подсчете
+        }
+        entry->program = compile(entry->optimized);
+        const auto &program = entry->program;
+        entry->bytes = sizeof(CompiledExpression<T>) + 2 * key.size()
+                       + (node_count(entry->parsed) + node_count(entry->optimized)) * sizeof(BinaryExpression<T>)
+                       + program.get_code().size() * sizeof(Instruction) + program.get_constants().size() * sizeof(T);
+        for (const auto &name : program.get_variables()) entry->bytes += sizeof(std::string) + name.size();
+        entry->key = std::move(key);
+        return entry;
+    }
+
+    void evict_locked() {
+        while (stats_.bytes > capacity && !order.empty()) {
+            const auto &victim = order.back();
+            stats_.bytes -= victim->bytes;
+            index.erase(victim->key);
+            order.pop_back();
+            stats_.evictions++;
+        }
+        stats_.entries = order.size();
+    }
+
+public:
+    explicit ExpressionCache(const std::size_t capacity_bytes = std::size_t(64) << 20) : capacity(capacity_bytes) {}
+
+    // Запись для формулы; разбирает ее при промахе (ошибки разбора пробрасываются, в кэш ничего не попадает)
+    std::shared_ptr<const CompiledExpression<T>> get(const std::string_view text) {
+        std::vector<Token> tokens;
+        std::string key = normalize_formula(text, &tokens);
+        {
+            std::lock_guard lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                order.splice(order.begin(), order, it->second);
+                stats_.hits++;
+                return *it->second;
+            }
+            stats_.misses++;
+        }
+        // Разбор без блокировки: другие потоки в это время пользуются кэшем
+        auto entry = build(std::move(key), std::move(tokens));
+        std::lock_guard lock(mutex);
+        auto it = index.find(entry->key);
+        if (it != index.end()) return *it->second; // успел другой поток
+        if (entry->bytes > capacity) return entry; // слишком большая запись не кэшируется
+        order.push_front(entry);
+        index.emplace(entry->key, order.begin());
+        stats_.bytes += entry->bytes;
+        evict_locked();
+        return entry;
+    }
+
+    CacheStats stats() const {
+        std::lock_guard lock(mutex);
+        return stats_;
+    }
+
+    std::size_t get_capacity() const {
+        std::lock_guard lock(mutex);
+        return capacity;
+    }
+
+    void set_capacity(const std::size_t capacity_bytes) {
+        std::lock_guard lock(mutex);
+        capacity = capacity_bytes;
+        evict_locked();
+    }
+
+    void clear() {
+        std::lock_guard lock(mutex);
+        index.clear();
+        order.clear();
+        stats_.bytes = 0;
+        stats_.entries = 0;
+    }
+};
+
+#endif // EXPRESSION_CACHE_H
@@ -0,0 +1,89 @@
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include "Program.h"
+#include <algorithm>
+
+// Обратное автоматическое дифференцирование: значение функции и все частные производные
+// за один прямой и один обратный проход. Лентой служит программа без переиспользования
+// регистров, так что каждое промежуточное значение доступно на обратном проходе.
+// Для комплексных чисел считаются производные голоморфной функции (те же формулы, что и в diff).
+template <typename T>
+class Gradient {
+    Program<T> tape;
+    std::vector<char> active; // зависит ли значение от какой-нибудь переменной
+
+public:
+    explicit Gradient(const std::shared_ptr<Expression<T>> &expr)
+        : tape(compile(expr, CompileOptions{.eliminate_common = true, .reuse_registers = false})) {
+        const auto &code = tape.get_code();
+        active.assign(code.size(), 0);
+        for (std::size_t i = 0; i < code.size(); i++) {
+            switch (code[i].code) {
+                case OP_CONST: break;
+                case OP_VAR: active[i] = 1; break;
+                case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+                    active[i] = active[code[i].a] || active[code[i].b];
+                    break;
+                default: active[i] = active[code[i].a];
+            }
+        }
+    }
+
+    const Program<T> &get_program() const { return tape; }
+    // Порядок производных в grad совпадает с порядком переменных
+    const std::vector<std::string> &get_variables() const { return tape.get_variables(); }
+
+    // scratch - не меньше 2 * get_program().get_registers() элементов
+    T eval(std::span<const T> values, std::span<T> grad, std::span<T> scratch) const {
+        const auto &code = tape.get_code();
+        const std::size_t n = code.size();
+        if (grad.size() < tape.get_variables().size()) throw std::runtime_error("Not enough space for gradient");
+        if (scratch.size() < 2 * n) throw std::runtime_error("Not enough registers");
+        std::span<T> v = scratch.first(n);
+        std::span<T> adj = scratch.subspan(n, n);
+
+        const T result = tape.eval(values, v);
+        std::fill(adj.begin(), adj.end(), T(0));
+        std::fill(grad.begin(), grad.begin() + tape.get_variables().size(), T(0));
+        adj[tape.get_result()] = T(1);
+
+        for (std::size_t i = n; i-- > 0;) {
+            if (!active[i]) continue;
+            const auto &ins = code[i];
+            const T g = adj[i];
+            switch (ins.code) {
+                case OP_VAR: grad[ins.a] += g; break;
+                case OP_ADD: adj[ins.a] += g; adj[ins.b] += g; break;
+                case OP_SUB: adj[ins.a] += g; adj[ins.b] -= g; break;
+                case OP_MUL:
+                    adj[ins.a] += g * v[ins.b];
+                    adj[ins.b] += g * v[ins.a];
+                    break;
+                case OP_DIV:
+                    adj[ins.a] += g / v[ins.b];
+                    adj[ins.b] -= g * v[i] / v[ins.b];
+                    break;
+                case OP_POW:
+                    // (f^g)' = g * f^(g - 1) * f' + f^g * ln(f) * g'; слагаемое считается, только если его множитель не константа
+                    if (active[ins.a]) adj[ins.a] += g * v[ins.b] * std::pow(v[ins.a], v[ins.b] - T(1));
+                    if (active[ins.b]) adj[ins.b] += g * v[i] * std::log(v[ins.a]);
+                    break;
+                case OP_SIN: adj[ins.a] += g * std::cos(v[ins.a]); break;
+                case OP_COS: adj[ins.a] -= g * std::sin(v[ins.a]); break;
+                case OP_LN: adj[ins.a] += g / v[ins.a]; break;
+                case OP_EXP: adj[ins.a] += g * v[i]; break;
+                default: break;
+            }
+        }
+        return result;
+    }
+
+    T eval(std::span<const T> values, std::span<T> grad) const {
+        thread_local std::vector<T> scratch;
+        if (scratch.size() < 2 * tape.get_registers()) scratch.resize(2 * tape.get_registers());
+        return eval(values, grad, scratch);
+    }
+};
+
+#endif // GRADIENT_H
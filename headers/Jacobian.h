@@ -0,0 +1,102 @@
+#ifndef JACOBIAN_H
+#define JACOBIAN_H
+
+#include "Program.h"
+#include <algorithm>
+#include <utility>
+
+// Матрица производных (якобиан системы или гессиан скалярной функции).
+// Все элементы строятся через одну таблицу уникальных узлов, поэтому общие части производных
+// - один и тот же узел, а скомпилированная программа считает их один раз на всю матрицу.
+// Элементы, которые после optimize стали нулевой константой, в программу не попадают.
+// Производные общих поддеревьев берутся из кэша производных, а не строятся заново для каждого элемента.
+template <typename T>
+struct DerivativeMatrix {
+    std::size_t rows = 0;
+    std::size_t cols = 0;
+    std::vector<std::string> variables; // столбцы
+    std::vector<std::vector<std::shared_ptr<Expression<T>>>> entries; // entries[i][j]
+    std::vector<std::pair<std::size_t, std::size_t>> nonzeros; // (строка, столбец) ненулевых элементов
+    Program<T> program; // i-й выход - элемент nonzeros[i]
+
+    // Значения в порядке слотов program (см. program.bind)
+    void eval_sparse(std::span<const T> values, std::span<T> out) const {
+        if (nonzeros.empty()) return;
+        std::vector<T> scratch(program.get_registers());
+        program.eval(values, out, std::span<T>(scratch));
+    }
+
+    // Плотная матрица по строкам: out[i * cols + j]
+    void eval(std::span<const T> values, std::span<T> out) const {
+        if (out.size() < rows * cols) throw std::runtime_error("Not enough space for matrix");
+        std::fill(out.begin(), out.begin() + rows * cols, T(0));
+        std::vector<T> sparse(nonzeros.size());
+        eval_sparse(values, sparse);
+        for (std::size_t k = 0; k < nonzeros.size(); k++) out[nonzeros[k].first * cols + nonzeros[k].second] = sparse[k];
+    }
+};
+
+template <typename T>
+bool is_zero_constant(const std::shared_ptr<Expression<T>> &expr) {
+    return expr->kind() == CONST_NODE && static_cast<const ConstantExpression<T> &>(*expr).get_value() == T(0);
+}
+
+template <typename T>
+void finish_matrix(DerivativeMatrix<T> &matrix) {
+    std::vector<std::shared_ptr<Expression<T>>> outputs;
+    for (std::size_t i = 0; i < matrix.rows; i++) {
+        for (std::size_t j = 0; j < matrix.cols; j++) {
+            if (is_zero_constant(matrix.entries[i][j])) continue;
+            matrix.nonzeros.emplace_back(i, j);
+            outputs.push_back(matrix.entries[i][j]);
+        }
+    }
+    // Полностью нулевой матрице все равно нужна программа, чтобы знать слоты переменных
+    if (outputs.empty()) outputs.push_back(make_constant<T>(T(0)));
+    matrix.program = compile(outputs);
+}
+
+// Якобиан: entries[i][j] = d exprs[i] / d variables[j]
+template <typename T>
+DerivativeMatrix<T> jacobian(const std::vector<std::shared_ptr<Expression<T>>> &exprs,
+                             const std::vector<std::string> &variables) {
+    HashConsTable<T> table;
+    HashConsScope<T> scope(table);
+    DiffCache<T> derivatives;
+    DiffCacheScope<T> diff_scope(derivatives);
+    DerivativeMatrix<T> matrix;
+    matrix.rows = exprs.size();
+    matrix.cols = variables.size();
+    matrix.variables = variables;
+    for (const auto &expr : exprs) {
+        auto &row = matrix.entries.emplace_back();
+        for (auto var : variables) row.push_back(optimize(expr->diff(var)));
+    }
+    finish_matrix(matrix);
+    return matrix;
+}
+
+// Гессиан: считается только верхний треугольник, нижний ссылается на те же узлы
+template <typename T>
+DerivativeMatrix<T> hessian(const std::shared_ptr<Expression<T>> &expr, const std::vector<std::string> &variables) {
+    HashConsTable<T> table;
+    HashConsScope<T> scope(table);
+    DiffCache<T> derivatives;
+    DiffCacheScope<T> diff_scope(derivatives);
+    DerivativeMatrix<T> matrix;
+    matrix.rows = matrix.cols = variables.size();
+    matrix.variables = variables;
+    matrix.entries.assign(variables.size(), std::vector<std::shared_ptr<Expression<T>>>(variables.size()));
+    for (std::size_t i = 0; i < variables.size(); i++) {
+        auto var = variables[i];
+        auto first = optimize(expr->diff(var));
+        for (std::size_t j = i; j < variables.size(); j++) {
+            auto by = variables[j];
+            matrix.entries[i][j] = matrix.entries[j][i] = optimize(first->diff(by));
+        }
+    }
+    finish_matrix(matrix);
+    return matrix;
+}
+
+#endif // JACOBIAN_H
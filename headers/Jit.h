@@ -0,0 +1,83 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "Program.h"
+
+// Машинный код x86-64 для Program<double>: каждая инструкция программы становится несколькими командами SSE2
+// или вызовом libm (sin, cos, log, exp, pow), без разбора кода операции при подсчете.
+// Регистры программы лежат в памяти (в переданном массиве), последний результат остается в xmm0.
+// Деление на ноль из машинного кода не бросает исключение, а возвращает статус; исключение бросает eval.
+// Там, где генератора нет (не x86-64 System V) или память нельзя сделать исполняемой, eval идет через
+// интерпретатор execute: результаты те же до бита, потому что операции и их порядок те же.
+
+enum NativeStatus : int {
+    NATIVE_OK = 0,
+    NATIVE_DIVISION_BY_ZERO = 1
+};
+
+// regs - не меньше get_registers() элементов; результаты остаются в regs[outputs[i]]
+using NativeFunction = int (*)(const double *values, double *regs);
+
+class NativeProgram {
+    Program<double> program;
+    void *memory = nullptr; // исполняемые страницы с кодом
+    std::size_t memory_size = 0;
+    NativeFunction function = nullptr;
+
+    double run(std::span<const double> values, std::span<double> scratch) const;
+
+public:
+    // native = false - всегда интерпретатор (для сравнения)
+    explicit NativeProgram(Program<double> program, bool native = true);
+    ~NativeProgram();
+    NativeProgram(NativeProgram &&other) noexcept;
+    NativeProgram &operator=(NativeProgram &&other) noexcept;
+    NativeProgram(const NativeProgram &other) = delete;
+    NativeProgram &operator=(const NativeProgram &other) = delete;
+
+    // Есть ли генератор под эту платформу
+    static bool supported();
+
+    bool is_native() const { return function != nullptr; }
+    // nullptr, если код не сгенерирован
+    NativeFunction get_function() const { return function; }
+    std::size_t code_size() const { return memory_size; }
+    const Program<double> &get_program() const { return program; }
+
+    std::size_t slot(const std::string &name) const { return program.slot(name); }
+    std::vector<double> bind(const std::map<std::string, double> &parameters) const { return program.bind(parameters); }
+
+    double eval(std::span<const double> values, std::span<double> scratch) const {
+        if (values.size() < program.get_variables().size()) throw std::runtime_error("Not enough variable values");
+        if (scratch.size() < program.get_registers()) throw std::runtime_error("Not enough registers");
+        return profile_phase(PHASE_EVAL, program.get_code().size(), [&] { return run(values, scratch); });
+    }
+
+    double eval(std::span<const double> values) const {
+        if (program.get_registers() <= Program<double>::inline_registers) {
+            std::array<double, Program<double>::inline_registers> regs;
+            return eval(values, regs);
+        }
+        thread_local std::vector<double> regs;
+        if (regs.size() < program.get_registers()) regs.resize(program.get_registers());
+        return eval(values, regs);
+    }
+
+    // Все результаты за один проход: out[i] - значение i-го выражения
+    void eval(std::span<const double> values, std::span<double> out, std::span<double> scratch) const {
+        const auto &outputs = program.get_outputs();
+        if (out.size() < outputs.size()) throw std::runtime_error("Not enough space for results");
+        eval(values, scratch);
+        for (std::size_t i = 0; i < outputs.size(); i++) out[i] = scratch[outputs[i]];
+    }
+};
+
+inline NativeProgram compile_native(const std::vector<std::shared_ptr<Expression<double>>> &exprs) {
+    return NativeProgram(compile(exprs));
+}
+
+inline NativeProgram compile_native(const std::shared_ptr<Expression<double>> &expr) {
+    return NativeProgram(compile(expr));
+}
+
+#endif // JIT_H
@@ -0,0 +1,8 @@
+#ifndef OPERATIONS_H
+#define OPERATIONS_H
+
+// Операции и функции выражений; отдельно, чтобы токенизатор классифицировал их без Expression.h
+enum Operation { PLUS, MINUS, MULT, DIV, POW };
+enum Function { SIN, COS, LN, EXP };
+
+#endif // OPERATIONS_H
@@ -0,0 +1,77 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "Batch.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <exception>
+#include <latch>
+
+// Многопоточный пакетный подсчет: диапазон точек режется на куски, куски раздаются пулу.
+// Программа общая и неизменяемая, рабочая память у каждого потока своя.
+
+constexpr std::size_t parallel_chunk = 16 * batch_block; // точек в одном задании
+
+template <typename T>
+void eval_parallel(const Program<T> &program, std::span<const std::span<const T>> columns, std::span<T> out,
+                   ThreadPool &pool, const std::size_t chunk = parallel_chunk) {
+    PhaseTimer timer(PHASE_EVAL, program.get_code().size() * out.size()); // потоки пула счетчиков не ведут
+    if (columns.size() < program.get_variables().size()) throw std::runtime_error("Not enough input columns");
+    for (std::size_t slot = 0; slot < program.get_variables().size(); slot++) {
+        if (columns[slot].size() < out.size()) throw std::runtime_error("Input column is too short");
+    }
+    const std::size_t step = std::max(chunk, batch_block);
+    const std::size_t chunks = (out.size() + step - 1) / step;
+    if (chunks == 0) return;
+
+    // Куски разбирают по номеру и помощники из пула, и сам вызывающий поток, поэтому подсчет завершится,
+    // даже если все потоки пула заняты (в том числе когда eval_parallel вызван из задачи этого же пула).
+    // Состояние в shared_ptr: помощник, до которого очередь дошла позже, только увидит, что кусков не осталось.
+    struct State {
+        const Program<T> &program;
+        std::span<const std::span<const T>> columns;
+        std::span<T> out;
+        std::size_t step;
+        std::size_t chunks;
+        std::atomic<std::size_t> next{0};
+        std::latch done;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        State(const Program<T> &program, std::span<const std::span<const T>> columns, std::span<T> out,
+              const std::size_t step, const std::size_t chunks)
+            : program(program), columns(columns), out(out), step(step), chunks(chunks),
+              done(static_cast<std::ptrdiff_t>(chunks)) {}
+
+        // Считает куски, пока они есть; поля, кроме счетчиков, читаются только после захвата куска
+        void work() {
+            for (std::size_t c = next++; c < chunks; c = next++) {
+                try {
+                    thread_local BatchScratch<T> scratch;
+                    const std::size_t end = std::min(out.size(), (c + 1) * step);
+                    for (std::size_t offset = c * step; offset < end; offset += batch_block) {
+                        eval_block(program, columns, offset, std::min(batch_block, end - offset), out, scratch);
+                    }
+                } catch (...) {
+                    std::lock_guard lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+                done.count_down();
+            }
+        }
+    };
+    auto state = std::make_shared<State>(program, columns, out, step, chunks);
+    try {
+        for (std::size_t helper = 0; helper < std::min(chunks - 1, pool.size()); helper++) {
+            pool.submit([state] { state->work(); });
+        }
+    } catch (...) {
+        // Не удалось поставить помощника - оставшиеся куски посчитает этот поток
+    }
+    state->work();
+    // Ждем только куски, уже захваченные другими потоками: они сейчас выполняются
+    state->done.wait();
+    if (state->error) std::rethrow_exception(state->error);
+}
+
+#endif // PARALLEL_H
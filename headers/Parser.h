@@ -3,135 +3,133 @@
 
 #include "Expression.h"
 #include "Tokenator.h"
+#include <cctype>
+#include <charconv>
+#include <optional>
 #include <stdexcept>
 
+// Разбор без рекурсии (Pratt / сортировочная станция): операнды и ожидающие операции
+// лежат в явных стеках, поэтому глубина вложенности ограничена только памятью.
+// Токены берутся по одному - либо из готового вектора, либо прямо из лексера.
 template<typename T>
 class Parser {
     std::vector<Token> tokens;
     size_t current = 0;
-    size_t cnt_par = 0; // счетчик скобок
+    std::optional<Lexer> lexer;
 
-    Token watch() const {
-        if (current < tokens.size()) {
-            return tokens[current];
-        }
-        throw std::runtime_error("Unexpected end of input");
-    }
+    // Ожидающая операция: бинарная (OPERATOR), функция (FUNCTION) или открытая скобка (LEFT_PAREN)
+    struct Pending {
+        TokenType type;
+        std::uint8_t code;
+    };
 
-    Token consume() {
+    bool next(Token &token) {
+        if (lexer) return lexer->next(token);
         if (current < tokens.size()) {
-            return tokens[current++];
-        }
-        throw std::runtime_error("Unexpected end of input");
-    }
-
-    bool ismatch(TokenType type) { // для проверки существования ')', как парной к '('
-        if (current < tokens.size() && tokens[current].type == type) {
-            current++;
+            token = tokens[current++];
             return true;
         }
         return false;
     }
 
-    // --- Основные методы парсера ---
-    std::shared_ptr<Expression<T> > parseExpression() {
-        return parseBinary(0);
+    static double number(const std::string_view text) {
+        double value = 0;
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc() || end == text.data()) throw std::runtime_error("Invalid number: " + std::string(text));
+        return value;
     }
 
-    // Парсит и может принимать бин операции
-    std::shared_ptr<Expression<T> > parseBinary(int minPriority) {
-        auto left = parsePrimary();
-
-        while (true) {
-            if (current >= tokens.size()) {
-                break;
-            }
-
-            auto token = watch();
-            if (token.type != OPERATOR) {
-                switch (token.type) {
-                    case RIGHT_PAREN: {
-                        if (!cnt_par) throw std::runtime_error("Extra ')'");
-                        break;
-                    }
-                    default: throw std::runtime_error("Expected operation");
-                }
-                break; // если скобка ")", но она не лишняя
-            }
-
-            operators op(token.value == "+"
-                             ? PLUS
-                             : token.value == "-"
-                                   ? MINUS
-                                   : token.value == "*"
-                                         ? MULT
-                                         : token.value == "/"
-                                               ? DIV
-                                               : token.value == "^"
-                                                     ? POW
-                                                     : PLUS);
-
-            if (op.priority < minPriority) {
-                break; // приоритет операции меньше минимального => возвращаемся к меньшим приоритетам операции
-            }
-
-            consume(); // удовлетворяющая операция => съедаем ее (тк уже записали ее в op)
-            auto right = parseBinary(op.priority + 1);
-            left = std::make_shared<BinaryExpression<T> >(left, right, op.type);
-        }
-
-        return left;
+    // Имена переменных без учета регистра
+    static std::string lower(const std::string_view name) {
+        std::string result(name);
+        for (char &c : result) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return result;
     }
 
-    // Вспомогательный метод парсера, который парсит
-    std::shared_ptr<Expression<T> > parsePrimary() {
-        if (current >= tokens.size()) {
-            throw std::runtime_error("Unexpected end of input in parsePrimary");
-        }
-
-        auto token = consume(); // работаем со след токеном
+    static std::shared_ptr<Expression<T> > operand(const Token &token) {
         switch (token.type) {
-            case NUMBER: return std::make_shared<ConstantExpression<T> >(std::stod(token.value));
+            case NUMBER: return make_constant<T>(number(token.value));
             case COMPLEX: {
                 if constexpr (std::is_same_v<T, std::complex<double>>) { // для нормального компила
-                    return std::make_shared<ConstantExpression<T> >(std::complex<double>(0, std::stod(token.value)));
+                    return make_constant<T>(std::complex<double>(0, number(token.value)));
                 } else {
-                    return std::make_shared<ConstantExpression<T> >(std::stod(token.value));
+                    return make_constant<T>(number(token.value));
                 }
             }
-            case VARIABLE: return std::make_shared<VarExpression<T> >(token.value);
-            case FUNCTION: {
-                auto arg = parsePrimary(); // тк ожидается скобка '(    '
-                Function func = token.value == "sin"
-                                    ? SIN
-                                    : token.value == "cos"
-                                          ? COS
-                                          : token.value == "ln"
-                                                ? LN
-                                                : token.value == "exp"
-                                                      ? EXP
-                                                      : SIN;
-                return std::make_shared<MonoExpression<T> >(arg, func);
-            }
-            case LEFT_PAREN: {
-                cnt_par++;
-                auto expr = parseExpression();
-                if (!ismatch(RIGHT_PAREN)) {
-                    throw std::runtime_error("Expected ')'");
-                }
-                cnt_par--;
-                return expr;
-            }
+            case VARIABLE: return make_var<T>(lower(token.value));
             default:
-                throw std::runtime_error("Unexpected token: " + token.value);
+                throw std::runtime_error("Unexpected token: " + std::string(token.value));
         }
     }
 
 public:
-    explicit Parser(const std::vector<Token> &tokens) : tokens(tokens) {}
+    explicit Parser(std::vector<Token> tokens) : tokens(std::move(tokens)) {}
+    // Разбор прямо из текста; text должен жить до конца parse()
+    explicit Parser(const std::string_view text) : lexer(std::in_place, text) {}
+    explicit Parser(std::string &&text) = delete;
 
+    // Токены из лексера читаются по ходу разбора, их время входит в фазу parse
     std::shared_ptr<Expression<T> > parse() {
-        return parseExpression();
+        return profile_tree_phase(PHASE_PARSE, [this] { return parse_tokens(); });
+    }
+
+private:
+    std::shared_ptr<Expression<T> > parse_tokens() {
+        std::vector<std::shared_ptr<Expression<T> > > values;
+        std::vector<Pending> pending;
+        size_t cnt_par = 0; // счетчик скобок
+
+        auto reduce = [&] {
+            auto right = std::move(values.back());
+            values.pop_back();
+            values.back() = make_binary<T>(values.back(), right, static_cast<Operation>(pending.back().code));
+            pending.pop_back();
+        };
+        // Функция применяется к ближайшему операнду (переменной, числу или скобке)
+        auto apply_functions = [&] {
+            while (!pending.empty() && pending.back().type == FUNCTION) {
+                values.back() = make_mono<T>(values.back(), static_cast<Function>(pending.back().code));
+                pending.pop_back();
+            }
+        };
+
+        Token token(START, {});
+        while (true) {
+            // Ожидается операнд
+            if (!next(token)) throw std::runtime_error("Unexpected end of input in parsePrimary");
+            if (token.type == FUNCTION || token.type == LEFT_PAREN) {
+                cnt_par += token.type == LEFT_PAREN;
+                pending.push_back({token.type, token.code});
+                continue;
+            }
+            values.push_back(operand(token));
+            apply_functions();
+
+            // Ожидается операция или закрывающая скобка
+            while (true) {
+                if (!next(token)) {
+                    if (cnt_par) throw std::runtime_error("Expected ')'");
+                    while (!pending.empty()) reduce();
+                    return values.back();
+                }
+                if (token.type == OPERATOR) {
+                    // Все операции левоассоциативны: сначала сворачиваем не менее приоритетные
+                    const int priority = operators(token.operation()).priority;
+                    while (!pending.empty() && pending.back().type == OPERATOR
+                           && operators(static_cast<Operation>(pending.back().code)).priority >= priority) {
+                        reduce();
+                    }
+                    pending.push_back({OPERATOR, token.code});
+                    break;
+                }
+                if (token.type != RIGHT_PAREN) throw std::runtime_error("Expected operation");
+                if (!cnt_par) throw std::runtime_error("Extra ')'");
+                while (pending.back().type == OPERATOR) reduce();
+                pending.pop_back();
+                cnt_par--;
+                apply_functions();
+            }
+        }
     }
 };
 
@@ -0,0 +1,158 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+
+// Счетчики по фазам конвейера: время, созданные узлы, размер результата, приведения типов в optimize,
+// посещения узлов при подсчете. Профилировщик включается в потоке на время жизни ProfileScope
+// (как HashConsScope и ArenaScope). Без него каждая точка учета - одна проверка thread_local указателя,
+// а сборка с EXPRESSION_NO_PROFILING убирает и ее: Profiler::active() всегда nullptr.
+
+enum Phase { PHASE_TOKENIZE, PHASE_PARSE, PHASE_DIFF, PHASE_SIMPLIFY, PHASE_OPTIMIZE, PHASE_COMPILE, PHASE_EVAL, PHASE_COUNT };
+
+inline const char *phase_name(const Phase phase) {
+    static const char *names[PHASE_COUNT] = {"tokenize", "parse", "diff", "simplify", "optimize", "compile", "eval"};
+    return phase < PHASE_COUNT ? names[phase] : "unknown";
+}
+
+struct PhaseStats {
+    std::uint64_t calls = 0;       // внешних вызовов (рекурсия внутри фазы не считается)
+    std::uint64_t nanoseconds = 0;
+    std::uint64_t nodes = 0;       // узлов создано за время фазы
+};
+
+struct ProfileStats {
+    std::array<PhaseStats, PHASE_COUNT> phases{};
+    std::uint64_t nodes_created = 0;  // всего, в том числе вне фаз
+    std::uint64_t peak_tree_size = 0; // наибольшее число различных узлов в результате разбора, diff, simplify, optimize
+    std::uint64_t optimize_casts = 0; // dynamic_pointer_cast в optimize
+    std::uint64_t eval_visits = 0;    // посчитанных узлов дерева и инструкций программы
+};
+
+class Profiler {
+    using Clock = std::chrono::steady_clock;
+
+    ProfileStats stats_;
+    std::array<std::uint32_t, PHASE_COUNT> depth{};
+    std::array<Clock::time_point, PHASE_COUNT> started{};
+    Phase active_phase = PHASE_COUNT; // которой фазе засчитываются новые узлы
+
+    friend class PhaseTimer;
+
+    // true - внешний вход в фазу
+    bool enter(const Phase phase) {
+        if (depth[phase]++ != 0) return false;
+        stats_.phases[phase].calls++;
+        started[phase] = Clock::now();
+        return true;
+    }
+
+    void leave(const Phase phase) {
+        if (--depth[phase] != 0) return;
+        stats_.phases[phase].nanoseconds += static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started[phase]).count());
+    }
+
+public:
+    Profiler() = default;
+    Profiler(const Profiler &other) = delete;
+    Profiler &operator=(const Profiler &other) = delete;
+
+    const ProfileStats &stats() const { return stats_; }
+    void reset() { stats_ = {}; }
+
+    void count_node() {
+        stats_.nodes_created++;
+        if (active_phase != PHASE_COUNT) stats_.phases[active_phase].nodes++;
+    }
+    void count_cast() { stats_.optimize_casts++; }
+    void count_visits(const std::uint64_t visits) { stats_.eval_visits += visits; }
+    void tree_size(const std::uint64_t nodes) {
+        if (nodes > stats_.peak_tree_size) stats_.peak_tree_size = nodes;
+    }
+
+    // Профилировщик этого потока, куда пишут счетчики (nullptr - выключен)
+    static Profiler *&current() {
+        thread_local Profiler *active = nullptr;
+        return active;
+    }
+
+    static Profiler *active() {
+#ifdef EXPRESSION_NO_PROFILING
+        return nullptr;
+#else
+        return current();
+#endif
+    }
+};
+
+// Пока объект жив, фазы этого потока учитываются в profiler
+class ProfileScope {
+    Profiler *previous;
+
+public:
+    explicit ProfileScope(Profiler &profiler) : previous(Profiler::current()) { Profiler::current() = &profiler; }
+    ~ProfileScope() { Profiler::current() = previous; }
+    ProfileScope(const ProfileScope &other) = delete;
+    ProfileScope &operator=(const ProfileScope &other) = delete;
+};
+
+// Замер фазы на время жизни объекта; вложенные вызовы той же фазы (рекурсивный diff) время не удваивают
+class PhaseTimer {
+    Profiler *profiler;
+    Phase phase;
+    Phase previous = PHASE_COUNT;
+    bool outer = false;
+
+public:
+    explicit PhaseTimer(const Phase phase, const std::uint64_t visits = 0) : profiler(Profiler::active()), phase(phase) {
+        if (!profiler) return;
+        profiler->count_visits(visits);
+        outer = profiler->enter(phase);
+        if (outer) {
+            previous = profiler->active_phase;
+            profiler->active_phase = phase;
+        }
+    }
+    ~PhaseTimer() {
+        if (!profiler) return;
+        if (outer) profiler->active_phase = previous;
+        profiler->leave(phase);
+    }
+    PhaseTimer(const PhaseTimer &other) = delete;
+    PhaseTimer &operator=(const PhaseTimer &other) = delete;
+
+    // Внешний вызов при включенном профилировщике: только он измеряет результат фазы
+    Profiler *outermost() const { return outer ? profiler : nullptr; }
+};
+
+// body() как фаза. Профилировщик проверяется до создания PhaseTimer: без него горячий путь -
+// одна ветка, без объекта с деструктором
+template <typename Body>
+decltype(auto) profile_phase(const Phase phase, const std::uint64_t visits, Body &&body) {
+    if (Profiler::active()) [[unlikely]] {
+        PhaseTimer timer(phase, visits);
+        return body();
+    }
+    return body();
+}
+
+inline void print_profile(std::ostream &out, const ProfileStats &stats) {
+    out << "phase       calls     time, ms      nodes\n";
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const auto &p = stats.phases[phase];
+        char line[96];
+        std::snprintf(line, sizeof(line), "%-9s %7llu %12.3f %10llu\n", phase_name(static_cast<Phase>(phase)),
+                      static_cast<unsigned long long>(p.calls), static_cast<double>(p.nanoseconds) / 1e6,
+                      static_cast<unsigned long long>(p.nodes));
+        out << line;
+    }
+    out << "nodes created: " << stats.nodes_created << ", peak tree size: " << stats.peak_tree_size
+        << ", optimize casts: " << stats.optimize_casts << ", eval visits: " << stats.eval_visits << '\n';
+}
+
+#endif // PROFILE_H
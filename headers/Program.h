@@ -0,0 +1,362 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "Expression.h"
+#include <array>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// Плоское представление выражения: линейный список инструкций над массивом регистров.
+// Переменные один раз превращаются в номера слотов, поэтому при подсчете нет ни поиска по строкам,
+// ни виртуальных вызовов.
+
+enum OpCode : std::uint8_t {
+    OP_CONST, // regs[dst] = constants[a]
+    OP_VAR,   // regs[dst] = values[a]
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, // regs[dst] = regs[a] (op) regs[b]
+    OP_SIN, OP_COS, OP_LN, OP_EXP           // regs[dst] = f(regs[a])
+};
+
+struct Instruction {
+    OpCode code;
+    std::uint32_t dst;
+    std::uint32_t a;
+    std::uint32_t b;
+};
+
+inline OpCode to_opcode(const Operation op) {
+    switch (op) {
+        case PLUS: return OP_ADD;
+        case MINUS: return OP_SUB;
+        case MULT: return OP_MUL;
+        case DIV: return OP_DIV;
+        case POW: return OP_POW;
+    }
+    throw std::runtime_error("Unknown operation");
+}
+
+inline OpCode to_opcode(const Function func) {
+    switch (func) {
+        case SIN: return OP_SIN;
+        case COS: return OP_COS;
+        case LN: return OP_LN;
+        case EXP: return OP_EXP;
+    }
+    throw std::runtime_error("Unknown function");
+}
+
+// Интерпретатор: один проход по инструкциям, без аллокаций
+template <typename T>
+T execute(std::span<const Instruction> code, std::span<const T> constants,
+          std::span<const T> values, std::span<T> regs, const std::uint32_t result) {
+    for (const auto &ins : code) {
+        switch (ins.code) {
+            case OP_CONST: regs[ins.dst] = constants[ins.a]; break;
+            case OP_VAR: regs[ins.dst] = values[ins.a]; break;
+            case OP_ADD: regs[ins.dst] = regs[ins.a] + regs[ins.b]; break;
+            case OP_SUB: regs[ins.dst] = regs[ins.a] - regs[ins.b]; break;
+            case OP_MUL: regs[ins.dst] = regs[ins.a] * regs[ins.b]; break;
+            case OP_DIV:
+                if (regs[ins.b] == T(0)) throw std::runtime_error("Division by zero");
+                regs[ins.dst] = regs[ins.a] / regs[ins.b];
+                break;
+            case OP_POW: regs[ins.dst] = std::pow(regs[ins.a], regs[ins.b]); break;
+            case OP_SIN: regs[ins.dst] = std::sin(regs[ins.a]); break;
+            case OP_COS: regs[ins.dst] = std::cos(regs[ins.a]); break;
+            case OP_LN: regs[ins.dst] = std::log(regs[ins.a]); break;
+            case OP_EXP: regs[ins.dst] = std::exp(regs[ins.a]); break;
+            default: throw std::runtime_error("Unknown instruction");
+        }
+    }
+    return regs[result];
+}
+
+struct CompileOptions {
+    bool eliminate_common = true; // одинаковые подвыражения считаются один раз
+    bool reuse_registers = true;  // false - каждая инструкция пишет в свой регистр (нужно для обратного прохода)
+};
+
+template <typename T>
+class Program {
+    std::vector<Instruction> code;
+    std::vector<T> constants;
+    std::vector<std::string> variables;
+    std::vector<std::uint32_t> outputs; // регистры результатов, по одному на выражение
+    std::uint32_t registers = 0;
+    std::size_t eliminated = 0; // сколько узлов дерева не попало в программу благодаря общим подвыражениям
+
+    template <typename U>
+    friend Program<U> compile(const std::vector<std::shared_ptr<Expression<U>>> &exprs, CompileOptions options);
+
+public:
+    static constexpr std::size_t inline_registers = 64; // столько регистров eval держит на стеке
+
+    const std::vector<Instruction> &get_code() const { return code; }
+    const std::vector<T> &get_constants() const { return constants; }
+    const std::vector<std::string> &get_variables() const { return variables; }
+    const std::vector<std::uint32_t> &get_outputs() const { return outputs; }
+    std::uint32_t get_registers() const { return registers; }
+    std::uint32_t get_result() const { return outputs.front(); }
+    std::size_t get_eliminated() const { return eliminated; }
+
+    // Номер слота переменной во входном массиве
+    std::size_t slot(const std::string &name) const {
+        for (std::size_t i = 0; i < variables.size(); i++) {
+            if (variables[i] == name) return i;
+        }
+        throw std::runtime_error("Unknown variable: " + name);
+    }
+
+    // Раскладывает словарь параметров по слотам (отсутствующие переменные равны нулю, как в eval дерева)
+    std::vector<T> bind(const std::map<std::string, T> &parameters) const {
+        std::vector<T> values(variables.size(), T(0));
+        for (std::size_t i = 0; i < variables.size(); i++) {
+            auto it = parameters.find(variables[i]);
+            if (it != parameters.end()) values[i] = it->second;
+        }
+        return values;
+    }
+
+    T eval(std::span<const T> values, std::span<T> scratch) const {
+        if (values.size() < variables.size()) throw std::runtime_error("Not enough variable values");
+        if (scratch.size() < registers) throw std::runtime_error("Not enough registers");
+        return profile_phase(PHASE_EVAL, code.size(),
+                             [&] { return execute<T>(code, constants, values, scratch, outputs.front()); });
+    }
+
+    T eval(std::span<const T> values) const {
+        if (registers <= inline_registers) {
+            std::array<T, inline_registers> regs;
+            return eval(values, regs);
+        }
+        thread_local std::vector<T> regs;
+        if (regs.size() < registers) regs.resize(registers);
+        return eval(values, regs);
+    }
+
+    // Все результаты за один проход: out[i] - значение i-го выражения
+    void eval(std::span<const T> values, std::span<T> out, std::span<T> scratch) const {
+        if (out.size() < outputs.size()) throw std::runtime_error("Not enough space for results");
+        eval(values, scratch);
+        for (std::size_t i = 0; i < outputs.size(); i++) out[i] = scratch[outputs[i]];
+    }
+};
+
+// Понижение деревьев в программу: сначала SSA (каждая инструкция пишет в свой номер),
+// затем регистры переиспользуются после последнего чтения значения.
+// Общие подвыражения находятся нумерацией значений: инструкция с теми же кодом и операндами
+// (или та же константа) не создается повторно, а узел, уже встреченный по указателю, не обходится снова.
+template <typename T>
+Program<T> compile(const std::vector<std::shared_ptr<Expression<T>>> &exprs, const CompileOptions options = {}) {
+    PhaseTimer timer(PHASE_COMPILE);
+    if (exprs.empty()) throw std::runtime_error("Nothing to compile");
+    Program<T> program;
+    std::unordered_map<std::string, std::uint32_t> slots;
+
+    struct ValueKey {
+        OpCode code;
+        std::uint32_t a;
+        std::uint32_t b;
+        std::array<std::uint64_t, 2> bits;
+        bool operator==(const ValueKey &other) const = default;
+    };
+    struct ValueKeyHash {
+        std::size_t operator()(const ValueKey &key) const {
+            std::size_t h = key.code;
+            for (const std::uint64_t v : {std::uint64_t(key.a), std::uint64_t(key.b), key.bits[0], key.bits[1]}) {
+                h ^= std::hash<std::uint64_t>()(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+            }
+            return h;
+        }
+    };
+    std::unordered_map<ValueKey, std::uint32_t, ValueKeyHash> numbered;
+    std::unordered_map<const Expression<T> *, std::uint32_t> visited;
+
+    auto emit = [&](Instruction ins, const std::array<std::uint64_t, 2> &bits) -> std::uint32_t {
+        if (options.eliminate_common) {
+            // a + b и b + a - одно значение
+            if ((ins.code == OP_ADD || ins.code == OP_MUL) && ins.b < ins.a) std::swap(ins.a, ins.b);
+            const ValueKey key{ins.code, ins.code == OP_CONST ? 0 : ins.a, ins.b, bits};
+            auto it = numbered.find(key);
+            if (it != numbered.end()) return it->second;
+            numbered.emplace(key, static_cast<std::uint32_t>(program.code.size()));
+        }
+        ins.dst = static_cast<std::uint32_t>(program.code.size());
+        if (ins.code == OP_CONST) {
+            ins.a = static_cast<std::uint32_t>(program.constants.size());
+        }
+        program.code.push_back(ins);
+        return ins.dst;
+    };
+
+    // Обход без рекурсии: у длинной суммы глубина дерева равна числу слагаемых.
+    // Узел снимается со стека, когда его дети уже обработаны (второй элемент пары - дети положены).
+    std::vector<std::pair<const Expression<T> *, bool>> stack;
+    auto push_children = [&](const Expression<T> &node) {
+        stack.back().second = true;
+        // Правый ребенок кладется первым, чтобы левый обрабатывался раньше
+        if (node.kind() == MONO_NODE) {
+            stack.push_back({static_cast<const MonoExpression<T> &>(node).get_arg().get(), false});
+        } else if (node.kind() == BINARY_NODE) {
+            const auto &binary = static_cast<const BinaryExpression<T> &>(node);
+            stack.push_back({binary.get_right().get(), false});
+            stack.push_back({binary.get_left().get(), false});
+        }
+    };
+
+    std::vector<std::uint32_t> results; // значения обработанных детей
+    auto lower = [&](const Expression<T> &root) -> std::uint32_t {
+        stack.push_back({&root, false});
+        while (!stack.empty()) {
+            const auto [pointer, expanded] = stack.back();
+            const Expression<T> &node = *pointer;
+            if (!expanded) {
+                if (options.eliminate_common) {
+                    auto it = visited.find(&node);
+                    if (it != visited.end()) {
+                        results.push_back(it->second);
+                        stack.pop_back();
+                        continue;
+                    }
+                }
+                push_children(node);
+                continue;
+            }
+            stack.pop_back();
+
+            Instruction ins{OP_CONST, 0, 0, 0};
+            std::array<std::uint64_t, 2> bits{0, 0};
+            std::uint32_t value;
+            switch (node.kind()) {
+                case CONST_NODE: {
+                    const T &constant = static_cast<const ConstantExpression<T> &>(node).get_value();
+                    bits = value_bits(constant);
+                    const auto before = program.code.size();
+                    value = emit(ins, bits);
+                    if (program.code.size() != before) program.constants.push_back(constant);
+                    break;
+                }
+                case VAR_NODE: {
+                    const auto &name = static_cast<const VarExpression<T> &>(node).get_name();
+                    auto [it, inserted] = slots.emplace(name, static_cast<std::uint32_t>(program.variables.size()));
+                    if (inserted) program.variables.push_back(name);
+                    ins.code = OP_VAR;
+                    ins.a = it->second;
+                    value = emit(ins, bits);
+                    break;
+                }
+                case MONO_NODE: {
+                    ins.a = results.back();
+                    results.pop_back();
+                    ins.code = to_opcode(static_cast<const MonoExpression<T> &>(node).get_func());
+                    value = emit(ins, bits);
+                    break;
+                }
+                case BINARY_NODE: {
+                    ins.b = results.back();
+                    results.pop_back();
+                    ins.a = results.back();
+                    results.pop_back();
+                    ins.code = to_opcode(static_cast<const BinaryExpression<T> &>(node).get_op());
+                    value = emit(ins, bits);
+                    break;
+                }
+                default: throw std::runtime_error("Unknown node");
+            }
+            if (options.eliminate_common) visited.emplace(&node, value);
+            results.push_back(value);
+        }
+        const auto value = results.back();
+        results.pop_back();
+        return value;
+    };
+
+    // Размер деревьев, если бы общие узлы повторялись (с насыщением, DAG может быть экспоненциальным)
+    std::unordered_map<const Expression<T> *, std::size_t> sizes;
+    auto tree_size = [&](const Expression<T> &root) -> std::size_t {
+        stack.push_back({&root, false});
+        while (!stack.empty()) {
+            const auto [node, expanded] = stack.back();
+            if (sizes.count(node)) {
+                stack.pop_back();
+                continue;
+            }
+            if (!expanded) {
+                push_children(*node);
+                continue;
+            }
+            stack.pop_back();
+            std::size_t size = 1;
+            if (node->kind() == MONO_NODE) {
+                size += sizes.at(static_cast<const MonoExpression<T> *>(node)->get_arg().get());
+            } else if (node->kind() == BINARY_NODE) {
+                const auto *binary = static_cast<const BinaryExpression<T> *>(node);
+                size = std::min<std::size_t>(SIZE_MAX / 2, size + sizes.at(binary->get_left().get()));
+                size = std::min<std::size_t>(SIZE_MAX / 2, size + sizes.at(binary->get_right().get()));
+            }
+            sizes.emplace(node, size);
+        }
+        return sizes.at(&root);
+    };
+
+    std::vector<std::uint32_t> roots;
+    std::size_t total = 0;
+    for (const auto &expr : exprs) {
+        roots.push_back(lower(*expr));
+        total = std::min<std::size_t>(SIZE_MAX / 2, total + tree_size(*expr));
+    }
+    program.eliminated = total - program.code.size();
+
+    auto &code = program.code;
+    auto reads = [](const Instruction &ins) {
+        return ins.code == OP_CONST || ins.code == OP_VAR ? 0 : ins.code >= OP_SIN ? 1 : 2;
+    };
+    if (!options.reuse_registers) {
+        program.registers = static_cast<std::uint32_t>(code.size());
+        program.outputs = roots;
+        return program;
+    }
+
+    // Распределение регистров по последнему использованию
+    std::vector<std::uint32_t> last_use(code.size(), 0);
+    for (std::uint32_t i = 0; i < code.size(); i++) {
+        if (reads(code[i]) >= 1) last_use[code[i].a] = i;
+        if (reads(code[i]) == 2) last_use[code[i].b] = i;
+    }
+    for (const auto root : roots) last_use[root] = static_cast<std::uint32_t>(code.size());
+
+    std::vector<std::uint32_t> reg_of(code.size());
+    std::vector<std::uint32_t> free_regs;
+    for (std::uint32_t i = 0; i < code.size(); i++) {
+        auto &ins = code[i];
+        const int n = reads(ins);
+        const std::uint32_t a = ins.a, b = ins.b;
+        // Операнды читаются раньше записи, поэтому их регистры можно сразу отдать под результат
+        if (n >= 1) {
+            if (last_use[a] == i) free_regs.push_back(reg_of[a]);
+            ins.a = reg_of[a];
+        }
+        if (n == 2) {
+            if (last_use[b] == i && b != a) free_regs.push_back(reg_of[b]);
+            ins.b = reg_of[b];
+        }
+        if (free_regs.empty()) {
+            reg_of[i] = program.registers++;
+        } else {
+            reg_of[i] = free_regs.back();
+            free_regs.pop_back();
+        }
+        ins.dst = reg_of[i];
+    }
+    for (const auto root : roots) program.outputs.push_back(reg_of[root]);
+    return program;
+}
+
+template <typename T>
+Program<T> compile(const std::shared_ptr<Expression<T>> &expr, const CompileOptions options = {}) {
+    return compile(std::vector<std::shared_ptr<Expression<T>>>{expr}, options);
+}
+
+#endif // PROGRAM_H
@@ -0,0 +1,369 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "Program.h"
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string_view>
+#include <utility>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Двоичный формат скомпилированного выражения: файл отображается в память и считается прямо из нее,
+// без разбора текста. Внутри - программа (см. Program.h): инструкции с номерами операндов,
+// пул констант, таблица имен переменных (каждое имя один раз) и регистры результатов.
+// Все секции выровнены на 16 байт, числа в порядке байт машины, записавшей файл
+// (другой порядок байт при загрузке отвергается).
+//
+//   BinaryHeader | Instruction[code_count] | T[constant_count] | uint32[output_count]
+//   | uint64[name_count + 1] (смещения имен в блоке строк) | блок строк
+
+constexpr char binary_magic[8] = {'E', 'X', 'P', 'R', 'B', 'I', 'N', '\0'};
+constexpr std::uint32_t binary_version = 1;
+constexpr std::uint32_t binary_byte_order = 0x01020304;
+
+template <typename T>
+struct BinaryValueType;
+template <>
+struct BinaryValueType<double> { static constexpr std::uint32_t id = 1; };
+template <>
+struct BinaryValueType<std::complex<double>> { static constexpr std::uint32_t id = 2; };
+
+struct BinaryHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t value_type;
+    std::uint32_t registers;
+    std::uint64_t code_count, code_offset;
+    std::uint64_t constant_count, constant_offset;
+    std::uint64_t output_count, output_offset;
+    std::uint64_t name_count, name_offset;
+    std::uint64_t strings_size, strings_offset;
+    std::uint64_t file_size;
+};
+
+static_assert(sizeof(Instruction) == 16 && offsetof(Instruction, dst) == 4 && offsetof(Instruction, b) == 12,
+              "Instruction is stored in files as is");
+static_assert(sizeof(BinaryHeader) % 16 == 0);
+
+namespace binary_detail {
+constexpr std::uint64_t align(const std::uint64_t offset) { return (offset + 15) & ~std::uint64_t(15); }
+
+[[noreturn]] inline void invalid(const std::string &reason) {
+    throw std::runtime_error("Invalid binary expression: " + reason);
+}
+}
+
+template <typename T>
+void write_binary(const Program<T> &program, std::ostream &out) {
+    using binary_detail::align;
+    const auto &code = program.get_code();
+    const auto &constants = program.get_constants();
+    const auto &outputs = program.get_outputs();
+    const auto &variables = program.get_variables();
+
+    BinaryHeader header{};
+    std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.version = binary_version;
+    header.byte_order = binary_byte_order;
+    header.value_type = BinaryValueType<T>::id;
+    header.registers = program.get_registers();
+    header.code_count = code.size();
+    header.code_offset = sizeof(BinaryHeader);
+    header.constant_count = constants.size();
+    header.constant_offset = align(header.code_offset + code.size() * sizeof(Instruction));
+    header.output_count = outputs.size();
+    header.output_offset = align(header.constant_offset + constants.size() * sizeof(T));
+    header.name_count = variables.size();
+    header.name_offset = align(header.output_offset + outputs.size() * sizeof(std::uint32_t));
+    for (const auto &name : variables) header.strings_size += name.size();
+    header.strings_offset = align(header.name_offset + (variables.size() + 1) * sizeof(std::uint64_t));
+    header.file_size = header.strings_offset + header.strings_size;
+
+    std::uint64_t written = 0;
+    auto write = [&](const void *data, const std::size_t size) {
+        out.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+        written += size;
+    };
+    auto pad = [&](const std::uint64_t offset) {
+        static constexpr char zeros[16] = {};
+        write(zeros, offset - written);
+    };
+
+    write(&header, sizeof(header));
+    // Поля по одному: байты выравнивания внутри Instruction в файле нулевые
+    std::vector<Instruction> block;
+    block.reserve(std::min<std::size_t>(code.size(), 4096));
+    for (std::size_t i = 0; i < code.size(); i++) {
+        Instruction packed;
+        std::memset(&packed, 0, sizeof(packed));
+        packed.code = code[i].code;
+        packed.dst = code[i].dst;
+        packed.a = code[i].a;
+        packed.b = code[i].b;
+        block.push_back(packed);
+        if (block.size() == block.capacity() || i + 1 == code.size()) {
+            write(block.data(), block.size() * sizeof(Instruction));
+            block.clear();
+        }
+    }
+    pad(header.constant_offset);
+    write(constants.data(), constants.size() * sizeof(T));
+    pad(header.output_offset);
+    write(outputs.data(), outputs.size() * sizeof(std::uint32_t));
+    pad(header.name_offset);
+    std::uint64_t offset = 0;
+    write(&offset, sizeof(offset));
+    for (const auto &name : variables) {
+        offset += name.size();
+        write(&offset, sizeof(offset));
+    }
+    pad(header.strings_offset);
+    for (const auto &name : variables) write(name.data(), name.size());
+    if (!out) throw std::runtime_error("Cannot write binary expression");
+}
+
+// Выражение компилируется (с общими подвыражениями и переиспользованием регистров) и записывается
+template <typename T>
+void write_binary(const std::shared_ptr<Expression<T>> &expr, std::ostream &out) {
+    write_binary(compile(expr), out);
+}
+
+template <typename T>
+void save_binary(const Program<T> &program, const std::string &path) {
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("Cannot open file: " + path);
+    write_binary(program, out);
+    out.flush();
+    if (!out) throw std::runtime_error("Cannot write file: " + path);
+}
+
+// Программа поверх чужого буфера (отображенного файла): ничего не копирует, буфер должен жить дольше.
+// Буфер проверяется один раз при создании, поэтому испорченный файл дает исключение, а не падение.
+template <typename T>
+class ProgramView {
+    std::span<const Instruction> code;
+    std::span<const T> constants;
+    std::span<const std::uint32_t> outputs;
+    std::vector<std::string_view> variables;
+    std::uint32_t registers = 0;
+
+public:
+    ProgramView() = default;
+
+    explicit ProgramView(const std::span<const std::byte> bytes) {
+        using binary_detail::invalid;
+        if (reinterpret_cast<std::uintptr_t>(bytes.data()) % alignof(std::max_align_t) != 0) {
+            invalid("buffer is not aligned");
+        }
+        BinaryHeader header;
+        if (bytes.size() < sizeof(header)) invalid("file is too short");
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0) invalid("wrong magic");
+        if (header.version != binary_version) invalid("unsupported version " + std::to_string(header.version));
+        if (header.byte_order != binary_byte_order) invalid("wrong byte order");
+        if (header.value_type != BinaryValueType<T>::id) invalid("wrong value type");
+        if (header.file_size != bytes.size()) invalid("wrong file size");
+
+        // Секция целиком внутри файла и выровнена
+        auto section = [&](const std::uint64_t offset, const std::uint64_t count, const std::size_t size) {
+            if (offset % 16 != 0 || offset > bytes.size() || count > (bytes.size() - offset) / size) {
+                invalid("section out of bounds");
+            }
+            return bytes.data() + offset;
+        };
+        code = {reinterpret_cast<const Instruction *>(section(header.code_offset, header.code_count, sizeof(Instruction))),
+                header.code_count};
+        constants = {reinterpret_cast<const T *>(section(header.constant_offset, header.constant_count, sizeof(T))),
+                     header.constant_count};
+        outputs = {reinterpret_cast<const std::uint32_t *>(
+                       section(header.output_offset, header.output_count, sizeof(std::uint32_t))),
+                   header.output_count};
+        const auto *names = reinterpret_cast<const std::uint64_t *>(
+            section(header.name_offset, header.name_count + 1, sizeof(std::uint64_t)));
+        const auto *strings = reinterpret_cast<const char *>(section(header.strings_offset, header.strings_size, 1));
+        registers = header.registers;
+
+        if (outputs.empty()) invalid("no outputs");
+        variables.reserve(header.name_count);
+        for (std::uint64_t i = 0; i < header.name_count; i++) {
+            if (names[i] > names[i + 1] || names[i + 1] > header.strings_size) invalid("bad name table");
+            variables.emplace_back(strings + names[i], names[i + 1] - names[i]);
+        }
+        for (const auto output : outputs) {
+            if (output >= registers) invalid("output register out of range");
+        }
+        for (const auto &ins : code) {
+            bool valid = ins.dst < registers;
+            switch (ins.code) {
+                case OP_CONST: valid = valid && ins.a < constants.size(); break;
+                case OP_VAR: valid = valid && ins.a < variables.size(); break;
+                case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+                    valid = valid && ins.a < registers && ins.b < registers;
+                    break;
+                case OP_SIN: case OP_COS: case OP_LN: case OP_EXP: valid = valid && ins.a < registers; break;
+                default: valid = false;
+            }
+            if (!valid) invalid("bad instruction");
+        }
+    }
+
+    std::span<const Instruction> get_code() const { return code; }
+    std::span<const T> get_constants() const { return constants; }
+    std::span<const std::uint32_t> get_outputs() const { return outputs; }
+    const std::vector<std::string_view> &get_variables() const { return variables; }
+    std::uint32_t get_registers() const { return registers; }
+
+    std::size_t slot(const std::string_view name) const {
+        for (std::size_t i = 0; i < variables.size(); i++) {
+            if (variables[i] == name) return i;
+        }
+        throw std::runtime_error("Unknown variable: " + std::string(name));
+    }
+
+    // Отсутствующие переменные равны нулю, как в Program::bind
+    std::vector<T> bind(const std::map<std::string, T> &parameters) const {
+        std::vector<T> values(variables.size(), T(0));
+        for (std::size_t i = 0; i < variables.size(); i++) {
+            auto it = parameters.find(std::string(variables[i]));
+            if (it != parameters.end()) values[i] = it->second;
+        }
+        return values;
+    }
+
+    T eval(std::span<const T> values, std::span<T> scratch) const {
+        if (values.size() < variables.size()) throw std::runtime_error("Not enough variable values");
+        if (scratch.size() < registers) throw std::runtime_error("Not enough registers");
+        return profile_phase(PHASE_EVAL, code.size(),
+                             [&] { return execute<T>(code, constants, values, scratch, outputs.front()); });
+    }
+
+    T eval(std::span<const T> values) const {
+        thread_local std::vector<T> regs;
+        if (regs.size() < registers) regs.resize(registers);
+        return eval(values, regs);
+    }
+
+    void eval(std::span<const T> values, std::span<T> out, std::span<T> scratch) const {
+        if (out.size() < outputs.size()) throw std::runtime_error("Not enough space for results");
+        eval(values, scratch);
+        for (std::size_t i = 0; i < outputs.size(); i++) out[i] = scratch[outputs[i]];
+    }
+
+    // Деревья обратно: программа исполняется над узлами вместо чисел (общие подвыражения остаются общими)
+    std::vector<std::shared_ptr<Expression<T>>> to_expressions() const {
+        std::vector<std::shared_ptr<Expression<T>>> regs(registers);
+        for (const auto &ins : code) {
+            auto operand = [&](const std::uint32_t reg) {
+                if (!regs[reg]) binary_detail::invalid("register read before write");
+                return regs[reg];
+            };
+            switch (ins.code) {
+                case OP_CONST: regs[ins.dst] = make_constant<T>(constants[ins.a]); break;
+                case OP_VAR: regs[ins.dst] = make_var<T>(std::string(variables[ins.a])); break;
+                case OP_ADD: regs[ins.dst] = make_binary<T>(operand(ins.a), operand(ins.b), PLUS); break;
+                case OP_SUB: regs[ins.dst] = make_binary<T>(operand(ins.a), operand(ins.b), MINUS); break;
+                case OP_MUL: regs[ins.dst] = make_binary<T>(operand(ins.a), operand(ins.b), MULT); break;
+                case OP_DIV: regs[ins.dst] = make_binary<T>(operand(ins.a), operand(ins.b), DIV); break;
+                case OP_POW: regs[ins.dst] = make_binary<T>(operand(ins.a), operand(ins.b), POW); break;
+                case OP_SIN: regs[ins.dst] = make_mono<T>(operand(ins.a), SIN); break;
+                case OP_COS: regs[ins.dst] = make_mono<T>(operand(ins.a), COS); break;
+                case OP_LN: regs[ins.dst] = make_mono<T>(operand(ins.a), LN); break;
+                case OP_EXP: regs[ins.dst] = make_mono<T>(operand(ins.a), EXP); break;
+            }
+        }
+        std::vector<std::shared_ptr<Expression<T>>> result;
+        for (const auto output : outputs) {
+            if (!regs[output]) binary_detail::invalid("register read before write");
+            result.push_back(regs[output]);
+        }
+        return result;
+    }
+};
+
+// Файл, отображенный в память только для чтения. Страницы подгружаются при первом обращении
+// и общие для всех процессов, открывших тот же файл.
+class MappedFile {
+    const std::byte *data_ = nullptr;
+    std::size_t size_ = 0;
+#if !(defined(__unix__) || defined(__APPLE__))
+    std::vector<std::max_align_t> buffer; // без mmap файл просто читается целиком
+#endif
+
+    void release() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (data_ && size_) ::munmap(const_cast<std::byte *>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+public:
+    explicit MappedFile(const std::string &path) {
+#if defined(__unix__) || defined(__APPLE__)
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::runtime_error("Cannot open file: " + path);
+        struct stat info{};
+        if (::fstat(fd, &info) < 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_ == 0) {
+            ::close(fd);
+            return;
+        }
+        void *mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) throw std::runtime_error("Cannot map file: " + path);
+        data_ = static_cast<const std::byte *>(mapped);
+#else
+        std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!in) throw std::runtime_error("Cannot open file: " + path);
+        size_ = static_cast<std::size_t>(in.tellg());
+        buffer.resize(size_ / sizeof(std::max_align_t) + 1);
+        in.seekg(0);
+        in.read(reinterpret_cast<char *>(buffer.data()), static_cast<std::streamsize>(size_));
+        if (!in) throw std::runtime_error("Cannot read file: " + path);
+        data_ = reinterpret_cast<const std::byte *>(buffer.data());
+#endif
+    }
+    ~MappedFile() { release(); }
+
+    MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+    MappedFile &operator=(MappedFile &&other) noexcept {
+        if (this != &other) {
+            release();
+#if !(defined(__unix__) || defined(__APPLE__))
+            buffer = std::move(other.buffer);
+#endif
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+    MappedFile(const MappedFile &other) = delete;
+    MappedFile &operator=(const MappedFile &other) = delete;
+
+    std::span<const std::byte> bytes() const { return {data_, size_}; }
+};
+
+// Выражение из файла: отображение и проверка, без разбора и без копирования программы
+template <typename T>
+class MappedProgram : public ProgramView<T> {
+    MappedFile file;
+
+public:
+    explicit MappedProgram(const std::string &path) : file(path) {
+        static_cast<ProgramView<T> &>(*this) = ProgramView<T>(file.bytes());
+    }
+};
+
+#endif // SERIALIZE_H
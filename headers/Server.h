@@ -0,0 +1,85 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "ExpressionCache.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <shared_mutex>
+
+// Долгоживущий сервер подсчета на Unix-сокете (только Linux: epoll).
+// Цикл событий читает запросы, порции строк считает пул потоков (порции одного соединения - по очереди,
+// разные соединения - параллельно), ответы пишутся в порядке запросов, поэтому клиент может слать
+// запросы подряд, не дожидаясь ответов. Клиенту, который не читает ответы, сервер перестает читать запросы. Протокол строковый:
+//   def <выражение>         -> ok <handle> <переменные через пробел>; handle живет до free или закрытия соединения
+//   call <handle> <v1> ...  -> (re,im); значения переменных в порядке из ответа def
+//   free <handle>           -> ok
+//   eval; ... / diff; ...   -> как в --batch
+// Ошибка - строка "error: <сообщение>", соединение при этом не закрывается.
+
+// Выражения, определенные одним клиентом через def: у каждого соединения своя таблица и своя нумерация.
+// Таблица освобождается вместе с соединением и его незавершенными порциями.
+struct HandleTable {
+    std::shared_mutex mutex;
+    std::unordered_map<std::uint64_t, std::shared_ptr<const CompiledExpression<std::complex<double>>>> entries;
+    std::uint64_t next = 1;
+};
+
+struct ServerStats {
+    std::size_t connections = 0;
+    std::size_t requests = 0;
+};
+
+class Server {
+    struct Connection;
+    struct Completion {
+        std::uint64_t connection;
+        std::string text;
+        std::size_t requests;
+    };
+
+    std::string path;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int done_fd = -1; // eventfd: пул закончил порцию
+    int stop_fd = -1; // eventfd: пора остановиться
+    std::unique_ptr<ThreadPool> pool; // останавливается первым: задачи пользуются остальными полями
+    ExpressionCache<std::complex<double>> cache;
+
+    std::mutex done_mutex;
+    std::vector<Completion> done;
+
+    std::unordered_map<std::uint64_t, std::unique_ptr<Connection>> connections; // только в потоке run()
+    std::uint64_t next_connection = 16; // меньшие номера - служебные события epoll
+    std::atomic<std::size_t> connection_count{0};
+    std::atomic<std::size_t> request_count{0};
+
+    void accept_connections();
+    void read_connection(Connection &connection);
+    void write_connection(Connection &connection);
+    void watch(Connection &connection);
+    void dispatch(Connection &connection);
+    void collect_completions();
+    void close_connection(std::uint64_t id);
+
+public:
+    // Сокет создается сразу (старый файл по этому пути удаляется)
+    Server(std::string path, std::size_t threads);
+    ~Server();
+    Server(const Server &other) = delete;
+    Server &operator=(const Server &other) = delete;
+
+    // Обслуживает клиентов, пока не вызван stop()
+    void run();
+    // Можно вызывать из любого потока и из обработчика сигнала
+    void stop();
+
+    // Ответ на одну строку запроса (без перевода строки); def, call и free работают с handles
+    std::string handle_request(std::string_view line, HandleTable &handles);
+
+    ServerStats stats() const { return {connection_count.load(), request_count.load()}; }
+};
+
+// differentiator --serve <путь к сокету> [--threads N]
+int serve_command(int argc, char *argv[]);
+
+#endif // SERVER_H
@@ -0,0 +1,330 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "Expression.h"
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Полный упроститель (в отличие от optimize, который убирает только нули и единицы):
+// - свертка любых константных подвыражений;
+// - цепочки + и - разворачиваются в список слагаемых, подобные слагаемые складываются,
+//   константы собираются в одну (в конце суммы);
+// - цепочки * и / разворачиваются в коэффициент и список множителей со степенями,
+//   одинаковые основания объединяются (x * x^2 / x = x^2), x^1 -> x, x^0 -> 1, -(-a) -> a.
+// Узлы не меняются на месте, результат собирается заново.
+
+template <typename T>
+bool same_expression(const std::shared_ptr<Expression<T>> &a, const std::shared_ptr<Expression<T>> &b) {
+    if (a == b) return true;
+    if (a->kind() != b->kind()) return false;
+    switch (a->kind()) {
+        case CONST_NODE:
+            return value_bits(static_cast<const ConstantExpression<T> &>(*a).get_value())
+                   == value_bits(static_cast<const ConstantExpression<T> &>(*b).get_value());
+        case VAR_NODE:
+            return static_cast<const VarExpression<T> &>(*a).get_name() == static_cast<const VarExpression<T> &>(*b).get_name();
+        case MONO_NODE: {
+            const auto &x = static_cast<const MonoExpression<T> &>(*a);
+            const auto &y = static_cast<const MonoExpression<T> &>(*b);
+            return x.get_func() == y.get_func() && same_expression(x.get_arg(), y.get_arg());
+        }
+        case BINARY_NODE: {
+            const auto &x = static_cast<const BinaryExpression<T> &>(*a);
+            const auto &y = static_cast<const BinaryExpression<T> &>(*b);
+            return x.get_op() == y.get_op() && same_expression(x.get_left(), y.get_left())
+                   && same_expression(x.get_right(), y.get_right());
+        }
+    }
+    return false;
+}
+
+template <typename T>
+std::size_t node_count(const std::shared_ptr<Expression<T>> &expr) {
+    // Явный стек: глубина дерева не ограничена стеком вызовов
+    std::size_t count = 0;
+    std::vector<const Expression<T> *> pending{expr.get()};
+    while (!pending.empty()) {
+        const Expression<T> *node = pending.back();
+        pending.pop_back();
+        count++;
+        if (node->kind() == MONO_NODE) {
+            pending.push_back(static_cast<const MonoExpression<T> *>(node)->get_arg().get());
+        } else if (node->kind() == BINARY_NODE) {
+            const auto *binary = static_cast<const BinaryExpression<T> *>(node);
+            pending.push_back(binary->get_left().get());
+            pending.push_back(binary->get_right().get());
+        }
+    }
+    return count;
+}
+
+template <typename T>
+class Simplifier {
+    using Ptr = std::shared_ptr<Expression<T>>;
+
+    struct Factor {
+        Ptr base;
+        T exponent;
+    };
+    // coefficient * base1^exponent1 * base2^exponent2 * ...
+    struct Product {
+        T coefficient = T(1);
+        std::vector<Factor> factors;
+    };
+
+    std::unordered_map<const Expression<T> *, Ptr> done;
+
+    static bool is_constant(const Ptr &expr) { return expr->kind() == CONST_NODE; }
+    static const T &value(const Ptr &expr) { return static_cast<const ConstantExpression<T> &>(*expr).get_value(); }
+
+    static bool negative(const T &v) {
+        if constexpr (std::is_same_v<T, std::complex<double>>) return v.imag() == 0 && v.real() < 0;
+        else return v < T(0);
+    }
+    static bool integer(const T &v) {
+        if constexpr (std::is_same_v<T, std::complex<double>>) return v.imag() == 0 && v.real() == std::floor(v.real());
+        else return v == std::floor(v);
+    }
+    static bool finite(const T &v) {
+        if constexpr (std::is_same_v<T, std::complex<double>>) return std::isfinite(v.real()) && std::isfinite(v.imag());
+        else return std::isfinite(v);
+    }
+
+    static void add_factor(Product &product, const Ptr &base, const T &exponent) {
+        for (auto &factor : product.factors) {
+            if (same_expression(factor.base, base)) {
+                factor.exponent += exponent;
+                return;
+            }
+        }
+        product.factors.push_back({base, exponent});
+    }
+
+    // Разворачивает цепочку * и / (sign = -1 - мы в знаменателе)
+    static void collect_product(const Ptr &expr, const int sign, Product &product) {
+        if (is_constant(expr)) {
+            if (sign > 0) {
+                product.coefficient *= value(expr);
+            } else {
+                if (value(expr) == T(0)) throw std::runtime_error("Division by zero");
+                product.coefficient /= value(expr);
+            }
+            return;
+        }
+        if (expr->kind() == BINARY_NODE) {
+            const auto &binary = static_cast<const BinaryExpression<T> &>(*expr);
+            switch (binary.get_op()) {
+                case MULT:
+                    collect_product(binary.get_left(), sign, product);
+                    collect_product(binary.get_right(), sign, product);
+                    return;
+                case DIV:
+                    collect_product(binary.get_left(), sign, product);
+                    collect_product(binary.get_right(), -sign, product);
+                    return;
+                case POW:
+                    if (is_constant(binary.get_right())) {
+                        add_factor(product, binary.get_left(), value(binary.get_right()) * T(sign));
+                        return;
+                    }
+                    break;
+                default: break;
+            }
+        }
+        add_factor(product, expr, T(sign));
+    }
+
+    static bool same_factors(const Product &a, const Product &b) {
+        if (a.factors.size() != b.factors.size()) return false;
+        for (const auto &factor : a.factors) {
+            bool found = false;
+            for (const auto &other : b.factors) {
+                if (factor.exponent == other.exponent && same_expression(factor.base, other.base)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) return false;
+        }
+        return true;
+    }
+
+    // Разворачивает цепочку + и -: слагаемые без коэффициента и отдельно константа
+    static void collect_sum(const Ptr &expr, const T &sign, std::vector<Product> &terms, T &constant) {
+        if (is_constant(expr)) {
+            constant += sign * value(expr);
+            return;
+        }
+        if (expr->kind() == BINARY_NODE) {
+            const auto &binary = static_cast<const BinaryExpression<T> &>(*expr);
+            if (binary.get_op() == PLUS || binary.get_op() == MINUS) {
+                collect_sum(binary.get_left(), sign, terms, constant);
+                collect_sum(binary.get_right(), binary.get_op() == PLUS ? sign : -sign, terms, constant);
+                return;
+            }
+        }
+        Product product;
+        collect_product(expr, 1, product);
+        product.coefficient *= sign;
+        std::erase_if(product.factors, [](const Factor &factor) { return factor.exponent == T(0); });
+        if (product.factors.empty()) {
+            constant += product.coefficient;
+            return;
+        }
+        for (auto &term : terms) {
+            if (same_factors(term, product)) {
+                term.coefficient += product.coefficient;
+                return;
+            }
+        }
+        terms.push_back(std::move(product));
+    }
+
+    static Ptr power(const Factor &factor, const T &exponent) {
+        if (exponent == T(1)) return factor.base;
+        return make_binary<T>(factor.base, make_constant<T>(exponent), POW);
+    }
+
+    static Ptr build_product(const Product &product) {
+        if (product.coefficient == T(0)) return make_constant<T>(T(0));
+        Ptr numerator, denominator;
+        for (const auto &factor : product.factors) {
+            if (factor.exponent == T(0)) continue;
+            if (negative(factor.exponent)) {
+                auto f = power(factor, -factor.exponent);
+                denominator = denominator ? make_binary<T>(denominator, f, MULT) : f;
+            } else {
+                auto f = power(factor, factor.exponent);
+                if (numerator) {
+                    numerator = make_binary<T>(numerator, f, MULT);
+                } else {
+                    numerator = product.coefficient == T(1) ? f : make_binary<T>(make_constant<T>(product.coefficient), f, MULT);
+                }
+            }
+        }
+        if (!numerator) numerator = make_constant<T>(product.coefficient);
+        if (denominator) return make_binary<T>(numerator, denominator, DIV);
+        return numerator;
+    }
+
+    static Ptr build_sum(std::vector<Product> terms, const T &constant) {
+        std::erase_if(terms, [](const Product &term) { return term.coefficient == T(0); });
+        // Сумма по возможности начинается с положительного слагаемого: 1 - x вместо (-1) * x + 1
+        if (!terms.empty() && negative(terms.front().coefficient)) {
+            auto positive = std::find_if(terms.begin(), terms.end(),
+                                         [](const Product &term) { return !negative(term.coefficient); });
+            if (positive != terms.end()) {
+                std::rotate(terms.begin(), positive, positive + 1);
+            } else if (constant != T(0) && !negative(constant)) {
+                Ptr result = make_constant<T>(constant);
+                for (auto term : terms) {
+                    term.coefficient = -term.coefficient;
+                    result = make_binary<T>(result, build_product(term), MINUS);
+                }
+                return result;
+            }
+        }
+        Ptr result;
+        for (auto term : terms) {
+            if (!result) {
+                result = build_product(term);
+            } else if (negative(term.coefficient)) {
+                term.coefficient = -term.coefficient;
+                result = make_binary<T>(result, build_product(term), MINUS);
+            } else {
+                result = make_binary<T>(result, build_product(term), PLUS);
+            }
+        }
+        if (!result) return make_constant<T>(constant);
+        if (constant == T(0)) return result;
+        if (negative(constant)) return make_binary<T>(result, make_constant<T>(-constant), MINUS);
+        return make_binary<T>(result, make_constant<T>(constant), PLUS);
+    }
+
+    Ptr simplify_mono(const Ptr &arg, const Function func) {
+        if (is_constant(arg)) {
+            T folded;
+            switch (func) {
+                case SIN: folded = std::sin(value(arg)); break;
+                case COS: folded = std::cos(value(arg)); break;
+                case LN: folded = std::log(value(arg)); break;
+                case EXP: folded = std::exp(value(arg)); break;
+                default: throw std::runtime_error("Unknown function");
+            }
+            if (finite(folded)) return make_constant<T>(folded);
+        }
+        // ln(exp(a)) = a только для действительных чисел
+        if constexpr (!std::is_same_v<T, std::complex<double>>) {
+            if (func == LN && arg->kind() == MONO_NODE && static_cast<const MonoExpression<T> &>(*arg).get_func() == EXP) {
+                return static_cast<const MonoExpression<T> &>(*arg).get_arg();
+            }
+        }
+        return make_mono<T>(arg, func);
+    }
+
+    Ptr simplify_binary(const Ptr &left, const Ptr &right, const Operation op) {
+        if (is_constant(left) && is_constant(right)) {
+            const T folded = apply_operation(op, value(left), value(right));
+            if (finite(folded)) return make_constant<T>(folded);
+            return make_binary<T>(left, right, op);
+        }
+        switch (op) {
+            case PLUS: case MINUS: {
+                std::vector<Product> terms;
+                T constant = T(0);
+                collect_sum(left, T(1), terms, constant);
+                collect_sum(right, op == PLUS ? T(1) : T(-1), terms, constant);
+                return build_sum(terms, constant);
+            }
+            case MULT: case DIV: {
+                Product product;
+                collect_product(left, 1, product);
+                collect_product(right, op == MULT ? 1 : -1, product);
+                return build_product(product);
+            }
+            case POW: {
+                if (is_constant(right)) {
+                    if (value(right) == T(0)) return make_constant<T>(T(1));
+                    if (value(right) == T(1)) return left;
+                }
+                if (is_constant(left) && value(left) == T(1)) return make_constant<T>(T(1));
+                // (a^b)^n = a^(b * n) для целого n
+                if (is_constant(right) && integer(value(right)) && left->kind() == BINARY_NODE) {
+                    const auto &inner = static_cast<const BinaryExpression<T> &>(*left);
+                    if (inner.get_op() == POW && is_constant(inner.get_right())) {
+                        return simplify_binary(inner.get_left(), make_constant<T>(value(inner.get_right()) * value(right)), POW);
+                    }
+                }
+                return make_binary<T>(left, right, POW);
+            }
+            default: throw std::runtime_error("Unknown operation");
+        }
+    }
+
+public:
+    Ptr simplify(const Ptr &expr) {
+        auto it = done.find(expr.get());
+        if (it != done.end()) return it->second;
+        Ptr result = expr;
+        if (expr->kind() == MONO_NODE) {
+            const auto &mono = static_cast<const MonoExpression<T> &>(*expr);
+            result = simplify_mono(simplify(mono.get_arg()), mono.get_func());
+        } else if (expr->kind() == BINARY_NODE) {
+            const auto &binary = static_cast<const BinaryExpression<T> &>(*expr);
+            result = simplify_binary(simplify(binary.get_left()), simplify(binary.get_right()), binary.get_op());
+        }
+        done.emplace(expr.get(), result);
+        return result;
+    }
+};
+
+template <typename T>
+std::shared_ptr<Expression<T>> simplify(const std::shared_ptr<Expression<T>> &expr) {
+    return profile_tree_phase(PHASE_SIMPLIFY, [&] {
+        Simplifier<T> simplifier;
+        return simplifier.simplify(expr);
+    });
+}
+
+#endif // SIMPLIFY_H
@@ -0,0 +1,605 @@
+#ifndef STATIC_EXPRESSION_H
+#define STATIC_EXPRESSION_H
+
+#include "Expression.h"
+#include <array>
+#include <concepts>
+#include <string_view>
+
+// Выражения, известные при компиляции: строковый литерал разбирается consteval-парсером (та же грамматика,
+// что у Tokenator и Parser<T>) в тип шаблона выражения, подсчет - встроенные функции без виртуальных вызовов
+// и аллокаций, производная - тоже тип.
+//   constexpr auto f = parse_static<double, "x^2 * sin(y)">();
+//   f(1.5, 2.0);                 // аргументы в порядке первого появления переменных
+//   constexpr auto df = f.diff<"x">();
+// Производная строится по тем же правилам, что Expression::diff, узел в узел (без упрощения),
+// поэтому f.diff<"x">().to_expression() печатается так же, как diff дерева.
+// Ошибки разбора - ошибки компиляции. Числа до 15 значащих цифр и 22 знаков после точки переводятся
+// точно, как std::from_chars; более длинные - с возможной ошибкой в последнем бите.
+// Глубина дерева ограничена глубиной инстанцирования шаблонов (-ftemplate-depth).
+
+namespace static_expr {
+    // Строковый литерал как параметр шаблона
+    template <std::size_t N>
+    struct fixed_string {
+        char data[N]{};
+
+        constexpr fixed_string(const char (&text)[N]) {
+            for (std::size_t i = 0; i < N; i++) data[i] = text[i];
+        }
+        constexpr std::string_view view() const { return {data, N - 1}; }
+    };
+
+    // Узлы шаблона выражения. Константа хранит части числа: выражения разбираются под конкретный T,
+    // и мнимое число для double, как в Parser<double>, - действительное
+    template <double Re, double Im = 0.0>
+    struct Constant {};
+
+    template <std::size_t Slot>
+    struct Variable {};
+
+    template <Function F, typename Arg>
+    struct Mono {};
+
+    template <Operation Op, typename Left, typename Right>
+    struct Binary {};
+
+    template <typename T>
+    constexpr bool is_complex = std::is_same_v<T, std::complex<double>>;
+
+    // ---------- Разбор при компиляции ----------
+
+    struct Node {
+        NodeKind kind = CONST_NODE;
+        std::uint8_t code = 0; // Operation или Function
+        double re = 0;
+        double im = 0;
+        std::size_t slot = 0;
+        std::size_t left = 0;
+        std::size_t right = 0;
+    };
+
+    // Дерево в массиве. Узлов не больше 2 * длина + 1: вставленные 0 (унарный минус) и * (перед i) -
+    // по два узла на символ
+    template <std::size_t N>
+    struct Ast {
+        static constexpr std::size_t capacity = 2 * N + 2;
+        Node nodes[capacity]{};
+        std::size_t size = 0;
+        std::size_t root = 0;
+        // Имена переменных в порядке первого появления, через пробел
+        char names[N + 1]{};
+        std::size_t names_size = 0;
+        std::size_t variable_count = 0;
+    };
+
+    constexpr bool is_digit(const char c) { return c >= '0' && c <= '9'; }
+    constexpr bool is_alpha(const char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+    constexpr bool is_space(const char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+    constexpr char to_lower(const char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; }
+
+    // Как std::from_chars: самый длинный префикс вида цифры[.цифры], хотя бы одна цифра
+    constexpr double number(const std::string_view text) {
+        std::uint64_t mantissa = 0;
+        int digits = 0;   // значащих цифр в mantissa
+        int exponent = 0; // степень десяти
+        bool any = false;
+        bool point = false;
+        for (const char c : text) {
+            if (c == '.') {
+                if (point) break;
+                point = true;
+                continue;
+            }
+            any = true;
+            if (mantissa == 0 && c == '0') {
+                if (point) exponent--;
+                continue;
+            }
+            if (digits < 19) {
+                mantissa = mantissa * 10 + static_cast<std::uint64_t>(c - '0');
+                digits++;
+                if (point) exponent--;
+            } else if (!point) {
+                exponent++; // отброшенная цифра целой части
+            }
+        }
+        if (!any) throw std::runtime_error("Invalid number: " + std::string(text));
+        constexpr double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        // Мантисса до 2^53 и степень до 22 представимы точно, и результат - одно округление, как у from_chars
+        double value = static_cast<double>(mantissa);
+        while (exponent > 22) {
+            value *= 1e22;
+            exponent -= 22;
+        }
+        while (exponent < -22) {
+            value /= 1e22;
+            exponent += 22;
+        }
+        return exponent >= 0 ? value * powers[exponent] : value / powers[-exponent];
+    }
+
+    template <std::size_t N>
+    class LiteralParser {
+        enum TokenKind { NUMBER, COMPLEX, VARIABLE, OPERATOR, FUNCTION, LEFT_PAREN, RIGHT_PAREN, START };
+        struct Token {
+            TokenKind type = START;
+            std::uint8_t code = 0;
+            double value = 0;
+            std::size_t slot = 0;
+        };
+        struct Pending {
+            TokenKind type;
+            std::uint8_t code;
+        };
+
+        std::string_view input;
+        Ast<N> ast{};
+        Token tokens[Ast<N>::capacity]{};
+        std::size_t token_count = 0;
+
+        constexpr void push(const Token token) { tokens[token_count++] = token; }
+
+        constexpr std::size_t variable(const std::string_view name) {
+            // Имена сравниваются посимвольно: string_view::find по буферу вычисляемого объекта GCC не принимает
+            std::size_t slot = 0, start = 0;
+            while (start < ast.names_size) {
+                std::size_t end = start;
+                while (end < ast.names_size && ast.names[end] != ' ') end++;
+                bool same = end - start == name.size();
+                for (std::size_t i = 0; same && i < name.size(); i++) same = ast.names[start + i] == to_lower(name[i]);
+                if (same) return slot;
+                slot++;
+                start = end + 1;
+            }
+            if (ast.names_size) ast.names[ast.names_size++] = ' ';
+            for (const char c : name) ast.names[ast.names_size++] = to_lower(c);
+            return ast.variable_count++;
+        }
+
+        static constexpr bool find_function(const std::string_view name, Function &func) {
+            constexpr std::pair<std::string_view, Function> functions[] = {{"sin", SIN}, {"cos", COS}, {"ln", LN}, {"exp", EXP}};
+            for (const auto &[text, f] : functions) {
+                bool same = text.size() == name.size();
+                for (std::size_t i = 0; same && i < name.size(); i++) same = to_lower(name[i]) == text[i];
+                if (same) {
+                    func = f;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Лексер: те же правила, что Lexer::next
+        constexpr void tokenize() {
+            std::size_t pos = 0;
+            TokenKind previous = START;
+            auto emit = [&](const Token token) {
+                push(token);
+                previous = token.type;
+            };
+            while (true) {
+                while (pos < input.size() && is_space(input[pos])) pos++;
+                if (pos >= input.size()) return;
+                const char c = input[pos];
+                if (is_digit(c) || c == '.') {
+                    const std::size_t start = pos;
+                    while (pos < input.size() && (is_digit(input[pos]) || input[pos] == '.')) pos++;
+                    const double value = number(input.substr(start, pos - start));
+                    std::size_t after = pos;
+                    while (after < input.size() && is_space(input[after])) after++;
+                    if (after < input.size() && input[after] == 'i') {
+                        pos = after + 1;
+                        emit({COMPLEX, 0, value, 0});
+                    } else {
+                        emit({NUMBER, 0, value, 0});
+                    }
+                    continue;
+                }
+                if (c == 'i') {
+                    pos++;
+                    if (previous == RIGHT_PAREN) emit({OPERATOR, MULT, 0, 0});
+                    emit({COMPLEX, 0, 1, 0});
+                    continue;
+                }
+                if (is_alpha(c)) {
+                    const std::size_t start = pos;
+                    while (pos < input.size() && is_alpha(input[pos])) pos++;
+                    const auto name = input.substr(start, pos - start);
+                    Function func{};
+                    if (find_function(name, func)) emit({FUNCTION, static_cast<std::uint8_t>(func), 0, 0});
+                    else emit({VARIABLE, 0, 0, variable(name)});
+                    continue;
+                }
+                Operation op{};
+                switch (c) {
+                    case '+': op = PLUS; break;
+                    case '-': op = MINUS; break;
+                    case '*': op = MULT; break;
+                    case '/': op = DIV; break;
+                    case '^': op = POW; break;
+                    case '(': pos++; emit({LEFT_PAREN, 0, 0, 0}); continue;
+                    case ')': pos++; emit({RIGHT_PAREN, 0, 0, 0}); continue;
+                    default: throw std::runtime_error("Unknown character: " + std::string(1, c));
+                }
+                pos++;
+                // Унарный минус в начале строки или после '(' превращается в 0 - ...
+                if (op == MINUS && (previous == START || previous == LEFT_PAREN)) emit({NUMBER, 0, 0, 0});
+                emit({OPERATOR, static_cast<std::uint8_t>(op), 0, 0});
+            }
+        }
+
+        constexpr std::size_t add(const Node node) {
+            ast.nodes[ast.size] = node;
+            return ast.size++;
+        }
+
+        template <typename T>
+        constexpr std::size_t operand(const Token &token) {
+            switch (token.type) {
+                case NUMBER: return add({CONST_NODE, 0, token.value, 0, 0, 0, 0});
+                // Мнимое число для double - действительное, как в Parser<double>
+                case COMPLEX: return is_complex<T> ? add({CONST_NODE, 0, 0, token.value, 0, 0, 0})
+                                                   : add({CONST_NODE, 0, token.value, 0, 0, 0, 0});
+                case VARIABLE: return add({VAR_NODE, 0, 0, 0, token.slot, 0, 0});
+                default: throw std::runtime_error("Unexpected token");
+            }
+        }
+
+        static constexpr int priority(const std::uint8_t op) {
+            return op == POW ? 3 : op == MULT || op == DIV ? 2 : 1;
+        }
+
+    public:
+        constexpr explicit LiteralParser(const std::string_view input) : input(input) {}
+
+        // Разбор сортировочной станцией, как Parser<T>::parse
+        template <typename T>
+        constexpr Ast<N> parse() {
+            tokenize();
+            std::size_t values[Ast<N>::capacity]{};
+            std::size_t value_count = 0;
+            Pending pending[Ast<N>::capacity]{};
+            std::size_t pending_count = 0;
+            std::size_t cnt_par = 0;
+            std::size_t current = 0;
+
+            auto reduce = [&] {
+                const std::size_t right = values[--value_count];
+                const std::size_t left = values[value_count - 1];
+                values[value_count - 1] = add({BINARY_NODE, pending[--pending_count].code, 0, 0, 0, left, right});
+            };
+            auto apply_functions = [&] {
+                while (pending_count && pending[pending_count - 1].type == FUNCTION) {
+                    const std::size_t arg = values[value_count - 1];
+                    values[value_count - 1] = add({MONO_NODE, pending[--pending_count].code, 0, 0, 0, arg, 0});
+                }
+            };
+
+            while (true) {
+                if (current >= token_count) throw std::runtime_error("Unexpected end of input in parsePrimary");
+                Token token = tokens[current++];
+                if (token.type == FUNCTION || token.type == LEFT_PAREN) {
+                    cnt_par += token.type == LEFT_PAREN;
+                    pending[pending_count++] = {token.type, token.code};
+                    continue;
+                }
+                values[value_count++] = operand<T>(token);
+                apply_functions();
+
+                while (true) {
+                    if (current >= token_count) {
+                        if (cnt_par) throw std::runtime_error("Expected ')'");
+                        while (pending_count) reduce();
+                        ast.root = values[value_count - 1];
+                        return ast;
+                    }
+                    token = tokens[current++];
+                    if (token.type == OPERATOR) {
+                        while (pending_count && pending[pending_count - 1].type == OPERATOR
+                               && priority(pending[pending_count - 1].code) >= priority(token.code)) {
+                            reduce();
+                        }
+                        pending[pending_count++] = {OPERATOR, token.code};
+                        break;
+                    }
+                    if (token.type != RIGHT_PAREN) throw std::runtime_error("Expected operation");
+                    if (!cnt_par) throw std::runtime_error("Extra ')'");
+                    while (pending[pending_count - 1].type == OPERATOR) reduce();
+                    pending_count--;
+                    cnt_par--;
+                    apply_functions();
+                }
+            }
+        }
+    };
+
+    template <typename T, fixed_string Text>
+    struct Parsed {
+        static constexpr std::size_t length = Text.view().size();
+        static constexpr Ast<length> ast = LiteralParser<length>(Text.view()).template parse<T>();
+
+        static consteval auto names() {
+            constexpr std::size_t size = ast.names_size;
+            char text[size + 1]{};
+            for (std::size_t i = 0; i < size; i++) text[i] = ast.names[i];
+            return fixed_string<size + 1>(text);
+        }
+    };
+
+    // Тип узла дерева по его номеру
+    template <typename P, std::size_t I, NodeKind Kind = P::ast.nodes[I].kind>
+    struct build;
+
+    template <typename P, std::size_t I>
+    struct build<P, I, CONST_NODE> {
+        using type = Constant<P::ast.nodes[I].re, P::ast.nodes[I].im>;
+    };
+
+    template <typename P, std::size_t I>
+    struct build<P, I, VAR_NODE> {
+        using type = Variable<P::ast.nodes[I].slot>;
+    };
+
+    template <typename P, std::size_t I>
+    struct build<P, I, MONO_NODE> {
+        using type = Mono<static_cast<Function>(P::ast.nodes[I].code), typename build<P, P::ast.nodes[I].left>::type>;
+    };
+
+    template <typename P, std::size_t I>
+    struct build<P, I, BINARY_NODE> {
+        using type = Binary<static_cast<Operation>(P::ast.nodes[I].code), typename build<P, P::ast.nodes[I].left>::type,
+                            typename build<P, P::ast.nodes[I].right>::type>;
+    };
+
+    // ---------- Подсчет ----------
+
+    template <typename T, double Re, double Im>
+    constexpr T eval_node(Constant<Re, Im>, const T *) {
+        if constexpr (is_complex<T>) return T(Re, Im);
+        else return T(Re);
+    }
+
+    template <typename T, std::size_t Slot>
+    constexpr T eval_node(Variable<Slot>, const T *values) {
+        return values[Slot];
+    }
+
+    template <typename T, Function F, typename Arg>
+    constexpr T eval_node(Mono<F, Arg>, const T *values) {
+        const T arg = eval_node<T>(Arg{}, values);
+        if constexpr (F == SIN) return std::sin(arg);
+        else if constexpr (F == COS) return std::cos(arg);
+        else if constexpr (F == LN) return std::log(arg);
+        else return std::exp(arg);
+    }
+
+    template <typename T, Operation Op, typename Left, typename Right>
+    constexpr T eval_node(Binary<Op, Left, Right>, const T *values) {
+        const T left = eval_node<T>(Left{}, values);
+        const T right = eval_node<T>(Right{}, values);
+        if constexpr (Op == PLUS) return left + right;
+        else if constexpr (Op == MINUS) return left - right;
+        else if constexpr (Op == MULT) return left * right;
+        else if constexpr (Op == DIV) {
+            if (right == T(0)) throw std::runtime_error("Division by zero");
+            return left / right;
+        } else {
+            return std::pow(left, right);
+        }
+    }
+
+    // ---------- Производная (правила Expression::diff) ----------
+
+    constexpr std::size_t no_slot = static_cast<std::size_t>(-1);
+
+    template <typename E, std::size_t Slot, typename T>
+    struct derivative;
+
+    template <typename E, std::size_t Slot, typename T>
+    using derivative_t = typename derivative<E, Slot, T>::type;
+
+    using Zero = Constant<0.0>;
+    using One = Constant<1.0>;
+
+    template <double Re, double Im, std::size_t Slot, typename T>
+    struct derivative<Constant<Re, Im>, Slot, T> {
+        using type = Zero;
+    };
+
+    template <std::size_t S, std::size_t Slot, typename T>
+    struct derivative<Variable<S>, Slot, T> {
+        using type = std::conditional_t<S == Slot, One, Zero>;
+    };
+
+    template <typename A, std::size_t Slot, typename T>
+    struct derivative<Mono<SIN, A>, Slot, T> {
+        using type = Binary<MULT, Mono<COS, A>, derivative_t<A, Slot, T>>;
+    };
+
+    template <typename A, std::size_t Slot, typename T>
+    struct derivative<Mono<COS, A>, Slot, T> {
+        using type = Binary<MULT, Binary<MULT, Constant<-1.0>, Mono<SIN, A>>, derivative_t<A, Slot, T>>;
+    };
+
+    template <typename A, std::size_t Slot, typename T>
+    struct derivative<Mono<LN, A>, Slot, T> {
+        using type = Binary<DIV, derivative_t<A, Slot, T>, A>;
+    };
+
+    template <typename A, std::size_t Slot, typename T>
+    struct derivative<Mono<EXP, A>, Slot, T> {
+        using type = Binary<MULT, Mono<EXP, A>, derivative_t<A, Slot, T>>;
+    };
+
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct derivative<Binary<PLUS, L, R>, Slot, T> {
+        using type = Binary<PLUS, derivative_t<L, Slot, T>, derivative_t<R, Slot, T>>;
+    };
+
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct derivative<Binary<MINUS, L, R>, Slot, T> {
+        using type = Binary<MINUS, derivative_t<L, Slot, T>, derivative_t<R, Slot, T>>;
+    };
+
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct derivative<Binary<MULT, L, R>, Slot, T> {
+        using type = Binary<PLUS, Binary<MULT, derivative_t<L, Slot, T>, R>, Binary<MULT, L, derivative_t<R, Slot, T>>>;
+    };
+
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct derivative<Binary<DIV, L, R>, Slot, T> {
+        using type = Binary<DIV,
+                            Binary<MINUS, Binary<MULT, derivative_t<L, Slot, T>, R>, Binary<MULT, L, derivative_t<R, Slot, T>>>,
+                            Binary<POW, R, Constant<2.0>>>;
+    };
+
+    template <typename E>
+    constexpr bool is_constant = false;
+    template <double Re, double Im>
+    constexpr bool is_constant<Constant<Re, Im>> = true;
+
+    // f(x) ^ const
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct constant_power;
+
+    template <typename L, double Re, double Im, std::size_t Slot, typename T>
+    struct constant_power<L, Constant<Re, Im>, Slot, T> {
+        using R = Constant<Re, Im>;
+        using DL = derivative_t<L, Slot, T>;
+        // Отрицательная степень (только для действительных) уходит в знаменатель
+        static constexpr bool negative = !is_complex<T> && Re <= 0;
+        static constexpr double magnitude = Re < 0 ? -Re : Re;
+        using type = std::conditional_t<
+            Re == 1 && (!is_complex<T> || Im == 0), DL,
+            std::conditional_t<negative, Binary<DIV, Binary<MULT, R, DL>, Binary<POW, L, Constant<magnitude + 1>>>,
+                               Binary<MULT, R, Binary<MULT, Binary<POW, L, Constant<Re - 1, Im>>, DL>>>>;
+    };
+
+    // const ^ f(x)
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct constant_base {
+        using type = Binary<MULT, derivative_t<R, Slot, T>, Binary<MULT, Binary<POW, L, R>, Mono<LN, L>>>;
+    };
+
+    // f(x) ^ g(x) = f^g * (g' * ln(f) + g * f' / f)
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct general_power {
+        using type = Binary<MULT, Binary<POW, L, R>,
+                            Binary<PLUS, Binary<MULT, derivative_t<R, Slot, T>, Mono<LN, L>>,
+                                   Binary<MULT, R, Binary<DIV, derivative_t<L, Slot, T>, L>>>>;
+    };
+
+    template <typename L, typename R, std::size_t Slot, typename T>
+    struct derivative<Binary<POW, L, R>, Slot, T> {
+        using type = typename std::conditional_t<
+            is_constant<R>, constant_power<L, R, Slot, T>,
+            std::conditional_t<is_constant<L>, constant_base<L, R, Slot, T>, general_power<L, R, Slot, T>>>::type;
+    };
+
+    // ---------- Обратно в дерево ----------
+
+    template <typename T, double Re, double Im>
+    std::shared_ptr<Expression<T>> to_tree(Constant<Re, Im>, const std::string_view *) {
+        if constexpr (is_complex<T>) return make_constant<T>(T(Re, Im));
+        else return make_constant<T>(T(Re));
+    }
+
+    template <typename T, std::size_t Slot>
+    std::shared_ptr<Expression<T>> to_tree(Variable<Slot>, const std::string_view *names) {
+        return make_var<T>(std::string(names[Slot]));
+    }
+
+    template <typename T, Function F, typename Arg>
+    std::shared_ptr<Expression<T>> to_tree(Mono<F, Arg>, const std::string_view *names) {
+        return make_mono<T>(to_tree<T>(Arg{}, names), F);
+    }
+
+    template <typename T, Operation Op, typename Left, typename Right>
+    std::shared_ptr<Expression<T>> to_tree(Binary<Op, Left, Right>, const std::string_view *names) {
+        return make_binary<T>(to_tree<T>(Left{}, names), to_tree<T>(Right{}, names), Op);
+    }
+
+    consteval std::size_t count_names(const std::string_view names) {
+        if (names.empty()) return 0;
+        std::size_t count = 1;
+        for (const char c : names) count += c == ' ';
+        return count;
+    }
+}
+
+// Выражение-тип: Tree - шаблон выражения, Names - имена переменных по слотам через пробел
+template <typename T, typename Tree, static_expr::fixed_string Names>
+class StaticExpression {
+    static constexpr auto split() {
+        std::array<std::string_view, static_expr::count_names(Names.view())> result{};
+        const std::string_view names = Names.view();
+        std::size_t start = 0;
+        for (auto &name : result) {
+            std::size_t end = names.find(' ', start);
+            if (end == std::string_view::npos) end = names.size();
+            name = names.substr(start, end - start);
+            start = end + 1;
+        }
+        return result;
+    }
+
+    template <static_expr::fixed_string Var>
+    static constexpr std::size_t slot_of() {
+        const auto names = split();
+        for (std::size_t i = 0; i < names.size(); i++) {
+            if (names[i] == Var.view()) return i;
+        }
+        return static_expr::no_slot; // производная по отсутствующей переменной - ноль
+    }
+
+public:
+    using tree = Tree;
+    static constexpr std::size_t variable_count = static_expr::count_names(Names.view());
+
+    // Имена переменных в порядке аргументов
+    static constexpr std::array<std::string_view, variable_count> variables() { return split(); }
+
+    constexpr T eval(const std::array<T, variable_count> &values) const {
+        return static_expr::eval_node<T>(Tree{}, values.data());
+    }
+
+    template <typename... Values>
+        requires(sizeof...(Values) == variable_count && (std::convertible_to<Values, T> && ...))
+    constexpr T operator()(const Values &...values) const {
+        return eval(std::array<T, variable_count>{T(values)...});
+    }
+
+    // Словарь параметров по слотам (отсутствующие переменные равны нулю, как в eval дерева)
+    std::array<T, variable_count> bind(const std::map<std::string, T> &parameters) const {
+        std::array<T, variable_count> values{};
+        const auto names = variables();
+        for (std::size_t i = 0; i < variable_count; i++) {
+            auto it = parameters.find(std::string(names[i]));
+            values[i] = it != parameters.end() ? it->second : T(0);
+        }
+        return values;
+    }
+
+    // Производная по переменной (имя сравнивается как в Expression::diff, с учетом регистра)
+    template <static_expr::fixed_string Var>
+    constexpr auto diff() const {
+        return StaticExpression<T, static_expr::derivative_t<Tree, slot_of<Var>(), T>, Names>{};
+    }
+
+    // То же выражение обычным деревом
+    std::shared_ptr<Expression<T>> to_expression() const {
+        const auto names = variables();
+        return static_expr::to_tree<T>(Tree{}, names.data());
+    }
+};
+
+// Разбор литерала при компиляции: parse_static<double, "x^2 + sin(y)">()
+template <typename T, static_expr::fixed_string Text>
+consteval auto parse_static() {
+    using P = static_expr::Parsed<T, Text>;
+    return StaticExpression<T, typename static_expr::build<P, P::ast.root>::type, P::names()>{};
+}
+
+#endif // STATIC_EXPRESSION_H
@@ -0,0 +1,110 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с кражей работы: у каждого потока своя очередь, свои задачи он берет с конца,
+// а простаивая - забирает задачи из начала чужих очередей.
+class ThreadPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    // Задачи в очередях: меняется под замком той очереди, куда кладется или откуда берется задача,
+    // поэтому никогда не меньше нуля и не больше, чем задач в очередях на самом деле
+    std::atomic<std::size_t> pending{0};
+    bool stop = false; // под sleep_mutex
+    std::atomic<std::size_t> next{0}; // очередь для задач извне пула
+
+    static std::size_t &worker_index() {
+        thread_local std::size_t index = SIZE_MAX; // SIZE_MAX - поток не из пула
+        return index;
+    }
+
+    bool pop(const std::size_t self, std::function<void()> &task) {
+        {
+            auto &own = *queues[self];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                pending--;
+                return true;
+            }
+        }
+        for (std::size_t i = 1; i < queues.size(); i++) {
+            auto &other = *queues[(self + i) % queues.size()];
+            std::lock_guard lock(other.mutex);
+            if (!other.tasks.empty()) {
+                task = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                pending--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(const std::size_t self) {
+        worker_index() = self;
+        while (true) {
+            {
+                std::unique_lock lock(sleep_mutex);
+                wake.wait(lock, [this] { return pending > 0 || stop; });
+                if (pending == 0 && stop) return;
+            }
+            // Не удалось - задачу забрал другой поток; если задач больше нет, ожидание выше снова уснет
+            std::function<void()> task;
+            if (pop(self, task)) task();
+        }
+    }
+
+public:
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency()) {
+        if (threads == 0) threads = 1;
+        for (std::size_t i = 0; i < threads; i++) queues.push_back(std::make_unique<Queue>());
+        for (std::size_t i = 0; i < threads; i++) workers.emplace_back([this, i] { run(i); });
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(sleep_mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) worker.join();
+    }
+    ThreadPool(const ThreadPool &other) = delete;
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    std::size_t size() const { return workers.size(); }
+
+    // Задача не должна бросать исключения наружу
+    void submit(std::function<void()> task) {
+        std::size_t self = worker_index();
+        if (self >= queues.size()) self = next++ % queues.size();
+        {
+            auto &queue = *queues[self];
+            std::lock_guard lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+            pending++;
+        }
+        // Поток, уже проверивший pending под sleep_mutex, успеет уснуть до notify - пробуждение не потеряется
+        { std::lock_guard lock(sleep_mutex); }
+        wake.notify_one();
+    }
+};
+
+#endif // THREADPOOL_H
@@ -1,7 +1,11 @@
 #ifndef TOKENATOR_H
 #define TOKENATOR_H
+#include "Operations.h"
+#include <cstdint>
+#include <optional>
 #include <vector>
 #include <string>
+#include <string_view>
 
 enum TokenType {
     NUMBER,     // Число (действительная часть)
@@ -14,14 +18,45 @@ enum TokenType {
     START // для унарного минуса
 };
 
+// Токен не владеет текстом: value указывает во входную строку (или на статическую строку
+// для вставленных токенов), поэтому входная строка должна жить, пока используются токены.
+// Имена функций и переменных не приводятся к нижнему регистру - это делает парсер.
 struct Token {
     TokenType type;
-    std::string value;
+    std::string_view value;
+    std::uint8_t code; // Operation для OPERATOR, Function для FUNCTION
 
-    Token(const TokenType type, const std::string &value) noexcept
-        : type(type), value(value) {}
+    Token(const TokenType type, const std::string_view value, const std::uint8_t code = 0) noexcept
+        : type(type), value(value), code(code) {}
+
+    Operation operation() const { return static_cast<Operation>(code); }
+    Function function() const { return static_cast<Function>(code); }
+};
+
+// Потоковый лексер: выдает токены по одному, без промежуточного вектора.
+// Вставленные токены (0 перед унарным минусом, * перед i после скобки) выдаются через pending.
+class Lexer {
+    std::string_view input;
+    size_t pos = 0;
+    TokenType previous = START; // START - токенов еще не было
+    std::optional<Token> pending;
+
+    bool emit(Token &token, const Token &value) {
+        token = value;
+        previous = value.type;
+        return true;
+    }
+
+public:
+    explicit Lexer(const std::string_view input) : input(input) {}
+    explicit Lexer(std::string &&input) = delete;
+
+    // false - вход закончился
+    bool next(Token &token);
 };
 
-std::vector<Token> tokenize(const std::string& str);
+std::vector<Token> tokenize(std::string_view str);
+inline std::vector<Token> tokenize(const char *str) { return tokenize(std::string_view(str)); }
+std::vector<Token> tokenize(std::string &&str) = delete; // токены указывали бы в уничтоженную строку
 void printTokens(std::vector<Token> &tokens);
 #endif //TOKENATOR_H
@@ -6,15 +6,44 @@
 #include "Expression.h"
 #include "Tokenator.h"
 #include "Parser.h"
+#include "Simplify.h"
+#include "ExpressionCache.h"
+#include "Cli.h"
+#include "Profile.h"
+#ifdef __linux__
+#include "Server.h"
+#endif
 
-int main(int argc, char* argv[]) {
+int run(int argc, char* argv[]) {
     if (argc < 2) {
      std::cerr << "Usage: differentiator --eval <expression> [variable=value ...]" << std::endl;
      std::cerr << "       differentiator --diff <expression> --by <variable>" << std::endl;
+     std::cerr << "       differentiator --batch [file] [--threads N] [--block N] [--stats]" << std::endl;
+     std::cerr << "       differentiator --eval-file <expression> <input> <output> [--format csv|binary] [--columns x,y]"
+                  " [--chunk N] [--threads N] [--stats]" << std::endl;
+     std::cerr << "       differentiator --save <expression> <file> [--by <variable>]" << std::endl;
+     std::cerr << "       differentiator --load <file> [variable=value ...]" << std::endl;
+     std::cerr << "       differentiator --emit-header <name> <expression> [--by x,y] [--complex] [--out <file>]"
+               << std::endl;
+     std::cerr << "       differentiator --serve <socket> [--threads N]" << std::endl;
+     std::cerr << "       differentiator --profile <mode> ...   (phase counters of the main thread to stderr)" << std::endl;
+     return 1;
+    }
+    std::string mode = argv[1];  // Режим работы (--eval, --diff или --batch)
+    if (mode == "--batch") return batch_command(argc, argv);
+    if (mode == "--eval-file") return eval_file_command(argc, argv);
+    if (mode == "--save") return save_command(argc, argv);
+    if (mode == "--load") return load_command(argc, argv);
+    if (mode == "--emit-header") return emit_header_command(argc, argv);
+#ifdef __linux__
+    if (mode == "--serve") return serve_command(argc, argv);
+#endif
+    if (argc < 3) {
+     std::cerr << "Missing expression" << std::endl;
      return 1;
     }
-    std::string mode = argv[1];  // Режим работы (--eval или --diff)
     std::string expression = argv[2];  // Выражение
+    ExpressionCache<std::complex<double>> cache; // одинаковые значения переменных разбираются один раз
 
     if (mode == "--eval") {
      std::map<std::string, std::complex<double>> params;
@@ -29,18 +58,14 @@ int main(int argc, char* argv[]) {
          std::string var = arg.substr(0, eqPos);
 
          std::string val_expr = arg.substr(eqPos + 1);
-         auto val_tokens = tokenize(val_expr);
-         Parser<std::complex<double>> val_expr_parser(val_tokens);
-         auto expr = val_expr_parser.parse();
+         auto expr = cache.get(val_expr)->parsed;
          std::map<std::string, std::complex<double>> result;
          std::complex<double> value = expr->eval(result);
 
          params[var] = value;
      }
 
-     auto tokens = tokenize(expression);
-     Parser<std::complex<double>> parser(tokens);
-     auto expr = parser.parse();
+     auto expr = cache.get(expression)->parsed;
      std::cout << expr->eval(params) << std::endl;
 
     } else if (mode == "--diff") {
@@ -50,15 +75,28 @@ int main(int argc, char* argv[]) {
      }
 
      std::string diffVar = argv[4];  // Переменная, по которой дифференцируем
-     auto tokens = tokenize(expression);
-     Parser<std::complex<double>> parser(tokens);
-     auto expr = parser.parse();
+     auto expr = cache.get(expression)->parsed;
      auto diffExpr = expr->diff(diffVar);
-     optimize(diffExpr);
+     diffExpr = simplify(diffExpr);
      std::cout << diffExpr->to_string() << std::endl;
     } else {
      std::cerr << "Unknown mode: " << mode << std::endl;
      return 1;
     }
      return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[]) {
+    // --profile перед любым режимом: счетчики фаз основного потока печатаются в stderr
+    if (argc > 1 && std::string(argv[1]) == "--profile") {
+        Profiler profiler;
+        int code;
+        {
+            ProfileScope scope(profiler);
+            code = run(argc - 1, argv + 1);
+        }
+        print_profile(std::cerr, profiler.stats());
+        return code;
+    }
+    return run(argc, argv);
+}
@@ -0,0 +1,528 @@
+#include "Cli.h"
+#include "Codegen.h"
+#include "Parallel.h"
+#include "Serialize.h"
+#include <bit>
+#include <cstring>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <latch>
+
+namespace {
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front()))) text.remove_prefix(1);
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back()))) text.remove_suffix(1);
+    return text;
+}
+
+std::string lower(std::string_view text) {
+    std::string result(text);
+    for (char &c : result) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return result;
+}
+
+std::vector<std::string_view> split(std::string_view line, const char separator) {
+    std::vector<std::string_view> fields;
+    while (true) {
+        const auto end = line.find(separator);
+        fields.push_back(trim(line.substr(0, end)));
+        if (end == std::string_view::npos) return fields;
+        line.remove_prefix(end + 1);
+    }
+}
+
+void append_number(std::string &out, const double value) {
+    char buffer[32];
+    const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
+    out.append(buffer, result.ptr);
+}
+
+std::string eval_request(const std::vector<std::string_view> &fields, ExpressionCache<std::complex<double>> &cache) {
+    std::map<std::string, std::complex<double>> params;
+    for (std::size_t i = 2; i < fields.size(); i++) {
+        if (fields[i].empty()) continue;
+        const auto eq = fields[i].find('=');
+        if (eq == std::string_view::npos) throw std::runtime_error("Invalid argument: " + std::string(fields[i]));
+        const auto value = cache.get(fields[i].substr(eq + 1));
+        const auto values = value->program.bind({});
+        params[lower(trim(fields[i].substr(0, eq)))] = value->program.eval(std::span<const std::complex<double>>(values));
+    }
+    const auto entry = cache.get(fields[1]);
+    const auto values = entry->program.bind(params);
+    return format_value(entry->program.eval(std::span<const std::complex<double>>(values)));
+}
+
+std::string diff_request(const std::vector<std::string_view> &fields, ExpressionCache<std::complex<double>> &cache) {
+    if (fields.size() != 3 || fields[2].empty()) throw std::runtime_error("Expected: diff; <expression>; <variable>");
+    const auto entry = cache.get(fields[1]);
+    std::string var = lower(fields[2]);
+    // Производные повторяющихся формул в потоке строятся один раз
+    thread_local DiffCache<std::complex<double>> derivatives;
+    thread_local std::unordered_map<std::string, std::string> printed;
+    const std::string key = entry->key + '\n' + var;
+    if (auto it = printed.find(key); it != printed.end()) return it->second;
+    DiffCacheScope<std::complex<double>> scope(derivatives);
+    auto result = simplify(entry->parsed->diff(var))->to_string();
+    if (printed.size() >= 4096) printed.clear();
+    printed.emplace(key, result);
+    return result;
+}
+
+std::size_t parse_count(const char *text) {
+    std::size_t value = 0;
+    const std::string_view view(text);
+    const auto result = std::from_chars(view.data(), view.data() + view.size(), value);
+    if (result.ec != std::errc() || result.ptr != view.data() + view.size() || value == 0) {
+        throw std::runtime_error("Invalid number: " + std::string(view));
+    }
+    return value;
+}
+
+double load_double(const char *bytes) {
+    std::uint64_t bits;
+    std::memcpy(&bits, bytes, sizeof(bits));
+    if constexpr (std::endian::native == std::endian::big) bits = __builtin_bswap64(bits);
+    return std::bit_cast<double>(bits);
+}
+
+void store_double(std::string &out, const double value) {
+    auto bits = std::bit_cast<std::uint64_t>(value);
+    if constexpr (std::endian::native == std::endian::big) bits = __builtin_bswap64(bits);
+    char bytes[sizeof(bits)];
+    std::memcpy(bytes, &bits, sizeof(bits));
+    out.append(bytes, sizeof(bytes));
+}
+
+// Порция строк по столбцам переменных программы: подсчет и запись ответа
+class ChunkEvaluator {
+    const Program<double> &program;
+    const EvalFileOptions &options;
+    std::ostream &out;
+    std::unique_ptr<ThreadPool> pool;
+    BatchScratch<double> scratch;
+    std::vector<std::vector<double>> columns; // по слотам программы
+    std::vector<double> results;
+    std::string buffer;
+
+public:
+    std::vector<std::size_t> source; // номер столбца файла для каждого слота
+    std::size_t rows = 0; // строк в текущей порции
+    std::size_t total = 0;
+
+    ChunkEvaluator(const Program<double> &program, const EvalFileOptions &options, std::ostream &out,
+                   const std::vector<std::string> &names)
+        : program(program), options(options), out(out) {
+        for (const auto &variable : program.get_variables()) {
+            std::size_t found = names.size();
+            for (std::size_t c = 0; c < names.size(); c++) {
+                if (lower(trim(names[c])) == variable) found = c;
+            }
+            if (found == names.size()) throw std::runtime_error("No input column for variable: " + variable);
+            source.push_back(found);
+        }
+        columns.assign(source.size(), std::vector<double>(options.chunk));
+        results.resize(options.chunk);
+        if (options.threads > 1) pool = std::make_unique<ThreadPool>(options.threads);
+    }
+
+    double *slot(const std::size_t s) { return columns[s].data(); }
+    bool full() const { return rows == options.chunk; }
+
+    void flush() {
+        if (rows == 0) return;
+        std::vector<std::span<const double>> spans;
+        for (const auto &column : columns) spans.emplace_back(column.data(), rows);
+        const std::span<const std::span<const double>> by_slot(spans);
+        const std::span<double> result(results.data(), rows);
+        if (pool) {
+            eval_parallel(program, by_slot, result, *pool);
+        } else {
+            eval_batch(program, by_slot, result, scratch);
+        }
+        buffer.clear();
+        for (const double value : result) {
+            if (options.format == ColumnFormat::BINARY) {
+                store_double(buffer, value);
+            } else {
+                char text[32];
+                buffer.append(text, std::to_chars(text, text + sizeof(text), value).ptr);
+                buffer += '\n';
+            }
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        total += rows;
+        rows = 0;
+    }
+};
+
+constexpr std::size_t read_block = std::size_t(1) << 20; // байт за одно чтение
+
+std::size_t eval_binary(std::istream &in, ChunkEvaluator &chunk, const std::size_t width) {
+    if (width == 0) throw std::runtime_error("Binary input needs --columns");
+    const std::size_t row_bytes = width * sizeof(double);
+    const std::size_t rows_per_read = std::max<std::size_t>(1, read_block / row_bytes);
+    std::vector<char> bytes(rows_per_read * row_bytes);
+    std::size_t total = 0;
+    while (in) {
+        in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        const auto got = static_cast<std::size_t>(in.gcount());
+        total += got;
+        if (got % row_bytes) throw std::runtime_error("Truncated binary input");
+        for (std::size_t r = 0; r < got / row_bytes; r++) {
+            const char *row = bytes.data() + r * row_bytes;
+            for (std::size_t s = 0; s < chunk.source.size(); s++) {
+                chunk.slot(s)[chunk.rows] = load_double(row + chunk.source[s] * sizeof(double));
+            }
+            if (++chunk.rows, chunk.full()) chunk.flush();
+        }
+    }
+    return total;
+}
+
+void parse_csv_row(std::string_view line, ChunkEvaluator &chunk, const std::size_t width, std::vector<std::string_view> &fields) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (trim(line).empty()) return;
+    fields.clear();
+    while (true) {
+        const auto comma = line.find(',');
+        fields.push_back(trim(line.substr(0, comma)));
+        if (comma == std::string_view::npos) break;
+        line.remove_prefix(comma + 1);
+    }
+    if (fields.size() != width) {
+        throw std::runtime_error("Row " + std::to_string(chunk.total + chunk.rows + 1) + " has " + std::to_string(fields.size())
+                                 + " fields, expected " + std::to_string(width));
+    }
+    for (std::size_t s = 0; s < chunk.source.size(); s++) {
+        const auto field = fields[chunk.source[s]];
+        double value = 0;
+        const auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (result.ec != std::errc() || result.ptr != field.data() + field.size()) {
+            throw std::runtime_error("Invalid number: " + std::string(field));
+        }
+        chunk.slot(s)[chunk.rows] = value;
+    }
+    if (++chunk.rows, chunk.full()) chunk.flush();
+}
+
+std::size_t eval_csv(std::istream &in, ChunkEvaluator &chunk, const std::size_t width) {
+    std::vector<char> bytes(read_block);
+    std::string carry;
+    std::vector<std::string_view> fields;
+    std::size_t total = 0;
+    while (in) {
+        in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        const auto got = static_cast<std::size_t>(in.gcount());
+        total += got;
+        std::string_view block(bytes.data(), got);
+        // Неполная последняя строка блока переносится в следующий
+        const auto last = block.rfind('\n');
+        if (last == std::string_view::npos) {
+            carry.append(block);
+            continue;
+        }
+        std::string_view lines = block.substr(0, last + 1);
+        if (!carry.empty()) {
+            const auto first = lines.find('\n');
+            carry.append(lines.substr(0, first));
+            parse_csv_row(carry, chunk, width, fields);
+            carry.clear();
+            lines.remove_prefix(first + 1);
+        }
+        while (!lines.empty()) {
+            const auto end = lines.find('\n');
+            parse_csv_row(lines.substr(0, end), chunk, width, fields);
+            lines.remove_prefix(end + 1);
+        }
+        carry.assign(block.substr(last + 1));
+    }
+    parse_csv_row(carry, chunk, width, fields);
+    return total;
+}
+}
+
+std::string format_value(const std::complex<double> &value) {
+    std::string out = "(";
+    append_number(out, value.real());
+    out += ',';
+    append_number(out, value.imag());
+    out += ')';
+    return out;
+}
+
+std::string process_request(const std::string_view line, ExpressionCache<std::complex<double>> &cache) {
+    try {
+        const auto fields = split(line, ';');
+        if (fields.size() < 2) throw std::runtime_error("Expected: <eval|diff>; <expression>; ...");
+        const auto kind = lower(fields[0]);
+        if (kind == "eval") return eval_request(fields, cache);
+        if (kind == "diff") return diff_request(fields, cache);
+        throw std::runtime_error("Unknown request: " + std::string(fields[0]));
+    } catch (const std::exception &e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+BatchStats run_batch(std::istream &in, std::ostream &out, const BatchOptions &options,
+                     ExpressionCache<std::complex<double>> &cache) {
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t block = std::max<std::size_t>(options.block, 1);
+    std::unique_ptr<ThreadPool> pool;
+    if (options.threads > 1) pool = std::make_unique<ThreadPool>(options.threads);
+
+    BatchStats stats;
+    std::vector<std::string> lines;
+    std::vector<std::string> results(block);
+    std::string buffer;
+    buffer.reserve(options.buffer + 1024);
+    std::string line;
+    bool more = true;
+    while (more) {
+        lines.clear();
+        while (lines.size() < block && (more = static_cast<bool>(std::getline(in, line)))) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (trim(line).empty()) continue;
+            lines.push_back(line);
+        }
+        const std::size_t n = lines.size();
+        if (!pool) {
+            for (std::size_t i = 0; i < n; i++) results[i] = process_request(lines[i], cache);
+        } else if (n > 0) {
+            // Порция делится на части по числу потоков с запасом; ответы пишутся по своим местам
+            const std::size_t parts = std::min(n, pool->size() * 4);
+            std::latch done(static_cast<std::ptrdiff_t>(parts));
+            for (std::size_t p = 0; p < parts; p++) {
+                pool->submit([&, p] {
+                    for (std::size_t i = p * n / parts; i < (p + 1) * n / parts; i++) results[i] = process_request(lines[i], cache);
+                    done.count_down();
+                });
+            }
+            done.wait();
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            stats.errors += results[i].starts_with("error: ");
+            buffer += results[i];
+            buffer += '\n';
+            if (buffer.size() >= options.buffer) {
+                out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+        }
+        stats.requests += n;
+    }
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.flush();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+int batch_command(const int argc, char *argv[]) {
+    BatchOptions options;
+    std::string path;
+    bool print_stats = false;
+    try {
+        for (int i = 2; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--stats") {
+                print_stats = true;
+            } else if ((arg == "--threads" || arg == "--block") && i + 1 < argc) {
+                (arg == "--threads" ? options.threads : options.block) = parse_count(argv[++i]);
+            } else if (path.empty() && !arg.starts_with("--")) {
+                path = arg;
+            } else {
+                std::cerr << "Unknown argument: " << arg << std::endl;
+                return 1;
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::ifstream file;
+    if (!path.empty() && path != "-") {
+        file.open(path);
+        if (!file) {
+            std::cerr << "Cannot open file: " << path << std::endl;
+            return 1;
+        }
+    }
+    std::istream &in = file.is_open() ? static_cast<std::istream &>(file) : std::cin;
+
+    std::ios::sync_with_stdio(false);
+    ExpressionCache<std::complex<double>> cache;
+    const auto stats = run_batch(in, std::cout, options, cache);
+    if (print_stats) {
+        const auto cached = cache.stats();
+        std::cerr << "requests: " << stats.requests << ", errors: " << stats.errors << ", time: " << stats.seconds
+                  << " s, throughput: " << (stats.seconds > 0 ? stats.requests / stats.seconds : 0.0) << " req/s"
+                  << ", cache hits: " << cached.hits << ", misses: " << cached.misses << std::endl;
+    }
+    return 0;
+}
+
+EvalFileStats eval_file(const Program<double> &program, std::istream &in, std::ostream &out,
+                        const EvalFileOptions &options) {
+    const auto start = std::chrono::steady_clock::now();
+    if (options.chunk == 0) throw std::runtime_error("Chunk size must be positive");
+    EvalFileStats stats;
+    std::vector<std::string> names = options.columns;
+    if (options.format == ColumnFormat::CSV) {
+        std::string header;
+        if (!std::getline(in, header)) throw std::runtime_error("Missing CSV header");
+        stats.bytes += header.size() + 1;
+        if (!header.empty() && header.back() == '\r') header.pop_back();
+        names.clear();
+        for (const auto name : split(header, ',')) names.emplace_back(name);
+    }
+    ChunkEvaluator chunk(program, options, out, names);
+    if (options.format == ColumnFormat::BINARY) {
+        stats.bytes += eval_binary(in, chunk, names.size());
+    } else {
+        stats.bytes += eval_csv(in, chunk, names.size());
+    }
+    chunk.flush();
+    out.flush();
+    stats.rows = chunk.total;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+int eval_file_command(const int argc, char *argv[]) {
+    if (argc < 5) {
+        std::cerr << "Usage: differentiator --eval-file <expression> <input> <output> [--format csv|binary]"
+                     " [--columns x,y] [--chunk N] [--threads N] [--stats]" << std::endl;
+        return 1;
+    }
+    EvalFileOptions options;
+    bool print_stats = false;
+    try {
+        for (int i = 5; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--stats") {
+                print_stats = true;
+            } else if (arg == "--format" && i + 1 < argc) {
+                const std::string format = argv[++i];
+                if (format == "csv") options.format = ColumnFormat::CSV;
+                else if (format == "binary") options.format = ColumnFormat::BINARY;
+                else throw std::runtime_error("Unknown format: " + format);
+            } else if (arg == "--columns" && i + 1 < argc) {
+                for (const auto name : split(argv[++i], ',')) options.columns.emplace_back(name);
+            } else if ((arg == "--chunk" || arg == "--threads") && i + 1 < argc) {
+                (arg == "--chunk" ? options.chunk : options.threads) = parse_count(argv[++i]);
+            } else {
+                throw std::runtime_error("Unknown argument: " + arg);
+            }
+        }
+
+        const auto program = compile(Parser<double>(std::string_view(argv[2])).parse());
+        const auto mode = options.format == ColumnFormat::BINARY ? std::ios::binary : std::ios::openmode();
+        std::ifstream in(argv[3], std::ios::in | mode);
+        if (!in) throw std::runtime_error("Cannot open file: " + std::string(argv[3]));
+        std::ofstream out(argv[4], std::ios::out | std::ios::trunc | mode);
+        if (!out) throw std::runtime_error("Cannot open file: " + std::string(argv[4]));
+        const auto stats = eval_file(program, in, out, options);
+        if (!out) throw std::runtime_error("Cannot write file: " + std::string(argv[4]));
+        if (print_stats) {
+            std::cerr << "rows: " << stats.rows << ", read: " << stats.bytes << " bytes, time: " << stats.seconds
+                      << " s, throughput: " << (stats.seconds > 0 ? stats.bytes / stats.seconds / 1e6 : 0.0) << " MB/s"
+                      << std::endl;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int save_command(const int argc, char *argv[]) {
+    if (argc != 4 && !(argc == 6 && std::string_view(argv[4]) == "--by")) {
+        std::cerr << "Usage: differentiator --save <expression> <file> [--by <variable>]" << std::endl;
+        return 1;
+    }
+    try {
+        auto expr = Parser<std::complex<double>>(std::string_view(argv[2])).parse();
+        if (argc == 6) {
+            DiffCache<std::complex<double>> derivatives;
+            DiffCacheScope<std::complex<double>> scope(derivatives);
+            std::string var = lower(argv[5]);
+            expr = simplify(expr->diff(var));
+        }
+        try {
+            expr = optimize(expr);
+        } catch (const std::runtime_error &) {
+            // деление на константный ноль проявится при подсчете
+        }
+        save_binary(compile(expr), argv[3]);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int load_command(const int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: differentiator --load <file> [variable=value ...]" << std::endl;
+        return 1;
+    }
+    try {
+        const MappedProgram<std::complex<double>> program(argv[2]);
+        std::map<std::string, std::complex<double>> params;
+        for (int i = 3; i < argc; i++) {
+            const std::string_view arg = argv[i];
+            const auto eq = arg.find('=');
+            if (eq == std::string_view::npos) throw std::runtime_error("Invalid argument: " + std::string(arg));
+            const auto value = Parser<std::complex<double>>(arg.substr(eq + 1)).parse();
+            params[lower(trim(arg.substr(0, eq)))] = value->eval({});
+        }
+        const auto values = program.bind(params);
+        std::cout << format_value(program.eval(std::span<const std::complex<double>>(values))) << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int emit_header_command(const int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: differentiator --emit-header <name> <expression> [--by x,y] [--complex] [--out <file>]"
+                  << std::endl;
+        return 1;
+    }
+    try {
+        HeaderOptions options;
+        options.name = argv[2];
+        bool complex = false;
+        std::string path;
+        for (int i = 4; i < argc; i++) {
+            const std::string_view arg = argv[i];
+            if (arg == "--complex") {
+                complex = true;
+            } else if (arg == "--by" && i + 1 < argc) {
+                for (const auto var : split(argv[++i], ',')) options.by.push_back(lower(trim(var)));
+            } else if (arg == "--out" && i + 1 < argc) {
+                path = argv[++i];
+            } else {
+                throw std::runtime_error("Unknown argument: " + std::string(arg));
+            }
+        }
+        const std::string_view text = argv[3];
+        const std::string header = complex ? emit_header(Parser<std::complex<double>>(text).parse(), options)
+                                           : emit_header(Parser<double>(text).parse(), options);
+        if (path.empty()) {
+            std::cout << header;
+        } else {
+            std::ofstream out(path, std::ios::binary);
+            out << header;
+            if (!out) throw std::runtime_error("Cannot write file: " + path);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
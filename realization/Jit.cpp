@@ -0,0 +1,238 @@
+#include "Jit.h"
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define EXPRESSION_HAS_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef EXPRESSION_HAS_JIT
+// Обертки, а не адреса std::sin и т.п.: те же вызовы, что в execute, поэтому и те же результаты
+double call_sin(const double x) { return std::sin(x); }
+double call_cos(const double x) { return std::cos(x); }
+double call_log(const double x) { return std::log(x); }
+double call_exp(const double x) { return std::exp(x); }
+double call_pow(const double x, const double y) { return std::pow(x, y); }
+
+// Кодировщик нужного подмножества x86-64.
+// rbx - регистры программы, r12 - значения переменных (оба сохраняются при вызовах libm),
+// xmm0 и xmm1 - операнды, xmm2 - ноль для проверки делителя.
+class Assembler {
+    std::vector<std::uint8_t> bytes;
+
+public:
+    enum Base { RBX = 3, R12 = 12 };
+
+    const std::vector<std::uint8_t> &code() const { return bytes; }
+    std::size_t size() const { return bytes.size(); }
+
+    void emit(std::initializer_list<std::uint8_t> list) { bytes.insert(bytes.end(), list); }
+
+    void emit32(const std::uint32_t value) {
+        for (int i = 0; i < 4; i++) bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+
+    void emit64(const std::uint64_t value) {
+        for (int i = 0; i < 8; i++) bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+
+    void patch32(const std::size_t at, const std::uint32_t value) {
+        for (int i = 0; i < 4; i++) bytes[at + i] = static_cast<std::uint8_t>(value >> (8 * i));
+    }
+
+    // movsd xmm, [base + 8 * index] (store = false) или movsd [base + 8 * index], xmm
+    void movsd(const bool store, const int xmm, const Base base, const std::uint32_t index) {
+        bytes.push_back(0xF2);
+        if (base == R12) bytes.push_back(0x41);
+        emit({0x0F, static_cast<std::uint8_t>(store ? 0x11 : 0x10),
+              static_cast<std::uint8_t>(0x80 | (xmm << 3) | (base & 7))});
+        if ((base & 7) == 4) bytes.push_back(0x24); // SIB: r12 без индекса
+        emit32(index * 8);
+    }
+
+    // addsd/subsd/mulsd/divsd xmm0, xmm1
+    void arith(const std::uint8_t opcode) { emit({0xF2, 0x0F, opcode, 0xC1}); }
+
+    // movq xmm, imm64 через rax
+    void load_bits(const int xmm, const std::uint64_t bits) {
+        emit({0x48, 0xB8});
+        emit64(bits);
+        emit({0x66, 0x48, 0x0F, 0x6E, static_cast<std::uint8_t>(0xC0 | (xmm << 3))});
+    }
+
+    void call(const void *target) {
+        emit({0x48, 0xB8});
+        emit64(reinterpret_cast<std::uintptr_t>(target));
+        emit({0xFF, 0xD0}); // call rax
+    }
+
+    // je rel32 с местом под смещение; возвращает позицию смещения
+    std::size_t jump_if_equal() {
+        emit({0x0F, 0x84});
+        emit32(0);
+        return bytes.size() - 4;
+    }
+
+    std::size_t jump() {
+        bytes.push_back(0xE9);
+        emit32(0);
+        return bytes.size() - 4;
+    }
+
+    void bind(const std::size_t at) { patch32(at, static_cast<std::uint32_t>(bytes.size() - (at + 4))); }
+};
+
+std::vector<std::uint8_t> assemble(const Program<double> &program) {
+    // Смещения [base + 8 * index] - 32-битные
+    if (program.get_registers() >= (1u << 28) || program.get_variables().size() >= (1u << 28)) {
+        throw std::runtime_error("Program is too large for native code");
+    }
+    Assembler a;
+    // Пролог: на входе rsp = 16k + 8, после двух push и sub 8 выровнен для вызовов
+    a.emit({0x53});                   // push rbx
+    a.emit({0x41, 0x54});             // push r12
+    a.emit({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+    a.emit({0x49, 0x89, 0xFC});       // mov r12, rdi (values)
+    a.emit({0x48, 0x89, 0xF3});       // mov rbx, rsi (regs)
+
+    constexpr std::uint32_t none = UINT32_MAX;
+    std::uint32_t cached = none; // регистр программы, значение которого сейчас в xmm0
+    std::vector<std::size_t> division_errors;
+    const auto &constants = program.get_constants();
+
+    // xmm0 = regs[x], xmm1 = regs[y] с учетом того, что уже лежит в xmm0
+    auto load_operands = [&](const std::uint32_t x, const std::uint32_t y) {
+        if (cached == y && x != y) {
+            a.emit({0x66, 0x0F, 0x28, 0xC8}); // movapd xmm1, xmm0
+            a.movsd(false, 0, Assembler::RBX, x);
+            return;
+        }
+        if (cached != x) a.movsd(false, 0, Assembler::RBX, x);
+        if (x == y) a.emit({0x66, 0x0F, 0x28, 0xC8});
+        else a.movsd(false, 1, Assembler::RBX, y);
+    };
+
+    for (const auto &ins : program.get_code()) {
+        switch (ins.code) {
+            case OP_CONST: {
+                std::uint64_t bits;
+                std::memcpy(&bits, &constants.at(ins.a), sizeof(bits));
+                a.load_bits(0, bits);
+                break;
+            }
+            case OP_VAR: a.movsd(false, 0, Assembler::R12, ins.a); break;
+            case OP_ADD: load_operands(ins.a, ins.b); a.arith(0x58); break;
+            case OP_SUB: load_operands(ins.a, ins.b); a.arith(0x5C); break;
+            case OP_MUL: load_operands(ins.a, ins.b); a.arith(0x59); break;
+            case OP_DIV:
+                load_operands(ins.a, ins.b);
+                // Как в execute: ошибка, если делитель == 0 (и -0); NaN нулю не равен (PF = 1)
+                a.emit({0x66, 0x0F, 0x57, 0xD2}); // xorpd xmm2, xmm2
+                a.emit({0x66, 0x0F, 0x2E, 0xCA}); // ucomisd xmm1, xmm2
+                a.emit({0x7A, 0x06});             // jp через je
+                division_errors.push_back(a.jump_if_equal());
+                a.arith(0x5E);
+                break;
+            case OP_POW: load_operands(ins.a, ins.b); a.call(reinterpret_cast<const void *>(&call_pow)); break;
+            case OP_SIN:
+            case OP_COS:
+            case OP_LN:
+            case OP_EXP: {
+                if (cached != ins.a) a.movsd(false, 0, Assembler::RBX, ins.a);
+                double (*target)(double) = ins.code == OP_SIN ? call_sin : ins.code == OP_COS ? call_cos
+                                         : ins.code == OP_LN ? call_log : call_exp;
+                a.call(reinterpret_cast<const void *>(target));
+                break;
+            }
+            default: throw std::runtime_error("Unknown instruction");
+        }
+        a.movsd(true, 0, Assembler::RBX, ins.dst);
+        cached = ins.dst;
+    }
+
+    a.emit({0x31, 0xC0}); // xor eax, eax
+    const auto done = a.size();
+    a.emit({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+    a.emit({0x41, 0x5C});             // pop r12
+    a.emit({0x5B, 0xC3});             // pop rbx; ret
+    if (!division_errors.empty()) {
+        for (const auto at : division_errors) a.bind(at);
+        a.emit({0xB8});
+        a.emit32(NATIVE_DIVISION_BY_ZERO); // mov eax, status
+        const auto back = a.jump();
+        a.patch32(back, static_cast<std::uint32_t>(done - (back + 4)));
+    }
+    return a.code();
+}
+
+// Код копируется в новые страницы, которые затем становятся только исполняемыми (W^X)
+void *map_code(const std::vector<std::uint8_t> &code, std::size_t &size) {
+    const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    size = (code.size() + page - 1) / page * page;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return nullptr;
+    }
+    return memory;
+}
+#endif
+}
+
+bool NativeProgram::supported() {
+#ifdef EXPRESSION_HAS_JIT
+    return true;
+#else
+    return false;
+#endif
+}
+
+NativeProgram::NativeProgram(Program<double> program, const bool native) : program(std::move(program)) {
+#ifdef EXPRESSION_HAS_JIT
+    if (!native) return;
+    memory = map_code(assemble(this->program), memory_size);
+    if (memory) function = reinterpret_cast<NativeFunction>(memory);
+    else memory_size = 0;
+#else
+    (void)native;
+#endif
+}
+
+NativeProgram::~NativeProgram() {
+#ifdef EXPRESSION_HAS_JIT
+    if (memory) munmap(memory, memory_size);
+#endif
+}
+
+NativeProgram::NativeProgram(NativeProgram &&other) noexcept
+    : program(std::move(other.program)), memory(std::exchange(other.memory, nullptr)),
+      memory_size(std::exchange(other.memory_size, 0)), function(std::exchange(other.function, nullptr)) {}
+
+NativeProgram &NativeProgram::operator=(NativeProgram &&other) noexcept {
+    if (this != &other) {
+#ifdef EXPRESSION_HAS_JIT
+        if (memory) munmap(memory, memory_size);
+#endif
+        program = std::move(other.program);
+        memory = std::exchange(other.memory, nullptr);
+        memory_size = std::exchange(other.memory_size, 0);
+        function = std::exchange(other.function, nullptr);
+    }
+    return *this;
+}
+
+double NativeProgram::run(const std::span<const double> values, const std::span<double> scratch) const {
+    if (!function) {
+        return execute<double>(program.get_code(), program.get_constants(), values, scratch, program.get_result());
+    }
+    if (function(values.data(), scratch.data()) == NATIVE_DIVISION_BY_ZERO) {
+        throw std::runtime_error("Division by zero");
+    }
+    return scratch[program.get_result()];
+}
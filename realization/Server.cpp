@@ -0,0 +1,383 @@
+#include "Server.h"
+#include "Cli.h"
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <deque>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+constexpr std::uint64_t listen_event = 1;
+constexpr std::uint64_t done_event = 2;
+constexpr std::uint64_t stop_event = 3;
+constexpr std::size_t max_line = std::size_t(16) << 20; // строка длиннее - клиент закрывается
+// Непосланные ответы и необработанные запросы соединения сверх этого - чтение приостанавливается,
+// а ответы клиенту, который их не читает, перестают копиться
+constexpr std::size_t max_buffered = std::size_t(32) << 20;
+
+std::runtime_error system_error(const std::string &what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front()))) text.remove_prefix(1);
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back()))) text.remove_suffix(1);
+    return text;
+}
+
+// Следующее слово строки (слова разделены пробелами)
+std::string_view take_word(std::string_view &text) {
+    text = trim(text);
+    const auto end = std::min(text.find_first_of(" \t"), text.size());
+    const auto word = text.substr(0, end);
+    text.remove_prefix(end);
+    return word;
+}
+
+template <typename Number>
+Number parse_number(const std::string_view text) {
+    Number value{};
+    const auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != std::errc() || result.ptr != text.data() + text.size()) {
+        throw std::runtime_error("Invalid number: " + std::string(text));
+    }
+    return value;
+}
+
+void notify(const int fd) {
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto written = ::write(fd, &one, sizeof(one));
+}
+}
+
+struct Server::Connection {
+    std::uint64_t id;
+    int fd;
+    std::string in;
+    std::string out;
+    std::size_t written = 0;            // сколько байт out уже отправлено
+    // Порции строк, ждущие пула. Порции одного соединения считаются по одной и по порядку:
+    // def из одной порции виден call из следующей, ответы идут в порядке запросов
+    std::deque<std::shared_ptr<std::string>> queued;
+    std::size_t queued_bytes = 0;
+    bool running = false;               // порция этого соединения сейчас в пуле
+    bool peer_closed = false;
+    bool broken = false;                // запись не удалась - соединение закрывается сразу
+    std::uint32_t watched = EPOLLIN | EPOLLRDHUP;
+    std::shared_ptr<HandleTable> handles = std::make_shared<HandleTable>(); // разделяется с порциями в пуле
+
+    std::size_t unsent() const { return out.size() - written; }
+    // Больше не читаем, пока пул и клиент не разберут накопленное
+    bool saturated() const { return in.size() + queued_bytes + unsent() >= max_buffered; }
+    bool idle() const { return !running && queued.empty() && out.empty(); }
+};
+
+// Подписка на события соединения: чтение, пока клиент пишет, запись, пока есть неотправленное
+void Server::watch(Connection &connection) {
+    const bool reading = !connection.peer_closed && !connection.saturated();
+    const std::uint32_t wanted = (reading ? static_cast<std::uint32_t>(EPOLLIN | EPOLLRDHUP) : 0)
+                                 | (connection.out.empty() ? 0 : static_cast<std::uint32_t>(EPOLLOUT));
+    if (wanted == connection.watched) return;
+    epoll_event event{};
+    event.events = wanted;
+    event.data.u64 = connection.id;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.watched = wanted;
+}
+
+Server::Server(std::string path_, const std::size_t threads) : path(std::move(path_)), pool(std::make_unique<ThreadPool>(threads)) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path is too long: " + path);
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) throw system_error("socket");
+    ::unlink(path.c_str());
+    if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        const auto error = system_error("bind " + path);
+        ::close(listen_fd);
+        throw error;
+    }
+    if (::listen(listen_fd, SOMAXCONN) < 0) {
+        const auto error = system_error("listen");
+        ::close(listen_fd);
+        throw error;
+    }
+    epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    done_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || done_fd < 0 || stop_fd < 0) {
+        const auto error = system_error("epoll");
+        for (const int fd : {listen_fd, epoll_fd, done_fd, stop_fd}) if (fd >= 0) ::close(fd);
+        throw error;
+    }
+    for (const auto &[fd, id] : {std::pair{listen_fd, listen_event}, {done_fd, done_event}, {stop_fd, stop_event}}) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+Server::~Server() {
+    pool.reset();
+    for (auto &[id, connection] : connections) ::close(connection->fd);
+    for (const int fd : {listen_fd, epoll_fd, done_fd, stop_fd}) ::close(fd);
+    ::unlink(path.c_str());
+}
+
+void Server::stop() { notify(stop_fd); }
+
+std::string Server::handle_request(const std::string_view line, HandleTable &handles) {
+    try {
+        std::string_view rest = line;
+        const auto command = take_word(rest);
+        if (command == "def") {
+            const auto entry = cache.get(trim(rest));
+            std::uint64_t handle;
+            {
+                std::unique_lock lock(handles.mutex);
+                handle = handles.next++;
+                handles.entries.emplace(handle, entry);
+            }
+            std::string result = "ok " + std::to_string(handle);
+            for (const auto &name : entry->program.get_variables()) result += ' ' + name;
+            return result;
+        }
+        if (command == "call") {
+            const auto handle = parse_number<std::uint64_t>(take_word(rest));
+            std::shared_ptr<const CompiledExpression<std::complex<double>>> entry;
+            {
+                std::shared_lock lock(handles.mutex);
+                auto it = handles.entries.find(handle);
+                if (it == handles.entries.end()) throw std::runtime_error("Unknown handle: " + std::to_string(handle));
+                entry = it->second;
+            }
+            const auto &program = entry->program;
+            thread_local std::vector<std::complex<double>> values;
+            values.clear();
+            for (auto word = take_word(rest); !word.empty(); word = take_word(rest)) values.emplace_back(parse_number<double>(word));
+            if (values.size() != program.get_variables().size()) {
+                throw std::runtime_error("Expected " + std::to_string(program.get_variables().size()) + " values");
+            }
+            return format_value(program.eval(std::span<const std::complex<double>>(values)));
+        }
+        if (command == "free") {
+            const auto handle = parse_number<std::uint64_t>(take_word(rest));
+            std::unique_lock lock(handles.mutex);
+            if (!handles.entries.erase(handle)) throw std::runtime_error("Unknown handle: " + std::to_string(handle));
+            return "ok";
+        }
+    } catch (const std::exception &e) {
+        return std::string("error: ") + e.what();
+    }
+    return process_request(line, cache);
+}
+
+void Server::accept_connections() {
+    while (true) {
+        const int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return; // EAGAIN - больше никого нет
+        const auto id = next_connection++;
+        auto connection = std::make_unique<Connection>();
+        connection->id = id;
+        connection->fd = fd;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u64 = id;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        connections.emplace(id, std::move(connection));
+        connection_count++;
+    }
+}
+
+void Server::close_connection(const std::uint64_t id) {
+    auto it = connections.find(id);
+    if (it == connections.end()) return;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->second->fd, nullptr);
+    ::close(it->second->fd);
+    connections.erase(it); // ответы пула для этого соединения будут выброшены, его handles - освобождены
+}
+
+void Server::read_connection(Connection &connection) {
+    char chunk[1 << 16];
+    while (!connection.saturated()) {
+        const auto got = ::read(connection.fd, chunk, sizeof(chunk));
+        if (got > 0) {
+            connection.in.append(chunk, static_cast<std::size_t>(got));
+            continue;
+        }
+        if (got == 0) connection.peer_closed = true;
+        if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK) connection.broken = true;
+        break; // 0 - клиент закончил писать, -1 с EAGAIN - данных пока нет
+    }
+    const auto last = connection.in.rfind('\n');
+    if (last == std::string::npos) {
+        if (connection.in.size() > max_line) {
+            connection.peer_closed = true;
+            connection.in.clear();
+        }
+        return;
+    }
+    // Все полные строки становятся одной порцией
+    auto lines = std::make_shared<std::string>(connection.in, 0, last + 1);
+    connection.in.erase(0, last + 1);
+    connection.queued_bytes += lines->size();
+    connection.queued.push_back(std::move(lines));
+    dispatch(connection);
+}
+
+// Следующая порция соединения уходит в пул, когда предыдущая закончена и клиент успевает читать ответы
+void Server::dispatch(Connection &connection) {
+    if (connection.running || connection.queued.empty() || connection.unsent() >= max_buffered) return;
+    auto lines = std::move(connection.queued.front());
+    connection.queued.pop_front();
+    connection.queued_bytes -= lines->size();
+    connection.running = true;
+    pool->submit([this, lines, handles = connection.handles, id = connection.id] {
+        std::string text;
+        std::size_t requests = 0;
+        std::string_view rest(*lines);
+        while (!rest.empty()) {
+            const auto end = rest.find('\n');
+            auto line = rest.substr(0, end);
+            rest.remove_prefix(end + 1);
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (trim(line).empty()) continue;
+            text += handle_request(line, *handles);
+            text += '\n';
+            requests++;
+        }
+        {
+            std::lock_guard lock(done_mutex);
+            done.push_back({id, std::move(text), requests});
+        }
+        notify(done_fd);
+    });
+}
+
+void Server::write_connection(Connection &connection) {
+    while (connection.written < connection.out.size()) {
+        const auto sent = ::send(connection.fd, connection.out.data() + connection.written,
+                                 connection.out.size() - connection.written, MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) connection.broken = true;
+        if (sent <= 0) break;
+        connection.written += static_cast<std::size_t>(sent);
+    }
+    if (connection.written == connection.out.size()) {
+        connection.out.clear();
+        connection.written = 0;
+    }
+    dispatch(connection); // клиент прочитал ответы - можно считать отложенные порции
+    watch(connection);
+}
+
+void Server::collect_completions() {
+    std::uint64_t counter;
+    [[maybe_unused]] const auto got = ::read(done_fd, &counter, sizeof(counter));
+    std::vector<Completion> finished;
+    {
+        std::lock_guard lock(done_mutex);
+        finished.swap(done);
+    }
+    for (auto &completion : finished) {
+        request_count += completion.requests;
+        auto it = connections.find(completion.connection);
+        if (it == connections.end()) continue;
+        auto &connection = *it->second;
+        connection.out += completion.text;
+        connection.running = false;
+        dispatch(connection);
+        write_connection(connection);
+    }
+}
+
+void Server::run() {
+    epoll_event events[64];
+    while (true) {
+        const int count = ::epoll_wait(epoll_fd, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw system_error("epoll_wait");
+        }
+        for (int i = 0; i < count; i++) {
+            const auto id = events[i].data.u64;
+            if (id == stop_event) return;
+            if (id == listen_event) {
+                accept_connections();
+                continue;
+            }
+            if (id == done_event) {
+                collect_completions();
+                continue;
+            }
+            auto it = connections.find(id);
+            if (it == connections.end()) continue;
+            auto &connection = *it->second;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                read_connection(connection);
+                watch(connection);
+            }
+            if (events[i].events & EPOLLOUT) write_connection(connection);
+            // EPOLLHUP - клиент закрыл сокет целиком, ответы доставить уже некому
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(id);
+                continue;
+            }
+        }
+        // Закрываем соединения, которые больше ничего не пришлют и которым нечего ждать
+        std::vector<std::uint64_t> finished;
+        for (const auto &[id, connection] : connections) {
+            if (connection->broken || (connection->peer_closed && connection->idle())) {
+                finished.push_back(id);
+            }
+        }
+        for (const auto id : finished) close_connection(id);
+    }
+}
+
+namespace {
+Server *active_server = nullptr;
+
+void stop_active_server(int) {
+    if (active_server) active_server->stop();
+}
+}
+
+int serve_command(const int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: differentiator --serve <socket> [--threads N]" << std::endl;
+        return 1;
+    }
+    std::size_t threads = std::thread::hardware_concurrency();
+    try {
+        for (int i = 3; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--threads" && i + 1 < argc) {
+                threads = parse_number<std::size_t>(argv[++i]);
+            } else {
+                throw std::runtime_error("Unknown argument: " + arg);
+            }
+        }
+        Server server(argv[2], threads);
+        active_server = &server;
+        std::signal(SIGINT, stop_active_server);
+        std::signal(SIGTERM, stop_active_server);
+        std::cerr << "Listening on " << argv[2] << std::endl;
+        server.run();
+        active_server = nullptr;
+        const auto stats = server.stats();
+        std::cerr << "connections: " << stats.connections << ", requests: " << stats.requests << std::endl;
+    } catch (const std::exception &e) {
+        active_server = nullptr;
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
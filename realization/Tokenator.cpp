@@ -1,92 +1,104 @@
 #include "Tokenator.h"
+#include "Profile.h"
+#include <cctype>
 #include <iostream>
+#include <stdexcept>
 
-std::string lower(const std::string& str) {
-    std::string res(str);
-    for (char& c : res) {
-        c = static_cast<char>(std::tolower(c));
+namespace {
+bool is_digit(const char c) { return std::isdigit(static_cast<unsigned char>(c)); }
+bool is_alpha(const char c) { return std::isalpha(static_cast<unsigned char>(c)); }
+bool is_space(const char c) { return std::isspace(static_cast<unsigned char>(c)); }
+
+// Сравнение без учета регистра, без копирования имени
+bool equals_lower(const std::string_view name, const std::string_view lower) {
+    if (name.size() != lower.size()) return false;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (std::tolower(static_cast<unsigned char>(name[i])) != lower[i]) return false;
     }
-    return res;
+    return true;
 }
 
-std::vector<Token> tokenize(const std::string &input_) {
-    auto input = '#' + input_;
-    std::vector<Token> tokens;
-    size_t i = 0;
-
-    while (i < input.size()) {
-        char c = input[i];
-
-        if (std::isspace(c)) {
-            i++;
-            continue;
-        }
-        if (c == '#') {
-            tokens.emplace_back(START, "#");
-            i++;
-            continue;
-        }
-        if (isdigit(c) || c == '.') {
-            std::string numStr;
-            while (i < input.size() && (std::isdigit(input[i]) || input[i] == '.')) {
-                numStr += input[i];
-                i++;
-            }
-            tokens.emplace_back(NUMBER, numStr);
-            continue;
+bool find_function(const std::string_view name, Function &func) {
+    static constexpr std::pair<std::string_view, Function> functions[] = {{"sin", SIN}, {"cos", COS}, {"ln", LN}, {"exp", EXP}};
+    for (const auto &[text, f] : functions) {
+        if (equals_lower(name, text)) {
+            func = f;
+            return true;
         }
+    }
+    return false;
+}
+}
 
-        if (c == 'i') {
-            if (!tokens.empty() && tokens.back().type == NUMBER) {
-                tokens.back().type = COMPLEX;
-            } else {
-                if (!tokens.empty() && tokens.back().type == RIGHT_PAREN)
-                    tokens.emplace_back(OPERATOR, "*");
-                tokens.emplace_back(COMPLEX, "1");
-            }
-            i++;
-            continue;
-        }
+bool Lexer::next(Token &token) {
+    if (pending) {
+        const Token value = *pending;
+        pending.reset();
+        return emit(token, value);
+    }
+    while (pos < input.size() && is_space(input[pos])) pos++;
+    if (pos >= input.size()) return false;
+    const char c = input[pos];
 
-        if (std::isalpha(c)) {
-            std::string name;
-            while (i < input.size() && std::isalpha(input[i])) {
-                name += input[i];
-                i++;
-            }
-            name = lower(name);
-            if (name == "sin" || name == "cos" || name == "ln" || name == "exp") {
-                tokens.emplace_back(FUNCTION, name);
-            } else {
-                tokens.emplace_back(VARIABLE, name);
-            }
-            continue;
+    if (is_digit(c) || c == '.') {
+        const size_t start = pos;
+        while (pos < input.size() && (is_digit(input[pos]) || input[pos] == '.')) pos++;
+        const auto text = input.substr(start, pos - start);
+        // i после числа (в том числе через пробелы) делает его мнимым
+        size_t after = pos;
+        while (after < input.size() && is_space(input[after])) after++;
+        if (after < input.size() && input[after] == 'i') {
+            pos = after + 1;
+            return emit(token, Token(COMPLEX, text));
         }
+        return emit(token, Token(NUMBER, text));
+    }
 
-        if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^') {
-            if (c == '-') {
-                if (!tokens.empty() && (tokens.back().type == LEFT_PAREN || tokens.back().type == START)) {
-                    tokens.emplace_back(NUMBER, "0");
-                }
-            }
-            tokens.emplace_back(OPERATOR, std::string(1, c));
-            i++;
-            continue;
+    if (c == 'i') {
+        pos++;
+        if (previous == RIGHT_PAREN) {
+            pending.emplace(COMPLEX, "1");
+            return emit(token, Token(OPERATOR, "*", MULT));
         }
+        return emit(token, Token(COMPLEX, "1"));
+    }
 
-        if (c == '(') {
-            tokens.emplace_back(LEFT_PAREN, "(");
-            i++;
-            continue;
-        }
-        if (c == ')') {
-            tokens.emplace_back(RIGHT_PAREN, ")");
-            i++;
-            continue;
-        }
-        throw std::runtime_error("Unknown character: " + std::string(1, c));
+    if (is_alpha(c)) {
+        const size_t start = pos;
+        while (pos < input.size() && is_alpha(input[pos])) pos++;
+        const auto name = input.substr(start, pos - start);
+        Function func;
+        if (find_function(name, func)) return emit(token, Token(FUNCTION, name, func));
+        return emit(token, Token(VARIABLE, name));
+    }
+
+    Operation op;
+    switch (c) {
+        case '+': op = PLUS; break;
+        case '-': op = MINUS; break;
+        case '*': op = MULT; break;
+        case '/': op = DIV; break;
+        case '^': op = POW; break;
+        case '(': return emit(token, Token(LEFT_PAREN, input.substr(pos++, 1)));
+        case ')': return emit(token, Token(RIGHT_PAREN, input.substr(pos++, 1)));
+        default: throw std::runtime_error("Unknown character: " + std::string(1, c));
     }
-    tokens.erase(tokens.begin());
+    const Token result(OPERATOR, input.substr(pos++, 1), op);
+    // Унарный минус в начале строки или после '(' превращается в 0 - ...
+    if (op == MINUS && (previous == START || previous == LEFT_PAREN)) {
+        pending = result;
+        return emit(token, Token(NUMBER, "0"));
+    }
+    return emit(token, result);
+}
+
+std::vector<Token> tokenize(const std::string_view input) {
+    PhaseTimer timer(PHASE_TOKENIZE);
+    std::vector<Token> tokens;
+    tokens.reserve(input.size() + 1);
+    Lexer lexer(input);
+    Token token(START, {});
+    while (lexer.next(token)) tokens.push_back(token);
     return tokens;
 }
 
@@ -103,4 +115,4 @@ void printTokens(std::vector<Token> &tokens) {
             case START: std::cout << "START: " << token.value << std::endl; break; // добавкой
         }
     }
-}
\ No newline at end of file
+}
@@ -2,6 +2,33 @@
 #include "Expression.h"
 #include "Tokenator.h"
 #include "Parser.h"
+#include "Program.h"
+#include "Batch.h"
+#include "Parallel.h"
+#include "Gradient.h"
+#include "Dual.h"
+#include "Jacobian.h"
+#include "Simplify.h"
+#include "EGraph.h"
+#include "ExpressionCache.h"
+#include "Cli.h"
+#include "Serialize.h"
+#include "Jit.h"
+#include "Codegen.h"
+#include "StaticExpression.h"
+#include "generated_model.h"
+#include "generated_complex_model.h"
+#include <charconv>
+#include <cstring>
+#include <random>
+#include <sstream>
+#ifdef __linux__
+#include "Server.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <thread>
 
 bool diff_double(const std::string &input, const std::string &expected, std::string by) {
     auto tokens = tokenize(input);
@@ -36,7 +63,7 @@ TEST_CASE("Дифференцирование") {
         CHECK(diff_double("x / (x^2 + 1)", "((((x^2) + 1) - (x * (2 * (x^1)))) / (((x^2) + 1)^2))", "x"));
         CHECK(diff_double("exp(2 * x)", "(exp(2 * x) * 2)", "x"));
         CHECK(diff_double("ln(x^2 + 1)", "((2 * (x^1)) / ((x^2) + 1))", "x"));
-        CHECK(diff_double("x^x", "(ln(x) + (x * (1 / x)))", "x"));
+        CHECK(diff_double("x^x", "((x^x) * (ln(x) + (x * (1 / x))))", "x"));
         CHECK(diff_double("sin(x^2)", "(cos(x^2) * (2 * (x^1)))", "x"));
         CHECK(diff_double("cos(ln(x))", "(((-1) * sin(ln(x))) * (1 / x))", "x"));
         CHECK(diff_double("exp(x) * sin(x)", "((exp(x) * sin(x)) + (exp(x) * cos(x)))", "x"));
@@ -191,4 +218,1435 @@ TEST_CASE("Распознание") {
         CHECK(scan_complex("exp(a * b)", "exp(a * b)"));
         CHECK(scan_complex("(1.2 + sin(3.4)) * i", "((1.200000 + sin(3.400000)) * 1i)"));
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Токенизатор") {
+    const std::string input = "-SIN(x) + Exp(2.5i) * (y)i";
+    auto tokens = tokenize(input);
+    REQUIRE(tokens.size() == 17);
+    // Токены указывают во входную строку, вставленные - на статические строки
+    CHECK(tokens[0].type == NUMBER);
+    CHECK(tokens[0].value == "0");
+    CHECK(tokens[1].type == OPERATOR);
+    CHECK(tokens[1].operation() == MINUS);
+    CHECK(tokens[1].value.data() == input.data());
+    CHECK(tokens[2].type == FUNCTION);
+    CHECK(tokens[2].function() == SIN);
+    CHECK(tokens[2].value == "SIN");
+    CHECK(tokens[2].value.data() == input.data() + 1);
+    CHECK(tokens[7].function() == EXP);
+    CHECK(tokens[9].type == COMPLEX);
+    CHECK(tokens[9].value == "2.5");
+    CHECK(tokens[11].operation() == MULT);
+    CHECK(tokens[15].operation() == MULT);
+    CHECK(tokens[15].value == "*");
+    CHECK(tokens[16].type == COMPLEX);
+    CHECK(scan_complex("-SIN(X) + Exp(2.5i) * (Y)i", "((0 - sin(x)) + ((exp(2.500000i) * y) * 1i))"));
+    CHECK_THROWS(tokenize("x % y"));
+    CHECK_THROWS(scan_double("x + .", ""));
+}
+
+TEST_CASE("Потоковый разбор") {
+    for (const auto *input : {"sin(x) + cos(y) * ln(z)", "exp(a) - b * c / d", "x ^ y ^ z", "-(x - (-y))", "sin x * 2",
+                              "sin(cos(ln(exp(x))))", "(1.2 + sin(3.4)) * i", "2.5 - 1.7 i", "a / b ^ c"}) {
+        auto tokens = tokenize(input);
+        Parser<std::complex<double>> from_tokens(tokens);
+        Parser<std::complex<double>> from_text{std::string_view(input)};
+        CHECK(from_text.parse()->to_string() == from_tokens.parse()->to_string());
+    }
+    SECTION("Ошибки") {
+        auto error = [](const char *input) {
+            try {
+                Parser<double>{std::string_view(input)}.parse();
+            } catch (const std::runtime_error &e) {
+                return std::string(e.what());
+            }
+            return std::string();
+        };
+        CHECK(error("") == "Unexpected end of input in parsePrimary");
+        CHECK(error("x +") == "Unexpected end of input in parsePrimary");
+        CHECK(error("(x + y") == "Expected ')'");
+        CHECK(error("x + y)") == "Extra ')'");
+        CHECK(error("x y") == "Expected operation");
+        CHECK(error("x * * y") == "Unexpected token: *");
+        CHECK(error("x $ y") == "Unknown character: $");
+    }
+    SECTION("Глубокие выражения") {
+        // Около мегабайта: x + x + ... (левая цепочка глубиной 250000)
+        std::string sum = "x";
+        for (int i = 0; i < 250000; i++) sum += " + x";
+        auto expr = Parser<double>(std::string_view(sum)).parse();
+        std::size_t depth = 0;
+        for (auto node = expr; node->kind() == BINARY_NODE; node = static_cast<const BinaryExpression<double> &>(*node).get_left()) depth++;
+        CHECK(depth == 250000);
+        expr.reset();
+
+        std::string nested;
+        for (int i = 0; i < 100000; i++) nested += "sin((";
+        nested += "x";
+        for (int i = 0; i < 100000; i++) nested += "))";
+        expr = Parser<double>(std::string_view(nested)).parse();
+        CHECK(expr->kind() == MONO_NODE);
+        expr.reset();
+    }
+}
+
+bool compile_double(const std::string &input, const std::map<std::string, double> &params) {
+    auto tokens = tokenize(input);
+    Parser<double> parser(tokens);
+    auto expr = parser.parse();
+    auto program = compile(expr);
+    auto tmp = params;
+    auto expected = expr->eval(tmp);
+    auto values = program.bind(params);
+    auto result = program.eval(values);
+    std::cout << input << " = " << result << " || " << expected << " (expected)" << std::endl;
+    return result == expected;
+}
+
+bool compile_complex(const std::string &input, const std::map<std::string, std::complex<double>> &params) {
+    auto tokens = tokenize(input);
+    Parser<std::complex<double>> parser(tokens);
+    auto expr = parser.parse();
+    auto program = compile(expr);
+    auto tmp = params;
+    auto expected = expr->eval(tmp);
+    auto values = program.bind(params);
+    auto result = program.eval(values);
+    std::cout << input << " = " << result << " || " << expected << " (expected)" << std::endl;
+    return result == expected;
+}
+
+TEST_CASE("Компиляция") {
+    SECTION("DOUBLE") {
+        CHECK(compile_double("x + y", {{"x", 5}, {"y", 7}}));
+        CHECK(compile_double("x / y", {{"x", 5}, {"y", 7}}));
+        CHECK(compile_double("(a + b) * (c - d) / e", {{"a", 6}, {"b", 2}, {"c", 10}, {"d", 4}, {"e", 4}}));
+        CHECK(compile_double("sin(x) + cos(y) * ln(z) - exp(x ^ y)", {{"x", 0.5}, {"y", 1.5}, {"z", 3}}));
+        CHECK(compile_double("x * x * x + 2 * x * y - y / x", {{"x", 1.25}, {"y", -3}}));
+        CHECK(compile_double("3", {}));
+
+        auto tokens = tokenize("x / (y - y)");
+        Parser<double> parser(tokens);
+        auto program = compile(parser.parse());
+        CHECK(program.get_variables() == std::vector<std::string>{"x", "y"});
+        CHECK(program.slot("y") == 1);
+        CHECK_THROWS(program.slot("z"));
+        std::vector<double> values{1, 2};
+        CHECK_THROWS(program.eval(values));
+    }
+    SECTION("COMPLEX") {
+        CHECK(compile_complex("x * y * i", {{"x", to_cm(2, 1)}, {"y", to_cm(1, 2)}}));
+        CHECK(compile_complex("(x + y) ^ (a - b)", {{"x", to_cm(1, 1)}, {"y", to_cm(1, 2)}, {"a", to_cm(2, 0)}, {"b", to_cm(1, 1)}}));
+        CHECK(compile_complex("exp(i * x) * sin(x) / ln(x)", {{"x", to_cm(2, 3)}}));
+    }
+    SECTION("REGISTERS") {
+        // Длинная цепочка сложений не должна требовать регистра на каждый узел
+        std::string input = "x";
+        for (int i = 0; i < 200; i++) input += " + x";
+        auto tokens = tokenize(input);
+        Parser<double> parser(tokens);
+        auto program = compile(parser.parse());
+        CHECK(program.get_registers() <= 2);
+        std::vector<double> values{0.5};
+        CHECK(program.eval(values) == 100.5);
+    }
+}
+
+template <typename T>
+bool batch_matches(const std::string &input, const std::map<std::string, std::vector<T>> &columns, std::size_t n) {
+    auto tokens = tokenize(input);
+    Parser<T> parser(tokens);
+    auto expr = parser.parse();
+    std::map<std::string, std::span<const T>> named;
+    for (const auto &[name, column] : columns) named[name] = column;
+    std::vector<T> out(n);
+    eval_batch(expr, named, std::span<T>(out));
+    for (std::size_t i = 0; i < n; i++) {
+        std::map<std::string, T> params;
+        for (const auto &[name, column] : columns) params[name] = column[i];
+        if (expr->eval(params) != out[i]) {
+            std::cout << input << " differs at point " << i << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("Пакетный подсчет") {
+    const std::size_t n = 1000; // несколько блоков и неполный хвост
+    SECTION("DOUBLE") {
+        std::vector<double> x(n), y(n);
+        for (std::size_t i = 0; i < n; i++) {
+            x[i] = 0.01 * static_cast<double>(i) + 0.5;
+            y[i] = 2.0 - 0.003 * static_cast<double>(i);
+        }
+        CHECK(batch_matches<double>("x + y * 3 - x / y", {{"x", x}, {"y", y}}, n));
+        CHECK(batch_matches<double>("sin(x) * cos(y) + exp(-x) - ln(x)", {{"x", x}, {"y", y}}, n));
+        CHECK(batch_matches<double>("x ^ y + 2 ^ x", {{"x", x}, {"y", y}}, n));
+
+        std::vector<double> zeros(n, 0.0);
+        auto tokens = tokenize("1 / x");
+        Parser<double> parser(tokens);
+        std::vector<double> out(n);
+        CHECK_THROWS(eval_batch(parser.parse(), {{"x", std::span<const double>(zeros)}}, std::span<double>(out)));
+    }
+    SECTION("COMPLEX") {
+        std::vector<std::complex<double>> x(n), y(n);
+        for (std::size_t i = 0; i < n; i++) {
+            x[i] = to_cm(0.01 * static_cast<double>(i) + 0.5, 1.0 - 0.002 * static_cast<double>(i));
+            y[i] = to_cm(2.0 - 0.003 * static_cast<double>(i), 0.25);
+        }
+        CHECK(batch_matches<std::complex<double>>("x + y * i - x / y", {{"x", x}, {"y", y}}, n));
+        CHECK(batch_matches<std::complex<double>>("sin(x) * cos(y) + exp(i * x) - ln(x)", {{"x", x}, {"y", y}}, n));
+
+        // Бесконечности и переполнение: умножение как у std::complex, а не по формуле (ac - bd, ad + bc)
+        const double inf = std::numeric_limits<double>::infinity();
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        const std::vector<std::complex<double>> special{to_cm(inf, inf), to_cm(inf, 0), to_cm(0, inf), to_cm(-inf, 1),
+                                                        to_cm(nan, inf), to_cm(1e300, 1e300), to_cm(1, 0), to_cm(0.5, -2)};
+        std::vector<std::complex<double>> u, v;
+        for (const auto a : special) {
+            for (const auto b : special) {
+                u.push_back(a);
+                v.push_back(b);
+            }
+        }
+        auto product = Parser<std::complex<double>>(std::string_view("u * v + u")).parse();
+        std::vector<std::complex<double>> batch(u.size());
+        eval_batch(product, {{"u", std::span<const std::complex<double>>(u)}, {"v", std::span<const std::complex<double>>(v)}},
+                   std::span<std::complex<double>>(batch));
+        auto same = [](const double p, const double q) { return p == q || (std::isnan(p) && std::isnan(q)); };
+        for (std::size_t i = 0; i < u.size(); i++) {
+            const auto scalar = product->eval(std::map<std::string, std::complex<double>>{{"u", u[i]}, {"v", v[i]}});
+            CHECK(same(batch[i].real(), scalar.real()));
+            CHECK(same(batch[i].imag(), scalar.imag()));
+        }
+        // (inf, inf) * (1, 0) + (inf, inf)
+        CHECK(std::isinf(batch[6].real()));
+        CHECK(std::isinf(batch[6].imag()));
+        CHECK(batch_matches<std::complex<double>>("x ^ y", {{"x", x}, {"y", y}}, n));
+    }
+}
+
+TEST_CASE("Параллельный подсчет") {
+    const std::size_t n = 100000;
+    std::vector<double> x(n), y(n);
+    for (std::size_t i = 0; i < n; i++) {
+        x[i] = 0.0001 * static_cast<double>(i) + 0.5;
+        y[i] = std::cos(static_cast<double>(i));
+    }
+    auto tokens = tokenize("sin(x) * y + x ^ 2 / (y + 3) - ln(x)");
+    Parser<double> parser(tokens);
+    auto expr = parser.parse();
+    auto program = compile(expr);
+    std::vector<std::span<const double>> columns{x, y};
+
+    std::vector<double> expected(n), out(n);
+    eval_batch(program, std::span<const std::span<const double>>(columns), std::span<double>(expected));
+    ThreadPool pool(4);
+    eval_parallel(program, std::span<const std::span<const double>>(columns), std::span<double>(out), pool);
+    CHECK(out == expected);
+
+    SECTION("Ошибка в одном из кусков") {
+        std::vector<double> shifted = y;
+        shifted[n / 2] = -3;
+        std::vector<std::span<const double>> bad{x, shifted};
+        CHECK_THROWS(eval_parallel(program, std::span<const std::span<const double>>(bad), std::span<double>(out), pool));
+    }
+    SECTION("Вызов из задачи пула") {
+        // Все потоки пула заняты вызовами eval_parallel: куски считают сами вызывающие
+        ThreadPool single(1);
+        std::vector<std::vector<double>> results(3, std::vector<double>(n));
+        std::latch finished(static_cast<std::ptrdiff_t>(results.size()));
+        for (auto &result : results) {
+            single.submit([&] {
+                eval_parallel(program, std::span<const std::span<const double>>(columns), std::span<double>(result), single);
+                finished.count_down();
+            });
+        }
+        finished.wait();
+        for (const auto &result : results) CHECK(result == expected);
+    }
+    SECTION("Общее дерево из нескольких потоков") {
+        std::vector<double> results(8);
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < results.size(); t++) {
+            threads.emplace_back([&, t] {
+                const std::map<std::string, double> params{{"x", x[t]}, {"y", y[t]}};
+                results[t] = expr->eval(params);
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        for (std::size_t t = 0; t < results.size(); t++) CHECK(results[t] == expected[t]);
+    }
+}
+
+TEST_CASE("Арена") {
+    ExpressionArena arena;
+    std::string by = "x";
+    std::string heap, pooled;
+    {
+        auto tokens = tokenize("ln(x) / x^3 + exp(x) * sin(x)");
+        Parser<double> parser(tokens);
+        heap = optimize(parser.parse()->diff(by))->to_string();
+    }
+    {
+        ArenaScope scope(arena);
+        auto tokens = tokenize("ln(x) / x^3 + exp(x) * sin(x)");
+        Parser<double> parser(tokens);
+        auto expr = parser.parse();
+        auto parsed = arena.node_count();
+        CHECK(parsed == 12);
+        auto diffExpr = optimize(expr->diff(by));
+        CHECK(arena.node_count() > parsed);
+        pooled = diffExpr->to_string();
+    }
+    CHECK(heap == pooled);
+    CHECK(ExpressionArena::current() == nullptr);
+}
+
+template <typename T>
+std::size_t count_nodes(const std::shared_ptr<Expression<T>> &expr) {
+    switch (expr->kind()) {
+        case MONO_NODE: return 1 + count_nodes(std::static_pointer_cast<MonoExpression<T>>(expr)->get_arg());
+        case BINARY_NODE: {
+            auto binary = std::static_pointer_cast<BinaryExpression<T>>(expr);
+            return 1 + count_nodes(binary->get_left()) + count_nodes(binary->get_right());
+        }
+        default: return 1;
+    }
+}
+
+TEST_CASE("Уникальные узлы") {
+    std::string by = "x";
+    SECTION("DOUBLE") {
+        HashConsTable<double> table;
+        HashConsScope<double> scope(table);
+        auto tokens = tokenize("sin(x) * sin(x) + sin(x)");
+        Parser<double> parser(tokens);
+        auto expr = parser.parse();
+        auto sum = std::static_pointer_cast<BinaryExpression<double>>(expr);
+        auto product = std::static_pointer_cast<BinaryExpression<double>>(sum->get_left());
+        CHECK(product->get_left() == product->get_right());
+        CHECK(product->get_left() == sum->get_right());
+        CHECK(table.size() == 4); // x, sin(x), sin(x) * sin(x), сумма
+
+        // Вторая производная: дерево растет, а уникальных узлов намного меньше
+        HashConsTable<double> second_table;
+        HashConsScope<double> second_scope(second_table);
+        auto tokens2 = tokenize("exp(x) * sin(x)");
+        Parser<double> parser2(tokens2);
+        auto second = optimize(optimize(parser2.parse()->diff(by))->diff(by));
+        CHECK(second_table.size() < count_nodes(second));
+        CHECK(second_table.hit_count() > 0);
+    }
+    SECTION("Тот же результат, что и без таблицы") {
+        std::string plain;
+        {
+            auto tokens = tokenize("ln(x) / x^3 + x^x");
+            Parser<double> parser(tokens);
+            plain = optimize(parser.parse()->diff(by))->to_string();
+        }
+        HashConsTable<double> table;
+        HashConsScope<double> scope(table);
+        auto tokens = tokenize("ln(x) / x^3 + x^x");
+        Parser<double> parser(tokens);
+        CHECK(optimize(parser.parse()->diff(by))->to_string() == plain);
+    }
+    SECTION("COMPLEX") {
+        HashConsTable<std::complex<double>> table;
+        HashConsScope<std::complex<double>> scope(table);
+        auto tokens = tokenize("(1 + 2i) * x + (1 + 2i)");
+        Parser<std::complex<double>> parser(tokens);
+        auto expr = parser.parse();
+        CHECK(table.hit_count() == 3); // вторая скобка (1, 2i и их сумма) целиком берется из таблицы
+        auto sum = std::static_pointer_cast<BinaryExpression<std::complex<double>>>(expr);
+        auto product = std::static_pointer_cast<BinaryExpression<std::complex<double>>>(sum->get_left());
+        CHECK(product->get_left() == sum->get_right());
+        CHECK(make_constant<std::complex<double>>(to_cm(0, 2)) == make_constant<std::complex<double>>(to_cm(0, 2)));
+    }
+}
+
+TEST_CASE("Общие подвыражения") {
+    std::string by = "x";
+    SECTION("DOUBLE") {
+        auto tokens = tokenize("exp(x) * sin(x)");
+        Parser<double> parser(tokens);
+        auto f = parser.parse();
+        auto df = optimize(f->diff(by));
+        auto program = compile(df);
+        // ((exp(x) * sin(x)) + (exp(x) * cos(x))): второй exp(x) и все повторы x не попадают в программу
+        CHECK(program.get_eliminated() == 4);
+        CHECK(program.get_code().size() == 7);
+
+        const std::map<std::string, double> params{{"x", 0.7}};
+        auto values = program.bind(params);
+        CHECK(program.eval(values) == df->eval(params));
+
+        // f и f' вместе стоят немногим больше, чем f' отдельно
+        auto both = compile(std::vector{f, df});
+        CHECK(both.get_code().size() == program.get_code().size());
+        std::vector<double> out(2), scratch(both.get_registers());
+        both.eval(values, out, scratch);
+        CHECK(out[0] == f->eval(params));
+        CHECK(out[1] == df->eval(params));
+
+        auto plain = compile(df, CompileOptions{.eliminate_common = false});
+        CHECK(plain.get_eliminated() == 0);
+        CHECK(plain.get_code().size() == 11);
+        CHECK(plain.eval(values) == df->eval(params));
+    }
+    SECTION("COMPLEX") {
+        auto tokens = tokenize("(x + i) * (i + x) / (x + i)");
+        Parser<std::complex<double>> parser(tokens);
+        auto expr = parser.parse();
+        auto program = compile(expr);
+        CHECK(program.get_code().size() == 5); // x, i, x + i, произведение, частное
+        const std::map<std::string, std::complex<double>> params{{"x", to_cm(1, 2)}};
+        auto values = program.bind(params);
+        CHECK(program.eval(values) == expr->eval(params));
+    }
+}
+
+template <typename T>
+bool close(const T &a, const T &b) {
+    return std::abs(a - b) <= 1e-12 * std::max(1.0, std::abs(b));
+}
+
+// Градиент за один проход против diff по каждой переменной
+template <typename T>
+bool gradient_matches(const std::string &input, const std::map<std::string, T> &params) {
+    auto tokens = tokenize(input);
+    Parser<T> parser(tokens);
+    auto expr = parser.parse();
+    Gradient<T> gradient(expr);
+    auto values = gradient.get_program().bind(params);
+    std::vector<T> grad(gradient.get_variables().size());
+    const T value = gradient.eval(values, grad);
+    bool ok = value == expr->eval(params);
+    for (std::size_t i = 0; i < grad.size(); i++) {
+        std::string by = gradient.get_variables()[i];
+        const T expected = optimize(expr->diff(by))->eval(params);
+        std::cout << "d/d" << by << "(" << input << ") = " << grad[i] << " || " << expected << " (expected)" << std::endl;
+        ok = ok && close(grad[i], expected);
+    }
+    return ok;
+}
+
+TEST_CASE("Градиент") {
+    SECTION("DOUBLE") {
+        CHECK(gradient_matches<double>("x * y + sin(x) * cos(y)", {{"x", 0.3}, {"y", 1.7}}));
+        CHECK(gradient_matches<double>("exp(x * y) / (x + y) - ln(z)", {{"x", 0.3}, {"y", 1.7}, {"z", 2.5}}));
+        CHECK(gradient_matches<double>("x^3 + 2^y", {{"x", 1.3}, {"y", 0.4}}));
+        CHECK(gradient_matches<double>("(x - 2)^2 * (x - 2)", {{"x", -1.5}}));
+        CHECK(gradient_matches<double>("a * a * a - b / a", {{"a", 2}, {"b", 3}}));
+    }
+    SECTION("COMPLEX") {
+        CHECK(gradient_matches<std::complex<double>>("x * y + sin(x) * cos(y)", {{"x", to_cm(0.3, 1)}, {"y", to_cm(1.7, -0.5)}}));
+        CHECK(gradient_matches<std::complex<double>>("exp(i * x) / (x + y) - ln(x)", {{"x", to_cm(0.3, 1)}, {"y", to_cm(1.7, -0.5)}}));
+    }
+    SECTION("f^g") {
+        auto tokens = tokenize("x^y");
+        Parser<double> parser(tokens);
+        Gradient<double> gradient(parser.parse());
+        std::vector<double> values{1.3, 0.4}, grad(2);
+        CHECK(gradient.eval(values, grad) == std::pow(1.3, 0.4));
+        CHECK(close(grad[0], 0.4 * std::pow(1.3, -0.6)));
+        CHECK(close(grad[1], std::pow(1.3, 0.4) * std::log(1.3)));
+    }
+    SECTION("Константная часть не дифференцируется") {
+        auto tokens = tokenize("(0 - 2)^x + y^2");
+        Parser<double> parser(tokens);
+        Gradient<double> gradient(parser.parse());
+        std::vector<double> values{0.5, 3}, grad(2);
+        gradient.eval(values, grad);
+        CHECK(std::isnan(grad[0])); // ln(-2) действительно входит в производную по x
+        CHECK(grad[1] == 6);
+    }
+}
+
+// f и f' на дуальных числах против символьного diff
+template <typename T>
+bool dual_matches(const std::string &input, const std::map<std::string, T> &params, std::string by) {
+    auto tokens = tokenize(input);
+    Parser<T> parser(tokens);
+    auto expr = parser.parse();
+    const auto expected = optimize(expr->diff(by))->eval(params);
+    const auto tree = eval_dual(*expr, params, by);
+    auto program = compile(expr);
+    std::vector<Dual<T>> regs(program.get_registers());
+    auto values = program.bind(params);
+    const auto compiled = eval_dual(program, std::span<const T>(values), program.slot(by), std::span<Dual<T>>(regs));
+    std::cout << "d/d" << by << "(" << input << ") = " << tree.derivative << " || " << expected << " (expected)" << std::endl;
+    return tree.value == expr->eval(params) && close(tree.derivative, expected)
+           && compiled.value == tree.value && compiled.derivative == tree.derivative;
+}
+
+TEST_CASE("Дуальные числа") {
+    SECTION("DOUBLE") {
+        CHECK(dual_matches<double>("x^5 - 3 * x^3 + 2 * x", {{"x", 1.1}}, "x"));
+        CHECK(dual_matches<double>("x / (x^2 + 1)", {{"x", 0.4}}, "x"));
+        CHECK(dual_matches<double>("x^x", {{"x", 1.7}}, "x"));
+        CHECK(dual_matches<double>("(2 * x)^y", {{"x", 1.7}, {"y", 2.5}}, "y"));
+        CHECK(dual_matches<double>("x^0.5 + x^(0 - 2) + (3 * x)^1", {{"x", 1.7}}, "x"));
+        CHECK(dual_matches<double>("2^(x * x)", {{"x", 0.3}}, "x"));
+        CHECK(dual_matches<double>("cos(ln(x)) * exp(x) / sin(x)", {{"x", 0.9}}, "x"));
+        CHECK(dual_matches<double>("x * y + sin(x * y)", {{"x", 0.9}, {"y", -2}}, "y"));
+    }
+    SECTION("COMPLEX") {
+        CHECK(dual_matches<std::complex<double>>("exp(i * x) * sin(x)", {{"x", to_cm(0.5, 0.2)}}, "x"));
+        CHECK(dual_matches<std::complex<double>>("(x - i) / (x + i)", {{"x", to_cm(0.5, 0.2)}}, "x"));
+        CHECK(dual_matches<std::complex<double>>("x^2 + x^x + i^x", {{"x", to_cm(0.5, 0.2)}}, "x"));
+    }
+    SECTION("Пакетно") {
+        auto tokens = tokenize("x * sin(y)");
+        Parser<double> parser(tokens);
+        auto program = compile(parser.parse());
+        std::vector<double> x{1, 2, 3}, y{0.1, 0.2, 0.3}, values(3), derivatives(3);
+        std::vector<std::span<const double>> columns{x, y};
+        eval_dual_batch(program, std::span<const std::span<const double>>(columns), program.slot("y"),
+                        std::span<double>(values), std::span<double>(derivatives));
+        for (std::size_t i = 0; i < 3; i++) {
+            CHECK(values[i] == x[i] * std::sin(y[i]));
+            CHECK(derivatives[i] == x[i] * std::cos(y[i]));
+        }
+    }
+}
+
+TEST_CASE("Якобиан и гессиан") {
+    auto parse = [](const std::string &input) {
+        auto tokens = tokenize(input);
+        Parser<double> parser(tokens);
+        return parser.parse();
+    };
+    const std::map<std::string, double> params{{"x", 0.7}, {"y", -1.3}, {"z", 2}};
+    SECTION("Якобиан") {
+        std::vector<std::shared_ptr<Expression<double>>> system{parse("x * y + exp(x)"), parse("sin(x * y) + z"), parse("y^2")};
+        auto matrix = jacobian(system, {"x", "y", "z"});
+        CHECK(matrix.rows == 3);
+        CHECK(matrix.cols == 3);
+        // d/dz первых двух строк: 0, 1; d/dx и d/dz третьей: 0
+        CHECK(matrix.nonzeros.size() == 6);
+        auto values = matrix.program.bind(params);
+        std::vector<double> dense(9);
+        matrix.eval(values, dense);
+        for (std::size_t i = 0; i < 3; i++) {
+            for (std::size_t j = 0; j < 3; j++) {
+                CHECK(dense[i * 3 + j] == matrix.entries[i][j]->eval(params));
+            }
+        }
+        CHECK(dense[0] == 0.7 * 0 + -1.3 + std::exp(0.7));
+        CHECK(dense[2] == 0);
+        // cos(x * y) - общий узел производных второй строки по x и по y
+        CHECK(matrix.program.get_eliminated() > 0);
+    }
+    SECTION("Гессиан") {
+        auto matrix = hessian(parse("x^3 * y + sin(x) * exp(y) + z"), {"x", "y", "z"});
+        CHECK(matrix.entries[0][1] == matrix.entries[1][0]);
+        CHECK(matrix.nonzeros.size() == 4); // xx, xy, yx, yy; все по z - нули
+        auto values = matrix.program.bind(params);
+        std::vector<double> dense(9);
+        matrix.eval(values, dense);
+        CHECK(close(dense[0], 6 * 0.7 * -1.3 - std::sin(0.7) * std::exp(-1.3)));
+        CHECK(close(dense[1], 3 * 0.7 * 0.7 + std::cos(0.7) * std::exp(-1.3)));
+        CHECK(dense[1] == dense[3]);
+        CHECK(dense[8] == 0);
+    }
+}
+
+bool simplify_double(const std::string &input, const std::string &expected, std::string by) {
+    auto tokens = tokenize(input);
+    Parser<double> parser(tokens);
+    auto diffExpr = simplify(parser.parse()->diff(by));
+    std::cout << "d/d" << by << "(" << input << ") = " << diffExpr->to_string();
+    std::cout << " || " << expected << " (expected)"<< std::endl;
+    return diffExpr->to_string() == expected;
+}
+
+bool simplify_complex(const std::string &input, const std::string &expected, std::string by) {
+    auto tokens = tokenize(input);
+    Parser<std::complex<double>> parser(tokens);
+    auto diffExpr = simplify(parser.parse()->diff(by));
+    std::cout << "d/d" << by << "(" << input << ") = " << diffExpr->to_string();
+    std::cout << " || " << expected << " (expected)"<< std::endl;
+    return diffExpr->to_string() == expected;
+}
+
+// simplify не больше optimize по числу узлов и дает то же значение
+bool simplify_shrinks(const std::string &input, const std::map<std::string, double> &params, std::string by) {
+    auto tokens = tokenize(input);
+    Parser<double> parser(tokens);
+    auto diffExpr = parser.parse()->diff(by);
+    auto optimized = optimize(diffExpr);
+    auto simplified = simplify(diffExpr);
+    std::cout << input << ": " << node_count(optimized) << " -> " << node_count(simplified) << std::endl;
+    return node_count(simplified) <= node_count(optimized) && close(simplified->eval(params), optimized->eval(params));
+}
+
+TEST_CASE("Упрощение") {
+    SECTION("DOUBLE") {
+        CHECK(simplify_double("x^2 + 4 * x - 7", "((2 * x) + 4)", "x"));
+        CHECK(simplify_double("x^5 - 3 * x^3 + 2 * x", "(((5 * (x^4)) - (9 * (x^2))) + 2)", "x"));
+        CHECK(simplify_double("x / (x^2 + 1)", "((1 - (x^2)) / (((x^2) + 1)^2))", "x"));
+        CHECK(simplify_double("x^x", "((x^x) * (ln(x) + 1))", "x"));
+        CHECK(simplify_double("cos(ln(x))", "(((-1) * sin(ln(x))) / x)", "x"));
+        CHECK(simplify_double("sin(x) * cos(x)", "((cos(x)^2) - (sin(x)^2))", "x"));
+        CHECK(simplify_double("ln(x) / x^3", "(((x^2) - ((3 * ln(x)) * (x^2))) / (x^6))", "x"));
+        CHECK(simplify_double("2 * x + 3 * x * y - x * 2", "(3 * y)", "x"));
+        CHECK(simplify_double("x * x * x / x", "(2 * x)", "x"));
+        CHECK(simplify_double("0 - (0 - x) + sin(2 * 3) * x", "0.720585", "x"));
+        CHECK(simplify_double("ln(exp(x * x))", "(2 * x)", "x"));
+    }
+    SECTION("COMPLEX") {
+        CHECK(simplify_complex("cos(2i*x)", "(-2i * sin(2i * x))", "x"));
+        CHECK(simplify_complex("(x-i)/(x+i)", "(2i / ((x + 1i)^2))", "x"));
+        CHECK(simplify_complex("x^2 * i", "(2i * x)", "x"));
+    }
+    SECTION("Размер деревьев") {
+        const std::map<std::string, double> params{{"x", 1.3}};
+        for (const auto *input : {"x^5 - 3 * x^3 + 2 * x", "x / (x^2 + 1)", "ln(x^2 + 1)", "x^x", "sin(x^2)",
+                                  "cos(ln(x))", "exp(x) * sin(x)", "ln(x) / x^3", "sin(x) * cos(x)"}) {
+            CHECK(simplify_shrinks(input, params, "x"));
+        }
+    }
+    SECTION("Деление на ноль") {
+        auto tokens = tokenize("x / (y - y)");
+        Parser<double> parser(tokens);
+        CHECK_THROWS(simplify(parser.parse()));
+    }
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> saturate_text(const std::string &input, SaturationReport *report = nullptr) {
+    auto tokens = tokenize(input);
+    Parser<T> parser(tokens);
+    auto result = saturate(parser.parse(), SaturationLimits{}, CostModel{}, report);
+    std::cout << input << " -> " << result->to_string() << std::endl;
+    return result;
+}
+
+// Насыщение не дороже исходного выражения и дает то же значение
+template <typename T>
+bool saturation_matches(const std::string &input, const std::map<std::string, T> &params) {
+    auto tokens = tokenize(input);
+    Parser<T> parser(tokens);
+    auto expr = parser.parse();
+    SaturationReport report;
+    auto result = saturate(expr, SaturationLimits{}, CostModel{}, &report);
+    std::cout << input << " -> " << result->to_string() << " (" << report.cost_before << " -> " << report.cost_after
+              << ", " << report.nodes << " nodes)" << std::endl;
+    return report.cost_after <= report.cost_before && close(result->eval(params), expr->eval(params));
+}
+
+TEST_CASE("Насыщение равенств") {
+    SECTION("DOUBLE") {
+        CHECK(saturate_text<double>("sin(x)^2 + cos(x)^2")->to_string() == "1");
+        CHECK(saturate_text<double>("y * cos(x)^2 + sin(x)^2 * y")->to_string() == "y");
+        CHECK(saturate_text<double>("ln(exp(x + y))")->to_string() == "(x + y)");
+        CHECK(saturate_text<double>("exp(x) * exp(y)")->to_string() == "exp(x + y)");
+        CHECK(saturate_text<double>("x * y + x * z")->to_string() == "(x * (y + z))");
+        CHECK(saturate_text<double>("x^2 * x^3")->to_string() == "((x * x) * (x * (x * x)))");
+        CHECK(saturate_text<double>("(x + 1) - (1 + x)")->to_string() == "0");
+        // Правила не меняют результат: exp(ln(x)) при x <= 0 - NaN, x / x при x = 0 - ошибка
+        CHECK(saturate_text<double>("exp(ln(x))")->to_string() == "exp(ln(x))");
+        CHECK(saturate_text<double>("x / x + 0 * y")->to_string() == "(x / x)");
+        CHECK_THROWS(saturate_text<double>("x / x")->eval(std::map<std::string, double>{{"x", 0}}));
+        CHECK(saturate_text<double>("x / (3 - 1) / 2")->to_string() == "(x * 0.250000)");
+        CHECK(saturate_text<double>("x^2")->to_string() == "(x * x)");
+        const std::map<std::string, double> params{{"x", 0.7}, {"y", -1.3}, {"z", 2.1}};
+        for (const auto *input : {"x^5 - 3 * x^3 + 2 * x", "(x + y) * (x - y) + y * y", "exp(x) * sin(x) * exp(y)",
+                                  "x / (x^2 + 1) + 2 * x / (x^2 + 1)", "ln(x^2) + cos(y)^2 + sin(y)^2"}) {
+            CHECK(saturation_matches<double>(input, params));
+        }
+    }
+    SECTION("COMPLEX") {
+        CHECK(saturate_text<std::complex<double>>("sin(2i * x)^2 + cos(2i * x)^2")->to_string() == "1");
+        // ln(exp(a)) для комплексных чисел не упрощается, exp(ln(a)) - упрощается
+        CHECK(saturate_text<std::complex<double>>("ln(exp(x))")->to_string() == "ln(exp(x))");
+        CHECK(saturate_text<std::complex<double>>("exp(ln(x))")->to_string() == "x");
+        const std::map<std::string, std::complex<double>> params{{"x", to_cm(0.3, 0.4)}, {"y", to_cm(-1.1, 0.2)}};
+        CHECK(saturation_matches<std::complex<double>>("x * y + x * 2i - i * x", params));
+        CHECK(saturation_matches<std::complex<double>>("exp(x) * exp(y) / x", params));
+    }
+    SECTION("Лимиты") {
+        SaturationReport report;
+        auto tokens = tokenize("(a + b + c + d + e + f) * (g + h + k + l + m + n) * (a + b + c)");
+        Parser<double> parser(tokens);
+        auto expr = parser.parse();
+        // Время не ограничено: иначе число итераций зависело бы от скорости машины
+        const auto unlimited = std::chrono::milliseconds(std::chrono::hours(1));
+        saturate(expr, SaturationLimits{.max_nodes = 500, .max_iterations = 50, .time = unlimited}, CostModel{}, &report);
+        CHECK_FALSE(report.saturated);
+        CHECK(report.iterations < 50);
+        saturate(expr, SaturationLimits{.max_nodes = 1000000, .max_iterations = 2, .time = unlimited}, CostModel{}, &report);
+        CHECK(report.iterations == 2);
+    }
+}
+
+TEST_CASE("Кэш выражений") {
+    SECTION("Нормализация") {
+        CHECK(normalize_formula("  SIN( X )+2.5i*(y)i") == "sin ( x ) + 2.5i * ( y ) * 1i");
+        CHECK(normalize_formula("-x") == "0 - x");
+        ExpressionCache<double> cache;
+        auto first = cache.get("sin(x) * X + 1");
+        auto second = cache.get("SIN (x)*x+1");
+        CHECK(first == second);
+        CHECK(first->parsed->to_string() == "((sin(x) * x) + 1)");
+        CHECK(cache.get("sin(x) * y + 1") != first);
+        const auto stats = cache.stats();
+        CHECK(stats.hits == 1);
+        CHECK(stats.misses == 2);
+        CHECK(stats.entries == 2);
+        CHECK(stats.evictions == 0);
+        CHECK_THROWS(cache.get("sin(x) +"));
+        CHECK(cache.stats().entries == 2);
+    }
+    SECTION("Подсчет") {
+        ExpressionCache<std::complex<double>> cache;
+        auto entry = cache.get("x * 0 + (1 + 2i) * x / y");
+        CHECK(entry->optimized->to_string() == "(((1 + 2i) * x) / y)");
+        const std::map<std::string, std::complex<double>> params{{"x", to_cm(0.5, 1)}, {"y", to_cm(2, -1)}};
+        auto values = entry->program.bind(params);
+        CHECK(close(entry->program.eval(std::span<const std::complex<double>>(values)), entry->parsed->eval(params)));
+        // Деление на константный ноль не мешает разбору
+        CHECK_NOTHROW(cache.get("x / 0"));
+    }
+    SECTION("Вытеснение") {
+        ExpressionCache<double> cache;
+        const auto size = cache.get("x + 1")->bytes;
+        cache.set_capacity(3 * size);
+        cache.clear();
+        for (const auto *input : {"x + 1", "x + 2", "x + 3"}) cache.get(input);
+        cache.get("x + 1"); // теперь самая старая запись - x + 2
+        cache.get("x + 4");
+        auto stats = cache.stats();
+        CHECK(stats.evictions == 1);
+        CHECK(stats.entries == 3);
+        CHECK(stats.bytes <= 3 * size);
+        const auto misses = stats.misses;
+        cache.get("x + 1");
+        CHECK(cache.stats().misses == misses);
+        cache.get("x + 2");
+        CHECK(cache.stats().misses == misses + 1);
+        cache.set_capacity(0);
+        CHECK(cache.stats().entries == 0);
+        CHECK(cache.get("x + 5")->parsed->to_string() == "(x + 5)");
+        CHECK(cache.stats().entries == 0);
+    }
+    SECTION("Глубокие формулы") {
+        // Оптимизация и подсчет размера при сборке записи не должны упираться в стек вызовов
+        std::string nested;
+        for (int i = 0; i < 20000; i++) nested += "sin(";
+        nested += "x * 1";
+        for (int i = 0; i < 20000; i++) nested += ")";
+        ExpressionCache<double> cache;
+        auto entry = cache.get(nested);
+        CHECK(node_count(entry->parsed) == 20003);
+        CHECK(node_count(entry->optimized) == 20001);
+        const std::map<std::string, double> params{{"x", 1}};
+        double expected = 1;
+        for (int i = 0; i < 20000; i++) expected = std::sin(expected);
+        CHECK(close(entry->parsed->eval(params), expected));
+        auto values = entry->program.bind(params);
+        CHECK(close(entry->program.eval(std::span<const double>(values)), expected));
+        CHECK(cache.get(nested) == entry);
+    }
+    SECTION("Потоки") {
+        ExpressionCache<double> cache;
+        std::vector<std::thread> threads;
+        std::vector<const CompiledExpression<double> *> seen(8);
+        for (std::size_t t = 0; t < seen.size(); t++) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < 200; i++) cache.get("exp(x) * " + std::to_string(i % 20));
+                seen[t] = cache.get("exp(x) * 7").get();
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        for (const auto *entry : seen) CHECK(entry == seen.front());
+        const auto stats = cache.stats();
+        CHECK(stats.entries == 20);
+        CHECK(stats.hits + stats.misses == 8 * 201);
+    }
+}
+
+TEST_CASE("Кэш производных") {
+    auto parse = [](const char *input) { return Parser<double>(std::string_view(input)).parse(); };
+    std::string x = "x";
+    std::string y = "y";
+    SECTION("Общие поддеревья") {
+        HashConsTable<double> table;
+        HashConsScope<double> scope(table);
+        auto expr = parse("sin(x^2) * cos(x^2) + sin(x^2) / y");
+        const auto expected = optimize(expr->diff(x))->to_string();
+
+        DiffCache<double> cache;
+        DiffCacheScope<double> diff_scope(cache);
+        auto first = expr->diff(x);
+        CHECK(optimize(first)->to_string() == expected);
+        CHECK(cache.hit_count() > 0); // d/dx sin(x^2) и x^2 посчитаны по разу
+        const auto misses = cache.miss_count();
+        CHECK(expr->diff(x) == first);
+        CHECK(cache.miss_count() == misses);
+
+        // Вторая производная переиспользует первую
+        auto second = expr->diff(x)->diff(y);
+        CHECK(expr->diff(x)->diff(y) == second);
+        const std::map<std::string, double> params{{"x", 0.4}, {"y", 1.7}};
+        CHECK(close(second->eval(params), -std::cos(0.16) * 0.8 / (1.7 * 1.7)));
+    }
+    SECTION("Размер") {
+        DiffCache<double> cache(4);
+        DiffCacheScope<double> diff_scope(cache);
+        auto expr = parse("sin(x) * exp(x) + ln(x) / x - cos(x)");
+        expr->diff(x);
+        CHECK(cache.size() <= 4);
+        auto other = parse("x * x");
+        auto derivative = other->diff(x);
+        CHECK(other->diff(x) == derivative);
+        other.reset(); // запись умершего узла не используется
+        CHECK(cache.size() <= 4);
+    }
+    SECTION("Повторная запись") {
+        // Ключ, записанный дважды, занимает одно место и вытесняется один раз
+        DiffCache<double> cache(2);
+        auto a = make_var<double>("a");
+        auto b = make_var<double>("b");
+        auto one = make_constant<double>(1);
+        cache.insert(*a, x, one);
+        cache.insert(*a, x, one);
+        cache.insert(*b, x, one);
+        CHECK(cache.size() == 2);
+        CHECK(cache.find(*a, x) == one);
+        CHECK(cache.find(*b, x) == one);
+        auto c = make_var<double>("c");
+        cache.insert(*c, x, one);
+        CHECK(cache.size() == 2);
+        CHECK(cache.find(*a, x) == nullptr);
+        CHECK(cache.find(*c, x) == one);
+    }
+    SECTION("Без кэша") {
+        auto expr = parse("x * x");
+        CHECK(expr->diff(x) != expr->diff(x));
+    }
+}
+
+TEST_CASE("Пакетный режим") {
+    SECTION("Запросы") {
+        ExpressionCache<std::complex<double>> cache;
+        CHECK(process_request("eval; x^2 + Y; x=3; y=1-i", cache) == "(10,-1)");
+        CHECK(process_request("  EVAL ;sin(x) ; X = 0.5", cache) == format_value(std::sin(0.5)));
+        CHECK(process_request("eval; x * y; x=2", cache) == "(0,0)");
+        CHECK(process_request("diff; X^3; x", cache) == "(3 * (x^2))");
+        CHECK(process_request("diff; x^3; x", cache) == "(3 * (x^2))");
+        CHECK(process_request("eval; 1 / (x - x); x=1", cache) == "error: Division by zero");
+        CHECK(process_request("eval; x +", cache) == "error: Unexpected end of input in parsePrimary");
+        CHECK(process_request("integrate; x", cache) == "error: Unknown request: integrate");
+        CHECK(process_request("diff; x", cache).starts_with("error: "));
+        CHECK(process_request("eval; x; x", cache) == "error: Invalid argument: x");
+        for (const auto value : {to_cm(0.1, 2), to_cm(-1e-7, 123456789), to_cm(1.0 / 3, -0.25)}) {
+            std::ostringstream stream;
+            stream << value;
+            CHECK(format_value(value) == stream.str());
+        }
+    }
+    SECTION("Порядок ответов") {
+        std::string input;
+        for (int i = 0; i < 500; i++) {
+            input += i % 4 == 0 ? "diff; sin(x * " + std::to_string(i % 7) + "); x\n"
+                                : "eval; x * " + std::to_string(i) + " + y; x=2; y=i\n";
+            if (i % 50 == 0) input += "\n   \n";
+        }
+        input += "eval; (x"; // последняя строка без перевода строки
+        std::string expected;
+        for (const std::size_t threads : {1, 3}) {
+            ExpressionCache<std::complex<double>> cache;
+            std::istringstream in(input);
+            std::ostringstream out;
+            const auto stats = run_batch(in, out, BatchOptions{.threads = threads, .block = 64, .buffer = 100}, cache);
+            CHECK(stats.requests == 501);
+            CHECK(stats.errors == 1);
+            if (threads == 1) {
+                expected = out.str();
+            } else {
+                CHECK(out.str() == expected);
+            }
+        }
+        std::istringstream lines(expected);
+        std::string line;
+        for (int i = 0; i < 3; i++) std::getline(lines, line);
+        CHECK(line == "(4,1)"); // третий запрос: x * 2 + y
+    }
+}
+
+TEST_CASE("Подсчет по файлу") {
+    auto program = compile(Parser<double>(std::string_view("x * Y + 1")).parse());
+    SECTION("CSV") {
+        std::string input = "id, X ,y\r\n";
+        std::string expected;
+        for (int i = 0; i < 1000; i++) {
+            const double x = i * 0.5, y = 1.0 / (i + 1);
+            input += std::to_string(i) + "," + std::to_string(x) + ", " + std::to_string(y) + (i % 10 ? "\n" : "\r\n");
+            if (i % 100 == 0) input += "\n";
+            const double value = std::stod(std::to_string(x)) * std::stod(std::to_string(y)) + 1;
+            char text[32];
+            expected.append(text, std::to_chars(text, text + sizeof(text), value).ptr);
+            expected += '\n';
+        }
+        input.pop_back(); // последняя строка без перевода строки
+        for (const std::size_t threads : {1, 2}) {
+            std::istringstream in(input);
+            std::ostringstream out;
+            EvalFileOptions options;
+            options.chunk = 7;
+            options.threads = threads;
+            const auto stats = eval_file(program, in, out, options);
+            CHECK(stats.rows == 1000);
+            CHECK(stats.bytes == input.size());
+            CHECK(out.str() == expected);
+        }
+    }
+    SECTION("BINARY") {
+        std::string input;
+        std::vector<double> expected;
+        for (int i = 0; i < 300; i++) {
+            const double row[3] = {i * 0.25, -1.0 * i, 3.0};
+            input.append(reinterpret_cast<const char *>(row), sizeof(row));
+            expected.push_back(row[2] * row[0] + 1);
+        }
+        std::istringstream in(input);
+        std::ostringstream out;
+        const auto stats = eval_file(program, in, out, EvalFileOptions{.format = ColumnFormat::BINARY, .columns = {"x", "unused", "y"}, .chunk = 64});
+        CHECK(stats.rows == 300);
+        REQUIRE(out.str().size() == expected.size() * sizeof(double));
+        CHECK(std::memcmp(out.str().data(), expected.data(), out.str().size()) == 0);
+
+        std::istringstream truncated(input.substr(0, input.size() - 4));
+        std::ostringstream ignored;
+        CHECK_THROWS(eval_file(program, truncated, ignored, EvalFileOptions{.format = ColumnFormat::BINARY, .columns = {"x", "u", "y"}}));
+    }
+    SECTION("Ошибки") {
+        auto error = [&](const std::string &input) {
+            std::istringstream in(input);
+            std::ostringstream out;
+            try {
+                eval_file(program, in, out, EvalFileOptions{});
+            } catch (const std::runtime_error &e) {
+                return std::string(e.what());
+            }
+            return std::string();
+        };
+        CHECK(error("x,z\n1,2\n") == "No input column for variable: y");
+        CHECK(error("x,y\n1,2\n3\n") == "Row 2 has 1 fields, expected 2");
+        CHECK(error("x,y\n1,abc\n") == "Invalid number: abc");
+        CHECK(error("x,y\n1,0\n") == "");
+        CHECK(error("") == "Missing CSV header");
+    }
+}
+
+TEST_CASE("Печать") {
+    using C = std::complex<double>;
+    auto minimal = [](const std::string &text) { return print(Parser<double>(std::string_view(text)).parse()); };
+
+    SECTION("Только нужные скобки") {
+        CHECK(minimal("(x + y) + z") == "x + y + z");
+        CHECK(minimal("x + (y + z)") == "x + (y + z)");
+        CHECK(minimal("(x * y) + (z / 2)") == "x * y + z / 2");
+        CHECK(minimal("(x + y) * (x - y)") == "(x + y) * (x - y)");
+        CHECK(minimal("x - (y - z)") == "x - (y - z)");
+        CHECK(minimal("(x^2)^3") == "x^2^3");
+        CHECK(minimal("x^(2^3)") == "x^(2^3)");
+        CHECK(minimal("sin((x + 1)) * ln(x)^2") == "sin(x + 1) * ln(x)^2");
+        CHECK(minimal("2 * (3 - x)") == "2 * (3 - x)");
+    }
+
+    SECTION("Числа") {
+        CHECK(print(make_constant<double>(0.1)) == "0.1");
+        CHECK(print(make_constant<double>(-2.5)) == "(-2.5)");
+        CHECK(print(make_constant<double>(1e20)) == "100000000000000000000");
+        CHECK(print(make_constant<C>(C(0, -3))) == "(-3i)");
+        CHECK(print(make_constant<C>(C(1.5, -0.25))) == "(1.5 - 0.25i)");
+        // to_string по-прежнему печатает шесть знаков, как std::to_string
+        CHECK(make_constant<double>(0.1)->to_string() == "0.100000");
+        CHECK(make_constant<C>(C(0, -3))->to_string() == "-3i");
+        CHECK(to_string_optimized(-7) == "-7");
+    }
+
+    SECTION("Разбор напечатанного дает то же дерево") {
+        for (const char *text : {"sin(x) * y + x^2 / (y + 2) - cos(x - y)", "((x - y) - (z - x)) / ((x * y) * z)",
+                                 "exp(ln(x^y^0.5)) - 3.25 * (x + 1)^(y - 1)"}) {
+            const auto expr = Parser<double>(std::string_view(text)).parse();
+            const auto printed = print(expr);
+            CHECK(Parser<double>(std::string_view(printed)).parse()->to_string() == expr->to_string());
+        }
+    }
+
+    SECTION("Общие подвыражения") {
+        const auto x = make_var<double>("x");
+        auto expr = make_mono<double>(make_binary<double>(x, make_constant<double>(2), PLUS), SIN);
+        for (int i = 0; i < 3; i++) expr = make_binary<double>(expr, expr, MULT);
+        CHECK(print(expr, PrintOptions{true, true}) == "t1 = sin(x + 2)\nt2 = t1 * t1\nt3 = t2 * t2\nt3 * t3");
+        CHECK(print(expr) == "sin(x + 2) * sin(x + 2) * (sin(x + 2) * sin(x + 2)) * "
+                             "(sin(x + 2) * sin(x + 2) * (sin(x + 2) * sin(x + 2)))");
+        CHECK(print(expr, PrintOptions{false, true}) == "t1 = sin(x + 2)\nt2 = (t1 * t1)\nt3 = (t2 * t2)\n(t3 * t3)");
+
+        // Удвоение 40 раз: в общем виде строк столько же, сколько удвоений
+        auto doubled = make_binary<double>(x, make_constant<double>(1.5), MULT);
+        for (int i = 0; i < 40; i++) doubled = make_binary<double>(doubled, doubled, PLUS);
+        const auto text = print(doubled, PrintOptions{true, true});
+        CHECK(std::count(text.begin(), text.end(), '\n') == 40);
+    }
+
+    SECTION("Глубокое дерево") {
+        auto expr = make_var<double>("x");
+        for (int i = 0; i < 200000; i++) expr = make_binary<double>(expr, make_var<double>("y"), MINUS);
+        const auto text = print(expr);
+        CHECK(text.size() == 1 + 200000 * 4);
+        CHECK(expr->to_string().size() == 1 + 200000 * 6);
+    }
+}
+
+// Результат подсчета или признак исключения; NaN считаются равными друг другу, остальное - побитово
+struct EvalOutcome {
+    bool thrown = false;
+    double value = 0;
+    bool operator==(const EvalOutcome &other) const {
+        if (thrown || other.thrown) return thrown == other.thrown;
+        if (std::isnan(value) && std::isnan(other.value)) return true;
+        return std::bit_cast<std::uint64_t>(value) == std::bit_cast<std::uint64_t>(other.value);
+    }
+};
+
+template <typename F>
+EvalOutcome outcome(F &&f) {
+    try {
+        return {false, f()};
+    } catch (const std::runtime_error &) {
+        return {true, 0};
+    }
+}
+
+bool native_matches(const std::string &input, const std::map<std::string, double> &params) {
+    const auto expr = Parser<double>(std::string_view(input)).parse();
+    const NativeProgram native = compile_native(expr);
+    const NativeProgram interpreted(compile(expr), false);
+    const auto values = native.bind(params);
+    const auto tree = outcome([&] { return expr->eval(params); });
+    const auto jit = outcome([&] { return native.eval(values); });
+    const auto fallback = outcome([&] { return interpreted.eval(values); });
+    if (tree == jit && tree == fallback) return true;
+    std::cout << input << ": " << tree.value << " " << jit.value << " " << fallback.value << std::endl;
+    return false;
+}
+
+// Случайное выражение над x, y, z глубиной до depth
+std::string random_expression(std::mt19937 &random, const int depth) {
+    static const char *leaves[] = {"x", "y", "z", "2", "0.5", "3.25", "0", "1"};
+    static const char *ops[] = {" + ", " - ", " * ", " / ", " ^ "};
+    static const char *funcs[] = {"sin(", "cos(", "ln(", "exp("};
+    const auto pick = [&](const int n) { return static_cast<int>(random() % static_cast<unsigned>(n)); };
+    if (depth == 0 || pick(4) == 0) return leaves[pick(8)];
+    if (pick(3) == 0) return std::string(funcs[pick(4)]) + random_expression(random, depth - 1) + ")";
+    return "(" + random_expression(random, depth - 1) + ops[pick(5)] + random_expression(random, depth - 1) + ")";
+}
+
+TEST_CASE("Машинный код") {
+    SECTION("FIXED") {
+        CHECK(native_matches("x + y", {{"x", 5}, {"y", 7}}));
+        CHECK(native_matches("(a + b) * (c - d) / e", {{"a", 6}, {"b", 2}, {"c", 10}, {"d", 4}, {"e", 4}}));
+        CHECK(native_matches("sin(x) + cos(y) * ln(z) - exp(x ^ y)", {{"x", 0.5}, {"y", 1.5}, {"z", 3}}));
+        CHECK(native_matches("x * x / x - x", {{"x", 0.1}}));
+        CHECK(native_matches("3", {}));
+        CHECK(native_matches("ln(x) * x ^ 0.5", {{"x", -2}}));
+        CHECK(native_matches("x / y", {{"x", 1}, {"y", 0}}));
+        CHECK(native_matches("x / (y - y)", {{"x", 1}, {"y", 2}}));
+    }
+    SECTION("DIVISION") {
+        const NativeProgram program = compile_native(Parser<double>(std::string_view("x / y")).parse());
+        CHECK(program.eval(std::vector<double>{1, 4}) == 0.25);
+        CHECK_THROWS_WITH(program.eval(std::vector<double>{1, 0}), "Division by zero");
+        CHECK_THROWS_WITH(program.eval(std::vector<double>{1, -0.0}), "Division by zero");
+        CHECK(std::isnan(program.eval(std::vector<double>{1, std::nan("")})));
+        CHECK_THROWS(program.eval(std::vector<double>{1}));
+    }
+    SECTION("RANDOM") {
+        std::mt19937 random(2024);
+        for (int i = 0; i < 300; i++) {
+            const auto input = random_expression(random, 6);
+            const std::map<std::string, double> params{{"x", 0.7}, {"y", -1.3}, {"z", 2.5}};
+            REQUIRE(native_matches(input, params));
+        }
+    }
+    SECTION("REGISTERS") {
+        // Больше регистров, чем Program держит на стеке, и несколько результатов
+        std::vector<std::shared_ptr<Expression<double>>> exprs;
+        std::string x = "x";
+        std::string input = "x";
+        for (int i = 0; i < 100; i++) input = "sin(" + input + ") * (x + " + std::to_string(i) + ")";
+        exprs.push_back(Parser<double>(std::string_view(input)).parse());
+        exprs.push_back(exprs.front()->diff(x));
+        const NativeProgram native = compile_native(exprs);
+        const NativeProgram interpreted(compile(exprs), false);
+        CHECK(native.get_program().get_registers() > Program<double>::inline_registers);
+        std::vector<double> values{0.3}, scratch(native.get_program().get_registers());
+        std::vector<double> jit(2), fallback(2);
+        native.eval(values, jit, scratch);
+        interpreted.eval(values, fallback, scratch);
+        CHECK(std::bit_cast<std::uint64_t>(jit[0]) == std::bit_cast<std::uint64_t>(fallback[0]));
+        CHECK(std::bit_cast<std::uint64_t>(jit[1]) == std::bit_cast<std::uint64_t>(fallback[1]));
+        CHECK(native.eval(values) == fallback[0]);
+    }
+    SECTION("FUNCTION") {
+        const NativeProgram program = compile_native(Parser<double>(std::string_view("x * y + 1")).parse());
+        CHECK(program.is_native() == NativeProgram::supported());
+        if (const NativeFunction function = program.get_function()) {
+            const double values[] = {2, 3};
+            double regs[8];
+            CHECK(function(values, regs) == NATIVE_OK);
+            CHECK(regs[program.get_program().get_result()] == 7);
+        }
+    }
+}
+
+TEST_CASE("Генерация заголовка") {
+    SECTION("TEXT") {
+        const auto expr = Parser<double>(std::string_view("sin(x) * sin(x) + for / y")).parse();
+        const auto header = emit_header(expr, {"model", {"x"}});
+        CHECK(header.find("#ifndef MODEL_GENERATED_H") != std::string::npos);
+        CHECK(header.find("namespace model {") != std::string::npos);
+        CHECK(header.find("inline double f(const double x, const double for_, const double y) {") != std::string::npos);
+        CHECK(header.find("inline double df_dx(const double x, [[maybe_unused]] const double for_, "
+                          "[[maybe_unused]] const double y) {") != std::string::npos);
+        CHECK(header.find("if (y == 0.0) throw std::runtime_error(\"Division by zero\");") != std::string::npos);
+        // sin(x) - общее подвыражение: в f оно считается один раз
+        const auto f = header.substr(header.find("inline double f("), header.find("inline double df_dx") - header.find("inline double f("));
+        CHECK(f.find("std::sin(x)") == f.rfind("std::sin(x)"));
+        CHECK_THROWS(emit_header(expr, {"namespace", {}}));
+        CHECK_THROWS(emit_header(expr, {"model", {"x", "x"}}));
+    }
+    SECTION("LITERALS") {
+        std::string out;
+        codegen::append_literal(out, 2);
+        CHECK(out == "2.0");
+        out.clear();
+        codegen::append_literal(out, -0.1);
+        CHECK(out == "(-0.1)");
+        out.clear();
+        codegen::append_literal(out, 1e300);
+        CHECK(std::stod(out) == 1e300);
+    }
+    SECTION("GENERATED") {
+        // Заголовки сгенерированы при сборке командой differentiator --emit-header
+        const auto expr = Parser<double>(std::string_view(GENERATED_MODEL)).parse();
+        std::string x = "x", y = "y";
+        const auto dx = expr->diff(x);
+        const auto dy = expr->diff(y);
+        static_assert(generated_model::variable_count == 2 && generated_model::result_count == 3);
+        for (const auto &[vx, vy] : {std::pair{0.5, 1.5}, std::pair{-1.0, 3.0}, std::pair{4.0, 2.25}}) {
+            const std::map<std::string, double> params{{"x", vx}, {"y", vy}};
+            CHECK(close(generated_model::f(vx, vy), expr->eval(params)));
+            CHECK(close(generated_model::df_dx(vx, vy), dx->eval(params)));
+            CHECK(close(generated_model::df_dy(vx, vy), dy->eval(params)));
+            double out[generated_model::result_count];
+            generated_model::all(vx, vy, out);
+            CHECK(out[0] == generated_model::f(vx, vy));
+            CHECK(out[1] == generated_model::df_dx(vx, vy));
+            CHECK(out[2] == generated_model::df_dy(vx, vy));
+        }
+        CHECK_THROWS_WITH(generated_model::f(-2, 1), "Division by zero");
+
+        const auto complex = Parser<std::complex<double>>(std::string_view(GENERATED_MODEL)).parse();
+        const auto complex_dx = complex->diff(x);
+        const std::map<std::string, std::complex<double>> params{{"x", to_cm(0.5, 1)}, {"y", to_cm(-1, 2)}};
+        CHECK(close(generated_complex_model::f(to_cm(0.5, 1), to_cm(-1, 2)), complex->eval(params)));
+        CHECK(close(generated_complex_model::df_dx(to_cm(0.5, 1), to_cm(-1, 2)), complex_dx->eval(params)));
+    }
+}
+
+// Литерал, разобранный при компиляции, против Parser<T>: то же дерево, та же производная по x, те же значения
+template <typename T, static_expr::fixed_string Text>
+bool static_matches(const std::map<std::string, T> &params) {
+    constexpr auto f = parse_static<T, Text>();
+    constexpr auto df = f.template diff<"x">();
+    const auto tree = Parser<T>(Text.view()).parse();
+    std::string x = "x";
+    const auto tree_df = tree->diff(x);
+    auto same_value = [](auto static_eval, auto tree_eval) {
+        T a{}, b{};
+        bool thrown_a = false, thrown_b = false;
+        try { a = static_eval(); } catch (const std::runtime_error &) { thrown_a = true; }
+        try { b = tree_eval(); } catch (const std::runtime_error &) { thrown_b = true; }
+        return thrown_a == thrown_b && (thrown_a || close(a, b));
+    };
+    const bool same = print(f.to_expression()) == print(tree) && print(df.to_expression()) == print(tree_df)
+        && same_value([&] { return f.eval(f.bind(params)); }, [&] { return tree->eval(params); })
+        && same_value([&] { return df.eval(df.bind(params)); }, [&] { return tree_df->eval(params); });
+    if (!same) std::cout << Text.view() << ": " << print(f.to_expression()) << " | " << print(df.to_expression()) << std::endl;
+    return same;
+}
+
+TEST_CASE("Разбор при компиляции") {
+    using namespace static_expr;
+    SECTION("TYPES") {
+        static_assert(std::is_same_v<decltype(parse_static<double, "x + 1">())::tree, Binary<PLUS, Variable<0>, Constant<1.0>>>);
+        static_assert(std::is_same_v<decltype(parse_static<double, "-sin y">())::tree,
+                                     Binary<MINUS, Constant<0.0>, Mono<SIN, Variable<0>>>>);
+        static_assert(std::is_same_v<decltype(parse_static<double, "2i">())::tree, Constant<2.0>>);
+        static_assert(std::is_same_v<decltype(parse_static<std::complex<double>, "2i">())::tree, Constant<0.0, 2.0>>);
+        static_assert(std::is_same_v<decltype(parse_static<double, "x^3">().diff<"x">())::tree,
+                                     Binary<MULT, Constant<3.0>, Binary<MULT, Binary<POW, Variable<0>, Constant<2.0>>, Constant<1.0>>>>);
+        // Подсчет тоже возможен при компиляции
+        static_assert(parse_static<double, "2 * x + y / 4">()(3.0, 2.0) == 6.5);
+        static_assert(parse_static<double, "(x - 1) * (x + 1)">().diff<"x">()(5.0) == 10);
+        static_assert(decltype(parse_static<double, "3">())::variable_count == 0);
+    }
+    SECTION("GRAMMAR") {
+        CHECK(static_matches<double, "x^2 * sin(y) + 3 / x">({{"x", 1.5}, {"y", 2}}));
+        CHECK(static_matches<double, "-(x - 0.1) * 10 - y^x^2">({{"x", 0.5}, {"y", 1.25}}));
+        CHECK(static_matches<double, "sin x^2 + COS(X) * Exp(x)">({{"x", 0.7}}));
+        CHECK(static_matches<double, "ln(x) / (x - x) + 2 ^ x">({{"x", 3}}));
+        CHECK(static_matches<double, "x^(-2) + x^0.5 - x^1 + x^0">({{"x", 2.5}}));
+        CHECK(static_matches<double, "  ( x*y )/( 1.2.3 + .5 ) - 5.">({{"x", 4}, {"y", -1}}));
+        CHECK(static_matches<double, "0.1 + 123456789012345 * 0.000001 + 3.14159265358979">({}));
+        CHECK(static_matches<double, "z * x / y">({{"x", 2}, {"y", 0}, {"z", 1}}));
+        CHECK(static_matches<double, "y">({{"y", 1}}));
+        CHECK(static_matches<std::complex<double>, "exp(i * x) * 2i + (x)i - x^2i">({{"x", to_cm(1, 0.5)}}));
+        CHECK(static_matches<std::complex<double>, "x^3 / (x - i) + ln(x) * cos(x)">({{"x", to_cm(-0.5, 2)}}));
+    }
+    SECTION("NUMBERS") {
+        for (const std::string_view text : {"0.1", "2.675", "1.2.3", ".5", "5.", "007.25", "123456789012345",
+                                            "0.000001", "3.14159265358979", "9007199254740993"}) {
+            double expected = 0;
+            std::from_chars(text.data(), text.data() + text.size(), expected, std::chars_format::fixed);
+            CHECK(std::bit_cast<std::uint64_t>(number(text)) == std::bit_cast<std::uint64_t>(expected));
+        }
+        static_assert(number("0.3") == 0.3);
+    }
+    SECTION("EVAL") {
+        constexpr auto f = parse_static<double, "x^2 * sin(y) + 3 / x">();
+        static_assert(f.variables() == std::array<std::string_view, 2>{"x", "y"});
+        CHECK(f(1.5, 2.0) == f.eval({1.5, 2.0}));
+        CHECK(f.bind({{"y", 2}}) == std::array<double, 2>{0, 2});
+        CHECK_THROWS_WITH(f(0.0, 1.0), "Division by zero");
+        // Вторая производная и производная по отсутствующей переменной
+        std::string x = "x";
+        const auto tree = Parser<double>(std::string_view("x^2 * sin(y) + 3 / x")).parse();
+        CHECK(print(f.diff<"x">().diff<"x">().to_expression()) == print(tree->diff(x)->diff(x)));
+        CHECK(f.diff<"z">()(1.0, 2.0) == 0);
+    }
+}
+
+TEST_CASE("Профилирование") {
+    Profiler profiler;
+    std::string x = "x";
+    std::shared_ptr<Expression<double>> expr;
+    {
+        ProfileScope scope(profiler);
+        expr = Parser<double>(tokenize("sin(x) * y + x^2")).parse();
+        const auto derivative = expr->diff(x);
+        const auto optimized = optimize(simplify(derivative));
+        const std::map<std::string, double> params{{"x", 1}, {"y", 2}};
+        CHECK(expr->eval(params) == std::sin(1.0) * 2 + 1);
+        const auto program = compile(expr);
+        const auto values = program.bind(params);
+        program.eval(std::span<const double>(values));
+
+        const auto &stats = profiler.stats();
+        CHECK(stats.phases[PHASE_TOKENIZE].calls == 1);
+        CHECK(stats.phases[PHASE_PARSE].calls == 1);
+        CHECK(stats.phases[PHASE_PARSE].nodes == 8);
+        // diff и optimize рекурсивны, но считаются одним вызовом
+        CHECK(stats.phases[PHASE_DIFF].calls == 1);
+        CHECK(stats.phases[PHASE_DIFF].nodes > 0);
+        CHECK(stats.phases[PHASE_SIMPLIFY].calls == 1);
+        CHECK(stats.phases[PHASE_OPTIMIZE].calls == 1);
+        CHECK(stats.phases[PHASE_COMPILE].calls == 1);
+        CHECK(stats.phases[PHASE_EVAL].calls == 2);
+        CHECK(stats.eval_visits == 8 + program.get_code().size());
+        CHECK(stats.optimize_casts > 0);
+        CHECK(stats.peak_tree_size >= 8);
+        std::uint64_t by_phase = 0;
+        for (const auto &phase : stats.phases) by_phase += phase.nodes;
+        CHECK(stats.nodes_created == by_phase);
+
+        std::ostringstream out;
+        print_profile(out, stats);
+        CHECK(out.str().find("optimize casts: " + std::to_string(stats.optimize_casts)) != std::string::npos);
+    }
+    // Вне области профилировщик ничего не получает
+    const auto before = profiler.stats().nodes_created;
+    Parser<double>(std::string_view("x + 1")).parse();
+    CHECK(profiler.stats().nodes_created == before);
+    CHECK(Profiler::current() == nullptr);
+    profiler.reset();
+    CHECK(profiler.stats().phases[PHASE_PARSE].calls == 0);
+}
+
+// Выровненная копия записанного файла, как будто он отображен в память
+std::vector<std::max_align_t> aligned_bytes(const std::string &data) {
+    std::vector<std::max_align_t> buffer(data.size() / sizeof(std::max_align_t) + 1);
+    std::memcpy(buffer.data(), data.data(), data.size());
+    return buffer;
+}
+
+TEST_CASE("Двоичный формат") {
+    using C = std::complex<double>;
+
+    SECTION("Запись и загрузка файла") {
+        auto expr = Parser<C>(std::string_view("sin(x) * y + x^2 / (y + 2i) + sin(x) * y")).parse();
+        const auto program = compile(expr);
+        const std::string path = "/tmp/expression_test_" + std::to_string(::getpid()) + ".bin";
+        save_binary(program, path);
+        {
+            const MappedProgram<C> loaded(path);
+            CHECK(loaded.get_variables() == std::vector<std::string_view>{"x", "y"});
+            CHECK(loaded.get_code().size() == program.get_code().size());
+            CHECK(loaded.get_registers() == program.get_registers());
+            const std::map<std::string, C> params{{"x", C(0.5, 1)}, {"y", C(-2, 0.25)}};
+            const auto values = loaded.bind(params);
+            CHECK(loaded.eval(std::span<const C>(values)) == expr->eval(params));
+            CHECK(loaded.slot("y") == 1);
+            // Дерево восстанавливается из программы, общие подвыражения остаются общими
+            const auto restored = loaded.to_expressions();
+            REQUIRE(restored.size() == 1);
+            CHECK(restored[0]->eval(params) == expr->eval(params));
+            CHECK(compile(restored[0]).get_code().size() == program.get_code().size());
+        }
+        std::remove(path.c_str());
+        CHECK_THROWS_WITH(MappedProgram<C>(path), "Cannot open file: " + path);
+    }
+
+    SECTION("Несколько выражений и действительные числа") {
+        const std::vector<std::shared_ptr<Expression<double>>> exprs{
+            Parser<double>(std::string_view("x * 3 + 1")).parse(), Parser<double>(std::string_view("exp(x) - ln(x)")).parse()};
+        std::ostringstream out;
+        write_binary(compile(exprs), out);
+        const auto buffer = aligned_bytes(out.str());
+        const ProgramView<double> view(std::as_bytes(std::span(buffer)).first(out.str().size()));
+        const double value = 2;
+        std::vector<double> scratch(view.get_registers()), results(2);
+        view.eval(std::span<const double>(&value, 1), results, scratch);
+        CHECK(results[0] == 7);
+        CHECK(results[1] == std::exp(2.0) - std::log(2.0));
+        CHECK_THROWS_WITH(ProgramView<C>(std::as_bytes(std::span(buffer)).first(out.str().size())),
+                          "Invalid binary expression: wrong value type");
+    }
+
+    SECTION("Испорченный файл") {
+        std::ostringstream out;
+        write_binary(Parser<double>(std::string_view("x + 1")).parse(), out);
+        const std::string good = out.str();
+        auto load = [](const std::string &data) {
+            const auto buffer = aligned_bytes(data);
+            ProgramView<double> view(std::as_bytes(std::span(buffer)).first(data.size()));
+        };
+        CHECK_NOTHROW(load(good));
+        CHECK_THROWS_WITH(load(good.substr(0, 20)), "Invalid binary expression: file is too short");
+        CHECK_THROWS_WITH(load(good.substr(0, good.size() - 1)), "Invalid binary expression: wrong file size");
+        std::string bad = good;
+        bad[0] = 'X';
+        CHECK_THROWS_WITH(load(bad), "Invalid binary expression: wrong magic");
+        bad = good;
+        bad[sizeof(BinaryHeader) + 8] = 100; // номер операнда первой инструкции
+        CHECK_THROWS_WITH(load(bad), "Invalid binary expression: bad instruction");
+        bad = good;
+        bad[sizeof(BinaryHeader)] = 42; // код инструкции
+        CHECK_THROWS_WITH(load(bad), "Invalid binary expression: bad instruction");
+    }
+
+    SECTION("Глубокое дерево") {
+        // Цепочка сумм глубиной в число слагаемых: компиляция и запись без рекурсии
+        auto name = [](const int i) { return std::string{'v', char('a' + i / 676), char('a' + i / 26 % 26), char('a' + i % 26)}; };
+        std::string text = name(0);
+        for (int i = 1; i < 200000; i++) text += " + " + name(i % 1000);
+        const auto expr = Parser<double>(std::string_view(text)).parse();
+        std::ostringstream out;
+        write_binary(expr, out);
+        const auto buffer = aligned_bytes(out.str());
+        const ProgramView<double> view(std::as_bytes(std::span(buffer)).first(out.str().size()));
+        CHECK(view.get_variables().size() == 1000);
+        std::vector<double> values(1000, 1.0);
+        CHECK(view.eval(std::span<const double>(values)) == 200000);
+    }
+}
+
+#ifdef __linux__
+// Отправляет куски отдельными записями (с паузой между ними), не дожидаясь ответов,
+// и читает ответ до закрытия сервером
+std::string server_roundtrip(const std::string &path, const std::vector<std::string> &parts,
+                             const std::chrono::microseconds pause = std::chrono::microseconds(0)) {
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        ::close(fd);
+        return "connect failed";
+    }
+    for (const auto &text : parts) {
+        if (&text != &parts.front()) std::this_thread::sleep_for(pause);
+        for (std::size_t done = 0; done < text.size();) {
+            const auto sent = ::send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+            if (sent <= 0) break;
+            done += static_cast<std::size_t>(sent);
+        }
+    }
+    ::shutdown(fd, SHUT_WR);
+    std::string result;
+    char chunk[4096];
+    for (auto got = ::read(fd, chunk, sizeof(chunk)); got > 0; got = ::read(fd, chunk, sizeof(chunk))) result.append(chunk, got);
+    ::close(fd);
+    return result;
+}
+
+std::string server_roundtrip(const std::string &path, const std::string &text) {
+    return server_roundtrip(path, std::vector<std::string>{text});
+}
+
+TEST_CASE("Сервер") {
+    const std::string path = "/tmp/expression_test_" + std::to_string(::getpid()) + ".sock";
+    Server server(path, 3);
+    std::thread loop([&server] { server.run(); });
+
+    CHECK(server_roundtrip(path, "def sin(x) * Y\ncall 1 0.5 2\ncall 1 1\ncall 7 1\n\neval; x^2; x=3\ndiff; x^3; x\nfree 1\ncall 1 1 2\n")
+          == "ok 1 x y\n" + format_value(std::sin(0.5) * 2) + "\nerror: Expected 2 values\nerror: Unknown handle: 7\n(9,0)\n"
+             "(3 * (x^2))\nok\nerror: Unknown handle: 1\n");
+
+    // Handles другого (уже закрытого) соединения не видны
+    CHECK(server_roundtrip(path, "call 1 1\n") == "error: Unknown handle: 1\n");
+
+    // Много запросов подряд от нескольких клиентов: ответы в порядке запросов, у каждого клиента свой handle 1
+    std::string requests = "def x * 2 + 1\n", expected = "ok 1 x\n";
+    for (int i = 0; i < 3000; i++) {
+        requests += "call 1 " + std::to_string(i) + "\n";
+        expected += format_value(i * 2.0 + 1) + "\n";
+    }
+    std::vector<std::string> answers(4);
+    std::vector<std::thread> clients;
+    for (auto &answer : answers) clients.emplace_back([&] { answer = server_roundtrip(path, requests); });
+    for (auto &client : clients) client.join();
+    for (const auto &answer : answers) CHECK(answer == expected);
+
+    // def и call в разных записях (и порциях): порции одного соединения считаются по очереди,
+    // поэтому call видит handle, даже если def еще разбирается
+    std::string sum = "x";
+    for (int k = 1; k < 3000; k++) sum += " + x * " + std::to_string(k % 300); // разбор заметно дольше паузы
+    std::vector<std::string> parts;
+    std::string pipelined;
+    for (int i = 1; i <= 20; i++) {
+        parts.push_back("def " + sum + " + " + std::to_string(i) + "\n");
+        parts.push_back("call " + std::to_string(i) + " 1\nfree " + std::to_string(i) + "\n");
+        pipelined += "ok " + std::to_string(i) + " x\n" + format_value(448501.0 + i) + "\nok\n";
+    }
+    CHECK(server_roundtrip(path, parts, std::chrono::microseconds(300)) == pipelined);
+
+    HandleTable handles;
+    CHECK(server.handle_request("def x * 2 + 1", handles) == "ok 1 x");
+    CHECK(server.handle_request("call 1 4", handles) == "(9,0)");
+    CHECK(server.handle_request("call x", handles) == "error: Invalid number: x");
+    server.stop();
+    loop.join();
+    CHECK(server.stats().connections == 7);
+    CHECK(server.stats().requests == 8 + 1 + 4 * 3001 + 20 * 3);
+}
+#endif